@@ -0,0 +1,429 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <system_error>
+
+#include "astrobench.hpp"
+
+#define MAX_EVENTS 256
+#define STAT_BUFSIZE 65536
+#define RECONNECT_DELAY 100000000 // ns
+
+#define FORECAST_MARK " astrobench "
+
+const char *status_name(int status) {
+	static const char *names[] = {"SUCCESS", "TIMEOUT",  "REFUSED", "EOF",
+	                              "ERROTHER", "MISMATCH", "DENIED"};
+	return (status >= 0 && status < ST_MAX) ? names[status] : "UNKNOWN";
+}
+
+const char *operation_name(int op) {
+	static const char *names[] = {"CONNECT", "MSG"};
+	return (op >= 0 && op < OP_MAX) ? names[op] : "UNKNOWN";
+}
+
+static int errno_status(int err) {
+	switch (err) {
+	case ETIMEDOUT:
+		return ST_TIMEOUT;
+	case ECONNREFUSED:
+		return ST_REFUSED;
+	case ECONNRESET:
+	case EPIPE:
+		return ST_EOF;
+	default:
+		return ST_ERROTHER;
+	}
+}
+
+uint64_t clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t wall_offset() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec - (int64_t) clock_ns();
+}
+
+//######################################################
+// StatWriter class
+StatWriter::StatWriter(FILE *out, const std::string &hostname,
+                       const std::string &address)
+    : out_(out), hostname_(hostname), address_(address) {}
+
+void StatWriter::add(std::string &buf, uint64_t timestamp_ms, int conn, int op,
+                     uint64_t duration_us, size_t size, int status) {
+	char line[256];
+	int  n = snprintf(line, sizeof(line),
+	                  "%" PRIu64 "\t%s\t%d\tTCP\t%s\t%s\t%" PRIu64 "\t%zu\t%s\n",
+	                  timestamp_ms, hostname_.c_str(), conn, address_.c_str(),
+	                  operation_name(op), duration_us, size, status_name(status));
+	if (n > 0)
+		buf.append(line, std::min((size_t) n, sizeof(line) - 1));
+	if (buf.size() >= STAT_BUFSIZE)
+		flush(buf);
+}
+
+void StatWriter::flush(std::string &buf) {
+	if (buf.empty())
+		return;
+	std::lock_guard<std::mutex> lock(mutex_);
+	fwrite(buf.data(), 1, buf.size(), out_);
+	buf.clear();
+}
+
+void Summary::merge(const Summary &s) {
+	for (int op = 0; op < OP_MAX; op++)
+		for (int st = 0; st < ST_MAX; st++)
+			count[op][st] += s.count[op][st];
+	lat_min = std::min(lat_min, s.lat_min);
+	lat_max = std::max(lat_max, s.lat_max);
+	lat_sum += s.lat_sum;
+}
+
+//######################################################
+// Worker class
+Worker::Worker(int id, int first_conn, int conns, const Config &config,
+               StatWriter *stat)
+    : id_(id), config_(config), stat_(stat), conns_(conns),
+      rnd_(std::random_device()() + id), wall_offset_(wall_offset()) {
+	if ((ep_fd_ = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		throw std::system_error(errno, std::generic_category(), "epoll_create");
+	interval_ = (uint64_t)(1e9 * config.connections / config.rate);
+	if (interval_ == 0)
+		interval_ = 1;
+	for (int i = 0; i < conns; i++)
+		conns_[i].id = first_conn + i;
+	if (stat_)
+		out_.reserve(STAT_BUFSIZE + 256);
+}
+
+Worker::~Worker() {
+	for (auto &c : conns_) {
+		if (c.fd != -1)
+			close(c.fd);
+	}
+	close(ep_fd_);
+}
+
+void Worker::record(Conn &c, int op, uint64_t start, uint64_t now, size_t size,
+                    int status) {
+	uint64_t duration_us = now > start ? (now - start) / 1000 : 0;
+	summary_.count[op][status]++;
+	if (op == OP_MSG && status == ST_SUCCESS) {
+		summary_.lat_sum += duration_us;
+		summary_.lat_min = std::min(summary_.lat_min, duration_us);
+		summary_.lat_max = std::max(summary_.lat_max, duration_us);
+	}
+	if (stat_)
+		stat_->add(out_, (uint64_t)((int64_t) start + wall_offset_) / 1000000,
+		           c.id, op, duration_us, size, status);
+}
+
+void Worker::update_events(Conn &c) {
+	bool               want_out = c.state == CONNECTING || c.wpos < c.wbuf.size();
+	struct epoll_event ev;
+	if (want_out == c.want_out)
+		return;
+	ev.events = EPOLLIN | (want_out ? (uint32_t) EPOLLOUT : 0);
+	ev.data.u32 = (uint32_t)(&c - conns_.data());
+	if (epoll_ctl(ep_fd_, EPOLL_CTL_MOD, c.fd, &ev) == 0)
+		c.want_out = want_out;
+}
+
+void Worker::connect(Conn &c, uint64_t now) {
+	struct epoll_event ev;
+	c.connect_start = now;
+	c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (c.fd == -1) {
+		record(c, OP_CONNECT, now, now, 0, errno_status(errno));
+		c.retry = now + RECONNECT_DELAY;
+		return;
+	}
+	if (::connect(c.fd, (struct sockaddr *) &config_.addr,
+	              sizeof(config_.addr)) == -1 &&
+	    errno != EINPROGRESS) {
+		int err = errno;
+		close(c.fd);
+		c.fd = -1;
+		record(c, OP_CONNECT, now, now, 0, errno_status(err));
+		if (config_.verbose)
+			std::cerr << "connect " << c.id << ": " << std::strerror(err)
+			          << "\n";
+		c.retry = now + RECONNECT_DELAY;
+		return;
+	}
+	c.state = CONNECTING;
+	c.want_out = true;
+	ev.events = EPOLLIN | EPOLLOUT;
+	ev.data.u32 = (uint32_t)(&c - conns_.data());
+	if (epoll_ctl(ep_fd_, EPOLL_CTL_ADD, c.fd, &ev) == -1)
+		fail(c, ST_ERROTHER, now);
+}
+
+void Worker::connected(Conn &c, uint64_t now) {
+	int       err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+		err = errno;
+	if (err) {
+		if (config_.verbose)
+			std::cerr << "connect " << c.id << ": " << std::strerror(err)
+			          << "\n";
+		fail(c, errno_status(err), now);
+		return;
+	}
+	record(c, OP_CONNECT, c.connect_start, now, 0, ST_SUCCESS);
+	c.state = UP;
+	/* requests are not sent while down, schedule continue from now */
+	if (c.next < now)
+		c.next = now;
+	update_events(c);
+}
+
+void Worker::fail(Conn &c, int status, uint64_t now) {
+	if (c.state == CONNECTING) {
+		record(c, OP_CONNECT, c.connect_start, now, 0, status);
+	} else {
+		// outstanding requests are lost with connection
+		for (auto &p : c.inflight)
+			record(c, OP_MSG, p.intended, now, 0, status);
+	}
+	c.inflight.clear();
+	c.wbuf.clear();
+	c.wpos = 0;
+	c.rlen = 0;
+	/* close also remove fd from epoll set */
+	close(c.fd);
+	c.fd = -1;
+	c.want_out = false;
+	c.state = DOWN;
+	c.retry = now + RECONNECT_DELAY;
+}
+
+// queue due requests, while pipeline is not full
+void Worker::schedule(Conn &c, uint64_t now, bool sending) {
+	std::uniform_int_distribution<int> sign_dist(0, ASTRO_SIGNS - 1);
+	std::uniform_int_distribution<int> pcnt_dist(0, 99);
+	while (sending && c.next <= now &&
+	       c.inflight.size() < (size_t) config_.depth) {
+		Pending p;
+		p.intended = c.next;
+		p.sent = now;
+		p.sign = sign_dist(rnd_);
+		p.cmd = pcnt_dist(rnd_) < config_.stars ? ASTRO_CMD_STARS_SAY
+		                                        : ASTRO_CMD_HOROSCOPE;
+		if (c.wpos == c.wbuf.size()) {
+			c.wbuf.clear();
+			c.wpos = 0;
+		}
+		if (p.cmd == ASTRO_CMD_STARS_SAY) {
+			char   forecast[ASTRO_FORECAST_SIZE + 1];
+			char   sign[ASTRO_SIGN_SIZE + 1];
+			size_t len;
+			sscanf(astro_sign_name(p.sign), "%11s", sign);
+			len = snprintf(forecast, sizeof(forecast),
+			               "%s" FORECAST_MARK "%d.%" PRIu64, sign, c.id,
+			               c.seq++);
+			memset(forecast + len, ' ', ASTRO_FORECAST_SIZE - 1 - len);
+			forecast[ASTRO_FORECAST_SIZE - 1] = '\n';
+			c.wbuf.append(ASTRO_STARS_SAY, ASTRO_CMD_SIZE);
+			c.wbuf.append(astro_sign_name(p.sign), ASTRO_SIGN_SIZE);
+			c.wbuf.push_back('\n');
+			c.wbuf.append(forecast, ASTRO_FORECAST_SIZE);
+		} else {
+			c.wbuf.append(ASTRO_HOROSCOPE, ASTRO_CMD_SIZE);
+			c.wbuf.append(astro_sign_name(p.sign), ASTRO_SIGN_SIZE);
+			c.wbuf.push_back('\n');
+		}
+		c.inflight.push_back(p);
+		c.next += interval_;
+	}
+}
+
+void Worker::flush(Conn &c, uint64_t now) {
+	while (c.wpos < c.wbuf.size()) {
+		ssize_t n = send(c.fd, c.wbuf.data() + c.wpos, c.wbuf.size() - c.wpos,
+		                 MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				fail(c, errno_status(errno), now);
+			break;
+		}
+		c.wpos += n;
+	}
+	if (c.fd != -1)
+		update_events(c);
+}
+
+// forecast must be "<Sign> astrobench ..." of requested sign or foreign one
+static bool forecast_valid(const char *rec, int sign) {
+	const char *name = astro_sign_name(sign);
+	const char *mark;
+	size_t      len = strcspn(name, " ");
+	if (rec[ASTRO_FORECAST_SIZE - 1] != '\n')
+		return false;
+	mark = (const char *) memmem(rec, ASTRO_FORECAST_SIZE, FORECAST_MARK,
+	                             sizeof(FORECAST_MARK) - 1);
+	if (mark == NULL)
+		return true; // not our star, only format is checked
+	return (size_t)(mark - rec) == len && memcmp(rec, name, len) == 0;
+}
+
+void Worker::read(Conn &c, uint64_t now) {
+	for (;;) {
+		ssize_t n = recv(c.fd, c.rbuf + c.rlen, sizeof(c.rbuf) - c.rlen, 0);
+		size_t  pos = 0;
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				fail(c, errno_status(errno), now);
+			return;
+		} else if (n == 0) {
+			if (config_.verbose && !c.inflight.empty())
+				std::cerr << "connection " << c.id << " closed with "
+				          << c.inflight.size() << " requests\n";
+			fail(c, ST_EOF, now);
+			return;
+		}
+		c.rlen += n;
+		while (!c.inflight.empty()) {
+			Pending &p = c.inflight.front();
+			size_t   need = p.cmd == ASTRO_CMD_HOROSCOPE ? ASTRO_FORECAST_SIZE
+			                                             : ASTRO_REPLY_SIZE;
+			int      status = ST_SUCCESS;
+			if (c.rlen - pos < need)
+				break;
+			if (p.cmd == ASTRO_CMD_HOROSCOPE) {
+				if (!forecast_valid(c.rbuf + pos, p.sign))
+					status = ST_MISMATCH;
+			} else if (memcmp(c.rbuf + pos, ASTRO_DENIED, need) == 0) {
+				status = ST_DENIED;
+			} else if (memcmp(c.rbuf + pos, ASTRO_THANKS, need) != 0) {
+				status = ST_MISMATCH;
+			}
+			if (status == ST_MISMATCH) {
+				if (config_.verbose)
+					std::cerr << "connection " << c.id << ": invalid response '"
+					          << std::string(c.rbuf + pos,
+					                         strnlen(c.rbuf + pos, need))
+					          << "'\n";
+				// stream is out of sync, drop connection
+				record(c, OP_MSG, p.intended, now, need, status);
+				c.inflight.pop_front();
+				fail(c, ST_MISMATCH, now);
+				return;
+			}
+			record(c, OP_MSG, p.intended, now, need, status);
+			c.inflight.pop_front();
+			pos += need;
+		}
+		if (c.inflight.empty() && c.rlen > pos) {
+			if (config_.verbose)
+				std::cerr << "connection " << c.id << ": unexpected data\n";
+			fail(c, ST_MISMATCH, now);
+			return;
+		}
+		c.rlen -= pos;
+		memmove(c.rbuf, c.rbuf + pos, c.rlen);
+	}
+}
+
+void Worker::run(uint64_t start, const std::atomic<bool> &running) {
+	struct epoll_event events[MAX_EVENTS];
+	uint64_t           end = start + (uint64_t) config_.duration * 1000000000;
+	uint64_t           timeout = (uint64_t) config_.timeout * 1000000;
+	uint64_t           con_timeout = (uint64_t) config_.con_timeout * 1000000;
+	uint64_t           now = clock_ns();
+
+	// spread connections over interval, so requests are not bursts
+	for (size_t i = 0; i < conns_.size(); i++) {
+		conns_[i].next = start + interval_ * i / conns_.size();
+		conns_[i].retry = start;
+	}
+
+	while (running) {
+		bool     sending = now < end;
+		bool     pending = false;
+		uint64_t wake = now + 100000000;
+		int      n;
+
+		for (auto &c : conns_) {
+			if (c.state == DOWN) {
+				if (sending && c.retry <= now)
+					connect(c, now);
+			} else if (c.state == CONNECTING) {
+				if (now - c.connect_start >= con_timeout)
+					fail(c, ST_TIMEOUT, now);
+			} else {
+				if (!c.inflight.empty() &&
+				    now - c.inflight.front().sent >= timeout) {
+					fail(c, ST_TIMEOUT, now);
+					continue;
+				}
+				schedule(c, now, sending);
+				if (c.wpos < c.wbuf.size())
+					flush(c, now);
+			}
+			if (c.state == DOWN) {
+				if (sending)
+					wake = std::min(wake, c.retry);
+			} else {
+				if (!c.inflight.empty())
+					pending = true;
+				if (sending && c.state == UP &&
+				    c.inflight.size() < (size_t) config_.depth)
+					wake = std::min(wake, c.next);
+			}
+		}
+		if (!sending && !pending)
+			break; // all responses received (or failed)
+
+		n = epoll_wait(ep_fd_, events, MAX_EVENTS,
+		               wake > now ? (int) ((wake - now + 999999) / 1000000) : 0);
+		if (n == -1) {
+			if (errno != EINTR) {
+				std::cerr << "epoll_wait: " << std::strerror(errno) << "\n";
+				break;
+			}
+			n = 0;
+		}
+		now = clock_ns();
+		for (int i = 0; i < n; i++) {
+			Conn &c = conns_[events[i].data.u32];
+			if (c.fd == -1)
+				continue;
+			if (c.state == CONNECTING) {
+				connected(c, now);
+				if (c.state != UP)
+					continue;
+			}
+			if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				read(c, now);
+			if (c.fd != -1 && (events[i].events & EPOLLOUT))
+				flush(c, now);
+		}
+	}
+	// interrupted, outstanding requests are lost
+	for (auto &c : conns_) {
+		if (c.state == UP && !c.inflight.empty())
+			fail(c, ST_EOF, now);
+	}
+	if (stat_)
+		stat_->flush(out_);
+}
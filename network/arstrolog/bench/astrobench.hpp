@@ -0,0 +1,148 @@
+#ifndef _ASTROLOG_ASTROBENCH_HPP_
+#define _ASTROLOG_ASTROBENCH_HPP_
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <astroproto.h>
+
+/*
+ * Open-loop astrolog client: every connection sends requests on own fixed
+ * schedule (rate / connections), without waiting for responses, up to
+ * pipeline depth outstanding requests. Latency is measured from scheduled
+ * send time, so request delayed by full pipeline (slow server) is counted
+ * with the time it waited (no coordinated omission).
+ *
+ * Star forecasts are "<Sign> astrobench <CONN>.<SEQ>", so forecast of other
+ * sign in HOROSCOPE response (reordered or lost response) is MISMATCH.
+ */
+
+enum Status {
+	ST_SUCCESS = 0,
+	ST_TIMEOUT,  // connect or response timeout
+	ST_REFUSED,  // connection refused
+	ST_EOF,      // connection closed or reset
+	ST_ERROTHER, // other socket error
+	ST_MISMATCH, // protocol violation in response
+	ST_DENIED,   // STARS SAY answered by DENIED! (proxy)
+	ST_MAX
+};
+
+const char *status_name(int status);
+
+enum Operation { OP_CONNECT = 0, OP_MSG, OP_MAX };
+
+const char *operation_name(int op);
+
+struct Config {
+	std::string        address; // IP:PORT for stat
+	struct sockaddr_in addr;
+	int                workers;     // threads
+	int                connections; // all workers
+	double             rate;        // requests per second, all connections
+	int                depth;       // outstanding requests per connection
+	int                stars;       // STARS SAY percent
+	int                duration;    // s
+	int                con_timeout; // ms
+	int                timeout;     // response timeout, ms
+	bool               verbose;
+};
+
+// TSV in statplot format, shared by workers
+class StatWriter {
+  public:
+	StatWriter(FILE *out, const std::string &hostname,
+	           const std::string &address);
+
+	// append record to worker buffer, flush buffer when full
+	void add(std::string &buf, uint64_t timestamp_ms, int conn, int op,
+	         uint64_t duration_us, size_t size, int status);
+	void flush(std::string &buf);
+
+  private:
+	FILE *      out_;
+	std::string hostname_;
+	std::string address_;
+	std::mutex  mutex_;
+};
+
+struct Summary {
+	uint64_t count[OP_MAX][ST_MAX] = {};
+	uint64_t lat_min = UINT64_MAX; // MSG success latency, us
+	uint64_t lat_max = 0;
+	uint64_t lat_sum = 0;
+
+	void merge(const Summary &s);
+};
+
+class Worker {
+  public:
+	Worker(int id, int first_conn, int conns, const Config &config,
+	       StatWriter *stat);
+	~Worker();
+
+	// event loop until duration end (and responses drain) or stop
+	void run(uint64_t start, const std::atomic<bool> &running);
+
+	const Summary &summary() const { return summary_; }
+
+  private:
+	enum ConnState { DOWN, CONNECTING, UP };
+
+	struct Pending {
+		uint64_t intended; // scheduled send time, ns
+		uint64_t sent;     // ns, for response timeout
+		int      cmd;
+		int      sign;
+	};
+
+	struct Conn {
+		int                 id;
+		int                 fd = -1;
+		ConnState           state = DOWN;
+		uint64_t            connect_start = 0;
+		uint64_t            retry = 0; // reconnect time
+		uint64_t            next = 0;  // next scheduled request
+		uint64_t            seq = 0;   // star forecasts counter
+		std::deque<Pending> inflight;
+		std::string         wbuf;
+		size_t              wpos = 0;
+		bool                want_out = false;
+		size_t              rlen = 0;
+		char                rbuf[4096];
+	};
+
+	void connect(Conn &c, uint64_t now);
+	void connected(Conn &c, uint64_t now);
+	void fail(Conn &c, int status, uint64_t now);
+	void schedule(Conn &c, uint64_t now, bool sending);
+	void flush(Conn &c, uint64_t now);
+	void read(Conn &c, uint64_t now);
+	void update_events(Conn &c);
+	void record(Conn &c, int op, uint64_t start, uint64_t now, size_t size,
+	            int status);
+
+	int                   id_;
+	const Config &        config_;
+	StatWriter *          stat_;
+	int                   ep_fd_;
+	uint64_t              interval_; // ns between requests of connection
+	std::vector<Conn>     conns_;
+	std::string           out_; // stat buffer
+	Summary               summary_;
+	std::mt19937          rnd_;
+	int64_t               wall_offset_; // realtime - monotonic, ns
+};
+
+// monotonic clock, ns
+uint64_t clock_ns();
+
+#endif /* _ASTROLOG_ASTROBENCH_HPP_ */
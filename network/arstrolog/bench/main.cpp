@@ -0,0 +1,246 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "astrobench.hpp"
+
+std::atomic<bool> running(true);
+
+void sig_handler(int) { running = false; }
+
+void usage(const char *name) {
+	std::cerr << "Usage: " << name << " [options]\n"
+	          << "\t-a | --address <IP:PORT> astrolog or proxy (default 127.0.0.1:1234)\n"
+	          << "\t-w | --workers <N> threads (default 1)\n"
+	          << "\t-c | --connections <N> connections (default 10)\n"
+	          << "\t-r | --rate <N> requests per second, all connections (default 1000)\n"
+	          << "\t-d | --depth <N> pipelined requests per connection (default 1)\n"
+	          << "\t-s | --stars <PERCENT> STARS SAY requests (default 10)\n"
+	          << "\t-D | --duration <SEC> test duration (default 10)\n"
+	          << "\t-C | --connect-timeout <MS> (default 200)\n"
+	          << "\t-t | --timeout <MS> response timeout (default 1000)\n"
+	          << "\t-o | --stat <FILE> per request stat for statplot (not overwritten)\n"
+	          << "\t-v | --verbose\n";
+}
+
+static int parse_addr(const char *s, Config &config) {
+	char        ip[INET_ADDRSTRLEN];
+	const char *colon = strrchr(s, ':');
+	int         port;
+	if (colon == NULL || (size_t)(colon - s) >= sizeof(ip))
+		return -1;
+	memcpy(ip, s, colon - s);
+	ip[colon - s] = '\0';
+	port = std::atoi(colon + 1);
+	if (port <= 0 || port > 65535)
+		return -1;
+	memset(&config.addr, 0, sizeof(config.addr));
+	config.addr.sin_family = AF_INET;
+	config.addr.sin_port = htons(port);
+	if (inet_aton(ip, &config.addr.sin_addr) == 0)
+		return -1;
+	config.address = s;
+	return 0;
+}
+
+static void rfc3339(FILE *out) {
+	char      buf[64];
+	time_t    t = time(NULL);
+	struct tm tm;
+	strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S%z", localtime_r(&t, &tm));
+	fprintf(out, "#%s\n", buf);
+}
+
+static void dump_config(FILE *out, const Config &config) {
+	fprintf(out, "#duration: %ds\n", config.duration);
+	fprintf(out, "#address: %s\n", config.address.c_str());
+	fprintf(out, "#workers: %d\n", config.workers);
+	fprintf(out, "#connections: %d\n", config.connections);
+	fprintf(out, "#rate: %g per second\n", config.rate);
+	fprintf(out, "#depth: %d per connection\n", config.depth);
+	fprintf(out, "#stars: %d%%\n", config.stars);
+	fprintf(out, "#connect timeout: %dms\n", config.con_timeout);
+	fprintf(out, "#recv timeout: %dms\n", config.timeout);
+	fprintf(out, "#timestamp(ns)\ttesthost\tsession\tproto\tremote_address\toper"
+	             "\tduration(us)\tsize\tstatus\n");
+}
+
+static void print_summary(const Summary &s, const Config &config) {
+	uint64_t msgs = 0, ok = s.count[OP_MSG][ST_SUCCESS];
+	for (int op = 0; op < OP_MAX; op++) {
+		bool any = false;
+		for (int st = 0; st < ST_MAX; st++) {
+			if (s.count[op][st] == 0)
+				continue;
+			std::cerr << (any ? ", " : std::string(operation_name(op)) + ": ")
+			          << status_name(st) << " " << s.count[op][st];
+			any = true;
+			if (op == OP_MSG)
+				msgs += s.count[op][st];
+		}
+		if (any)
+			std::cerr << "\n";
+	}
+	std::cerr << "rate: " << msgs / config.duration << " per second\n";
+	if (ok > 0)
+		std::cerr << "latency (us): min " << s.lat_min << ", avg "
+		          << s.lat_sum / ok << ", max " << s.lat_max << "\n";
+}
+
+int main(int argc, char *argv[]) {
+	Config      config;
+	const char *stat_file = nullptr;
+	FILE *      stat_out = nullptr;
+	char        hostname[256];
+	int         opt;
+
+	parse_addr("127.0.0.1:1234", config);
+	config.workers = 1;
+	config.connections = 10;
+	config.rate = 1000;
+	config.depth = 1;
+	config.stars = 10;
+	config.duration = 10;
+	config.con_timeout = 200;
+	config.timeout = 1000;
+	config.verbose = false;
+
+	const char *         opts = "ha:w:c:r:d:s:D:C:t:o:v";
+	const struct option long_opts[] = {
+	    {"help", no_argument, 0, 'h'},
+	    {"address", required_argument, 0, 'a'},
+	    {"workers", required_argument, 0, 'w'},
+	    {"connections", required_argument, 0, 'c'},
+	    {"rate", required_argument, 0, 'r'},
+	    {"depth", required_argument, 0, 'd'},
+	    {"stars", required_argument, 0, 's'},
+	    {"duration", required_argument, 0, 'D'},
+	    {"connect-timeout", required_argument, 0, 'C'},
+	    {"timeout", required_argument, 0, 't'},
+	    {"stat", required_argument, 0, 'o'},
+	    {"verbose", no_argument, 0, 'v'},
+	    {0, 0, 0, 0}};
+
+	while ((opt = getopt_long(argc, argv, opts, long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'a':
+			if (parse_addr(optarg, config) == -1) {
+				std::cerr << "invalid address: " << optarg << "\n";
+				return 1;
+			}
+			break;
+		case 'w':
+			config.workers = std::atoi(optarg);
+			break;
+		case 'c':
+			config.connections = std::atoi(optarg);
+			break;
+		case 'r':
+			config.rate = std::atof(optarg);
+			break;
+		case 'd':
+			config.depth = std::atoi(optarg);
+			break;
+		case 's':
+			config.stars = std::atoi(optarg);
+			break;
+		case 'D':
+			config.duration = std::atoi(optarg);
+			break;
+		case 'C':
+			config.con_timeout = std::atoi(optarg);
+			break;
+		case 't':
+			config.timeout = std::atoi(optarg);
+			break;
+		case 'o':
+			stat_file = optarg;
+			break;
+		case 'v':
+			config.verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc || config.workers < 1 || config.connections < 1 ||
+	    config.rate <= 0 || config.depth < 1 || config.stars < 0 ||
+	    config.stars > 100 || config.duration < 1 || config.con_timeout < 1 ||
+	    config.timeout < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (config.connections < config.workers)
+		config.workers = config.connections;
+
+	if (stat_file) {
+		struct stat st;
+		if (stat(stat_file, &st) == 0) {
+			std::cerr << stat_file << " already exists\n";
+			return 1;
+		}
+		if ((stat_out = fopen(stat_file, "w")) == NULL) {
+			std::cerr << stat_file << ": " << std::strerror(errno) << "\n";
+			return 1;
+		}
+		dump_config(stat_out, config);
+	}
+	if (gethostname(hostname, sizeof(hostname)) == -1)
+		strcpy(hostname, "localhost");
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	int ec = 0;
+	try {
+		StatWriter writer(stat_out, hostname, config.address);
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::thread>             threads;
+		Summary                              summary;
+		int count = config.connections / config.workers;
+		int extra = config.connections % config.workers;
+		int first = 0;
+		for (int i = 0; i < config.workers; i++) {
+			int n = count + (i < extra ? 1 : 0);
+			workers.emplace_back(new Worker(i, first, n, config,
+			                                stat_out ? &writer : nullptr));
+			first += n;
+		}
+		if (stat_out)
+			rfc3339(stat_out);
+		uint64_t start = clock_ns();
+		for (auto &w : workers)
+			threads.emplace_back([&w, start]() { w->run(start, running); });
+		for (auto &t : threads)
+			t.join();
+		for (auto &w : workers)
+			summary.merge(w->summary());
+		print_summary(summary, config);
+		// protocol violation is regression
+		if (summary.count[OP_MSG][ST_MISMATCH] > 0)
+			ec = 2;
+	} catch (std::exception &e) {
+		std::cerr << "Exception: " << e.what() << "\n";
+		ec = 1;
+	}
+	if (stat_out) {
+		rfc3339(stat_out);
+		fclose(stat_out);
+	}
+	return ec;
+}
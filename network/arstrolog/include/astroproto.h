@@ -0,0 +1,69 @@
+#ifndef _ASTROLOG_ASTROPROTO_H_
+#define _ASTROLOG_ASTROPROTO_H_
+
+#include <sys/types.h>
+
+/*
+ * Astrolog protocol: fixed size records, last byte is '\n'.
+ *
+ * > HOROSCOPE ZZ         (22 bytes, sign padded with spaces to 11 chars)
+ * < forecast             (80 bytes)
+ *
+ * > STARS SAY ZZ         (22 bytes)
+ * > forecast             (80 bytes)
+ * < THANKS!              (8 bytes, DENIED! if forbidden)
+ *
+ * > SUBSCRIBE ZZ         (22 bytes)
+ * < forecast             (80 bytes, current)
+ * < forecast             (80 bytes, pushed on each STARS SAY for ZZ)
+ *
+ * Several requests may be sent without waiting for responses (pipelined).
+ * Invalid request close connection.
+ */
+
+#define ASTRO_REQ_SIZE 22
+#define ASTRO_CMD_SIZE 10 /* "HOROSCOPE ", "STARS SAY ", "SUBSCRIBE " */
+#define ASTRO_SIGN_SIZE 11
+#define ASTRO_FORECAST_SIZE 80
+#define ASTRO_REPLY_SIZE 8
+#define ASTRO_SIGNS 12
+
+#define ASTRO_HOROSCOPE "HOROSCOPE "
+#define ASTRO_STARS_SAY "STARS SAY "
+#define ASTRO_SUBSCRIBE "SUBSCRIBE "
+#define ASTRO_THANKS "THANKS!\n"
+#define ASTRO_DENIED "DENIED!\n"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum astro_cmd {
+    ASTRO_CMD_HOROSCOPE = 0,
+    ASTRO_CMD_STARS_SAY,
+    ASTRO_CMD_SUBSCRIBE
+};
+
+struct astro_req {
+    int cmd;
+    int sign;
+    const char *forecast; /* STARS SAY, points into parsed buffer */
+};
+
+/* sign index for padded sign field (ASTRO_SIGN_SIZE bytes), -1 if invalid */
+int astro_sign(const char *field);
+
+const char *astro_sign_name(int sign);
+
+/*
+ * Parse one request record (with forecast for STARS SAY) at BUF. Nothing is
+ * copied, REQ point into BUF. Return consumed bytes, 0 if record is
+ * incomplete, -1 if invalid (detected by available prefix).
+ */
+ssize_t astro_parse(const char *buf, size_t len, struct astro_req *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _ASTROLOG_ASTROPROTO_H_ */
@@ -0,0 +1,62 @@
+#ifndef _ASTROLOG_ASTROPROXY_H_
+#define _ASTROLOG_ASTROPROXY_H_
+
+#include <arpa/inet.h>
+
+/*
+ * Secretary: STARS SAY and SUBSCRIBE are answered by DENIED! locally,
+ * HOROSCOPE is forwarded to astrolog over small pool of persistent upstream
+ * connections.
+ * Requests of all clients are pipelined into pool connections, responses
+ * are fixed size records, so they are matched to requests in FIFO order.
+ * Forecasts are cached for ttl and concurrent misses of sign are coalesced
+ * into one upstream request.
+ *
+ * With several astrolog backends request goes to less loaded (in-flight
+ * requests) of two random backends (power of two choices). Failed or timed
+ * out backend is ejected for a while (doubled on repeated failures), and
+ * requests in flight on failed connection are retried once on other backend.
+ *
+ * Optional hedging: request without response for percentile of recent
+ * upstream latency is duplicated to other backend, first response is used
+ * and late one is dropped. Hedges are limited by budget, percent of upstream
+ * requests.
+ */
+
+#define SESSION_TIMEOUT 60 /* idle session timeout (s) */
+
+#define CACHE_TTL 1000 /* forecast cache ttl (ms) */
+
+#define UPSTREAM_CONNECTIONS 4
+#define MAX_UPSTREAM_CONNECTIONS 64
+#define MAX_BACKENDS 16
+
+#define UPSTREAM_TIMEOUT 2000 /* upstream response timeout (ms) */
+#define EJECT_TIME 1000       /* first ejection of failed backend (ms) */
+#define MAX_EJECT_TIME 30000
+
+#define HEDGE_BUDGET 5 /* max hedges, percent of upstream requests */
+
+struct config {
+    char *ip;
+    int port;
+    struct sockaddr_in backends[MAX_BACKENDS]; /* astrolog addresses */
+    int nbackends;
+    int connections;        /* upstream connections per backend */
+    int timeout;            /* idle session timeout (s) */
+    int up_timeout;         /* upstream response timeout (ms) */
+    unsigned int cache_ttl; /* forecast cache ttl (ms), 0 - don't cache */
+    double hedge;           /* hedge delay percentile, 0 - don't hedge */
+    int hedge_budget;       /* percent of upstream requests */
+};
+
+extern int running;
+extern int stats_dump; /* log cache counters (SIGUSR1) */
+
+/* parse IP:PORT, return -1 if invalid */
+int parse_addr(const char *s, struct sockaddr_in *addr);
+
+/* event loop over clients and upstream pool */
+int proxy_loop(int srv_fd, const struct config *conf);
+
+#endif /* _ASTROLOG_ASTROPROXY_H_ */
@@ -0,0 +1,31 @@
+#ifndef _ASTROLOG_ASTROSRV_H_
+#define _ASTROLOG_ASTROSRV_H_
+
+#include <srvcommon/affinity.h>
+
+#include "forecast.h"
+#include "subscribe.h"
+
+#define SESSION_TIMEOUT 60 /* idle session timeout (s) */
+
+#define MAX_WORKERS 256
+
+struct config {
+    char *ip;
+    int port;
+    int workers;              /* event loop processes, one per core */
+    int timeout;              /* idle session timeout (s) */
+    struct affinity affinity; /* workers placement */
+    const char *store;        /* forecasts file, NULL - memory only */
+};
+
+extern int running;
+
+/* shared by all workers */
+extern struct forecast_table *forecasts;
+extern struct sub_table *subscriptions;
+
+/* epoll event loop over non-blocking sessions, run in worker process IDX */
+int worker_loop(int idx, int srv_fd, const struct config *conf);
+
+#endif /* _ASTROLOG_ASTROSRV_H_ */
@@ -0,0 +1,71 @@
+#ifndef _ASTROLOG_FORECAST_H_
+#define _ASTROLOG_FORECAST_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "astroproto.h"
+
+#define FORECAST_CACHE_LINE 64
+
+#define FORECAST_MAGIC "ASTROFC" /* store file signature (with '\0') */
+#define FORECAST_VERSION 1
+
+/*
+ * Forecast for each sign under own seqlock: sequence is odd while star
+ * forecast is written. Reader copy forecast and retry only if write
+ * overlapped copy, so readers never lock and never block writer.
+ * Writers of one sign are serialized by sequence CAS.
+ * Table is in shared mmap, forked workers use it too. With store file
+ * mapping is file backed, so STARS SAY update file in place and restart
+ * map saved forecasts back without replay. Entry with odd sequence (writer
+ * died) or bad checksum is reset to "unlucky" forecast on open.
+ */
+struct forecast_entry {
+    atomic_uint seq;
+    uint32_t sum; /* text checksum, written under odd sequence */
+    char text[ASTRO_FORECAST_SIZE];
+} __attribute__((aligned(FORECAST_CACHE_LINE)));
+
+struct forecast_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t signs;
+    uint32_t entry_size;
+} __attribute__((aligned(FORECAST_CACHE_LINE)));
+
+struct forecast_table {
+    struct forecast_header hdr;
+    struct forecast_entry sign[ASTRO_SIGNS];
+};
+
+/*
+ * Map table from store PATH (created if not exist or incompatible) or
+ * anonymous if PATH is NULL. Forecast is "unlucky" until star say it.
+ * RESTORED (if not NULL) is set to count of forecasts loaded from store.
+ * Return NULL on error (errno is set).
+ */
+struct forecast_table *forecast_create(const char *path, int *restored);
+
+void forecast_destroy(struct forecast_table *t);
+
+/*
+ * Schedule write back of updated forecasts to store (MS_ASYNC),
+ * or write and wait if WAIT. No-op for anonymous table or without updates.
+ */
+int forecast_sync(struct forecast_table *t, int wait);
+
+/*
+ * Copy consistent forecast (ASTRO_FORECAST_SIZE bytes) to DST, return its
+ * sequence (changed by each write).
+ */
+unsigned int forecast_read(const struct forecast_table *t, int sign,
+                           char *dst);
+
+/* current sequence of sign forecast, without copy */
+unsigned int forecast_seq(const struct forecast_table *t, int sign);
+
+/* publish forecast (ASTRO_FORECAST_SIZE bytes) atomically for readers */
+void forecast_write(struct forecast_table *t, int sign, const char *text);
+
+#endif /* _ASTROLOG_FORECAST_H_ */
@@ -0,0 +1,41 @@
+#ifndef _ASTROLOG_SUBSCRIBE_H_
+#define _ASTROLOG_SUBSCRIBE_H_
+
+#include <stdatomic.h>
+
+#include "forecast.h"
+
+/*
+ * SUBSCRIBE fan-out between workers: STARS SAY may come to any worker, and
+ * subscribers of sign may be in any worker. Worker publish count of own
+ * subscribers per sign, writer wake up workers with subscribers of updated
+ * signs by eventfd (once, until worker drain it). Woken worker compare
+ * forecast sequences with last pushed and push changed forecasts to own
+ * subscribers. Table is in anonymous shared mmap, created before fork.
+ */
+struct sub_worker {
+    atomic_uint subscribers[ASTRO_SIGNS];
+    atomic_int notified; /* eventfd is signaled and not drained yet */
+    int efd;
+} __attribute__((aligned(FORECAST_CACHE_LINE)));
+
+struct sub_table {
+    int workers;
+    struct sub_worker worker[];
+};
+
+/* return NULL on error (errno is set) */
+struct sub_table *sub_create(int workers);
+
+void sub_destroy(struct sub_table *t);
+
+/* forget subscribers of died worker */
+void sub_reset(struct sub_table *t, int worker);
+
+/* wake up workers with subscribers of signs in mask (bit per sign) */
+void sub_notify(struct sub_table *t, unsigned int signs);
+
+/* clear worker wake up, before forecasts check */
+void sub_drain(struct sub_table *t, int worker);
+
+#endif /* _ASTROLOG_SUBSCRIBE_H_ */
@@ -0,0 +1,86 @@
+#!/bin/sh
+
+# Run astroproxy over several local astrosrv backends under astrobench load.
+# In the middle of the test one backend is stopped (SIGSTOP) for STALL
+# seconds, so it stops answering but keeps connections: proxy must eject it
+# by response timeout and retry in-flight requests on other backends
+# (or hedge them before timeout with HEDGE).
+# Client statistic saved in OUT_DIR/multibackend.txt (process with statplot),
+# proxy backend counters are logged to OUT_DIR/astroproxy.log.
+
+[ -z "$1" -o -z "$2" -o -z "$3" -o -z "$4" ] && {
+	echo "use: $0 astrosrv astroproxy astrobench out_dir [astrobench options]" >&2
+	echo "env: PORT (default 1235), BACKENDS (default 3), BACKEND_PORT (default 1240)," >&2
+	echo "     DURATION (default 30), STALL (default 5), RATE (default 10000)," >&2
+	echo "     RESPONSE_TIMEOUT (default 200), CACHE_TTL (default 0)," >&2
+	echo "     HEDGE percentile (default 0 - off), HEDGE_BUDGET (default 5)" >&2
+	exit 1
+}
+
+SRV="$1"
+PROXY="$2"
+BENCH="$3"
+OUT="$4"
+shift 4
+
+PORT=${PORT:-1235}
+BACKENDS=${BACKENDS:-3}
+BACKEND_PORT=${BACKEND_PORT:-1240}
+DURATION=${DURATION:-30}
+STALL=${STALL:-5}
+RATE=${RATE:-10000}
+RESPONSE_TIMEOUT=${RESPONSE_TIMEOUT:-200}
+CACHE_TTL=${CACHE_TTL:-0}
+HEDGE=${HEDGE:-0}
+HEDGE_BUDGET=${HEDGE_BUDGET:-5}
+
+mkdir -p "${OUT}" || exit 1
+stat="${OUT}/multibackend.txt"
+[ -e "${stat}" ] && {
+	echo "${stat} already exists" >&2
+	exit 1
+}
+
+pids=""
+upstreams=""
+i=0
+while [ ${i} -lt ${BACKENDS} ]; do
+	port=$((BACKEND_PORT + i))
+	"${SRV}" -p ${port} -w 1 -L "${OUT}/astrosrv-${port}.log" &
+	pids="${pids} $!"
+	upstreams="${upstreams} -u 127.0.0.1:${port}"
+	i=$((i + 1))
+done
+sleep 1
+
+"${PROXY}" -p ${PORT} ${upstreams} -R ${RESPONSE_TIMEOUT} -T ${CACHE_TTL} \
+	-H ${HEDGE} -B ${HEDGE_BUDGET} -L "${OUT}/astroproxy.log" &
+proxy=$!
+sleep 1
+for pid in ${pids} ${proxy}; do
+	kill -0 ${pid} 2>/dev/null || {
+		echo "server start failed" >&2
+		kill ${pids} ${proxy} 2>/dev/null
+		exit 1
+	}
+done
+
+"${BENCH}" -a 127.0.0.1:${PORT} -r ${RATE} -D ${DURATION} -o "${stat}" "$@" &
+bench=$!
+
+# stall first backend (master and worker processes) in the middle of the test
+stalled=$(echo ${pids} | cut -d ' ' -f 1)
+stalled="${stalled} $(pgrep -P ${stalled} | tr '\n' ' ')"
+sleep $(((DURATION - STALL) / 2))
+echo "stop backend 127.0.0.1:${BACKEND_PORT} for ${STALL}s"
+kill -STOP ${stalled}
+sleep ${STALL}
+kill -CONT ${stalled}
+
+wait ${bench}
+ec=$?
+kill -USR1 ${proxy}
+sleep 1
+kill ${proxy} ${pids}
+wait
+exit ${ec}
@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "astroproto.h"
+
+/* padded to ASTRO_SIGN_SIZE, compared as whole field */
+static const char sign_names[ASTRO_SIGNS][ASTRO_SIGN_SIZE + 1] = {
+    "Aries      ", "Taurus     ", "Gemini     ", "Cancer     ",
+    "Leo        ", "Virgo      ", "Libra      ", "Scorpio    ",
+    "Sagittarius", "Capricorn  ", "Aquarius   ", "Pisces     "};
+
+/*
+ * Perfect hash (f[0] + f[2]) & 31 of sign names, collision free for this
+ * set. Slot is sign index or -1, match is checked by one memcmp.
+ */
+#define SIGN_HASH(f) (((unsigned char) (f)[0] + (unsigned char) (f)[2]) & 31)
+
+static const signed char sign_slots[32] = {
+    -1, -1, 7,  11, -1, -1, -1, -1, 5,  1,  0,  -1, -1, -1, 6,  -1,
+    -1, 3,  -1, 9,  2,  -1, 10, -1, -1, -1, 8,  4,  -1, -1, -1, -1};
+
+int astro_sign(const char *field) {
+    int sign = sign_slots[SIGN_HASH(field)];
+    if (sign == -1 || memcmp(field, sign_names[sign], ASTRO_SIGN_SIZE) != 0)
+        return -1;
+    return sign;
+}
+
+const char *astro_sign_name(int sign) {
+    if (sign < 0 || sign >= ASTRO_SIGNS)
+        return "unknown";
+    return sign_names[sign];
+}
+
+ssize_t astro_parse(const char *buf, size_t len, struct astro_req *req) {
+    size_t need;
+
+    if (len < ASTRO_CMD_SIZE) {
+        /* fail fast on garbage, before full record */
+        if (memcmp(buf, ASTRO_HOROSCOPE, len) != 0 &&
+            memcmp(buf, ASTRO_STARS_SAY, len) != 0 &&
+            memcmp(buf, ASTRO_SUBSCRIBE, len) != 0)
+            return -1;
+        return 0;
+    }
+    if (memcmp(buf, ASTRO_HOROSCOPE, ASTRO_CMD_SIZE) == 0) {
+        req->cmd = ASTRO_CMD_HOROSCOPE;
+        need = ASTRO_REQ_SIZE;
+    } else if (memcmp(buf, ASTRO_STARS_SAY, ASTRO_CMD_SIZE) == 0) {
+        req->cmd = ASTRO_CMD_STARS_SAY;
+        need = ASTRO_REQ_SIZE + ASTRO_FORECAST_SIZE;
+    } else if (memcmp(buf, ASTRO_SUBSCRIBE, ASTRO_CMD_SIZE) == 0) {
+        req->cmd = ASTRO_CMD_SUBSCRIBE;
+        need = ASTRO_REQ_SIZE;
+    } else {
+        return -1;
+    }
+    if (len < ASTRO_REQ_SIZE)
+        return 0;
+    if (buf[ASTRO_REQ_SIZE - 1] != '\n' ||
+        (req->sign = astro_sign(buf + ASTRO_CMD_SIZE)) == -1)
+        return -1;
+    if (len < need)
+        return 0;
+    if (req->cmd == ASTRO_CMD_STARS_SAY) {
+        if (buf[need - 1] != '\n')
+            return -1;
+        req->forecast = buf + ASTRO_REQ_SIZE;
+    } else {
+        req->forecast = NULL;
+    }
+    return need;
+}
@@ -0,0 +1,392 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <daemonutils.h>
+#include <logutils/syslogutils.h>
+#include <netutils/netutils.h>
+#include <strutils.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "astroproxy.h"
+
+/* #define BACKLOG 20 */
+#define BACKLOG SOMAXCONN
+
+int running = 1;
+int stats_dump = 0;
+
+void *root_logger;
+
+int parse_addr(const char *s, struct sockaddr_in *addr) {
+    char ip[INET_ADDRSTRLEN];
+    const char *colon = strrchr(s, ':');
+    int port;
+    if (colon == NULL || (size_t) (colon - s) >= sizeof(ip))
+        return -1;
+    memcpy(ip, s, colon - s);
+    ip[colon - s] = '\0';
+    port = atoi(colon + 1);
+    if (port <= 0 || port > 65535)
+        return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_aton(ip, &addr->sin_addr) == 0)
+        return -1;
+    return 0;
+}
+
+int start_server(const struct config *conf) {
+    int ec = 0;
+    int srv_fd; /* server socket */
+    SA_IN srv_addr;
+
+    if ((srv_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "socket");
+        goto EXIT;
+    }
+
+    srv_addr.sin_family = AF_INET;
+    srv_addr.sin_port = htons(conf->port);
+    if (conf->ip == NULL)
+        srv_addr.sin_addr.s_addr = htonl(INADDR_ANY); /* List on any IP */
+    else if (inet_aton(conf->ip, &srv_addr.sin_addr) == 0) {
+        ec = -1;
+        _LOG_ERROR(root_logger, "invalid address: %s", conf->ip);
+        goto EXIT;
+    }
+
+    if (bind(srv_fd, (SA *) &srv_addr, sizeof(srv_addr)) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "bind");
+        goto EXIT;
+    }
+
+    if (listen(srv_fd, BACKLOG) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "listen");
+        goto EXIT;
+    }
+
+    if (alog_start() == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "start log flusher");
+        goto EXIT;
+    }
+
+    for (int i = 0; i < conf->nbackends; i++)
+        _LOG_INFO(root_logger, "backend %s:%d",
+                  inet_ntoa(conf->backends[i].sin_addr),
+                  ntohs(conf->backends[i].sin_port));
+    _LOG_NOTICE(root_logger,
+                "startup (%d backends, %d connections, cache ttl %u ms)",
+                conf->nbackends, conf->connections, conf->cache_ttl);
+    if (conf->hedge > 0)
+        _LOG_NOTICE(root_logger, "hedge at p%g, budget %d%%", conf->hedge,
+                    conf->hedge_budget);
+
+    ec = proxy_loop(srv_fd, conf);
+
+EXIT:
+    alog_stop();
+    if (ec)
+        _LOG_NOTICE(root_logger, "%s", "shutdown with error");
+    else
+        _LOG_NOTICE(root_logger, "%s", "shutdown");
+    return ec;
+}
+
+void sig_handler(int sig) {
+    int saved_errno = errno;
+    switch (sig) {
+    case SIGHUP:
+        _LOG_INFO(root_logger, "%s", "received SIGHUP signal");
+        break;
+    case SIGUSR1:
+        stats_dump = 1;
+        break;
+    case SIGINT:
+    case SIGTERM:
+        /* event loop exit after epoll_wait */
+        running = 0;
+        break;
+    }
+    errno = saved_errno;
+}
+
+int sig_handlers_init() {
+    int ec = 0;
+    /* Handle signals */
+    struct sigaction sa;
+
+    /* Setup the signal handler */
+    sa.sa_handler = &sig_handler;
+
+    /* epoll_wait is interrupted anyway */
+    sa.sa_flags = SA_RESTART;
+
+    /* Block every signal during the handler */
+    sigfillset(&sa.sa_mask);
+
+    /* Ignore SIGPIPE */
+    if (sigaction(SIGPIPE, &(struct sigaction){SIG_IGN}, NULL) == -1) {
+        perror("Error: cannot handle SIGPIPE");
+        ec = 1;
+    }
+
+    /* SIGTERM is intended to gracefull kill your process */
+    if (sigaction(SIGTERM, &sa, NULL) == -1) {
+        perror("Cannot handle SIGTERM");
+        ec = 1;
+    }
+
+    /* Intercept SIGINT */
+    if (sigaction(SIGINT, &sa, NULL) == -1) {
+        perror("Error: cannot handle SIGINT");
+        ec = 1;
+    }
+
+    // Intercept SIGHUP
+    if (sigaction(SIGHUP, &sa, NULL) == -1) {
+        perror("Error: cannot handle SIGHUP");
+        ec = 1;
+    }
+
+    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+        perror("Error: cannot handle SIGUSR1");
+        ec = 1;
+    }
+
+    return ec;
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "use: %s [options]\n%s", name,
+            "\t-b | --background Fork and run in background\n"
+            "\t-a | --address <LISTEN_ADDRESS> (default all)\n"
+            "\t-p | --port <LISTEN_PORT> (default 1235)\n"
+            "\t-u | --upstream <IP:PORT> astrolog address, repeat for\n"
+            "\t     several backends (default 127.0.0.1:1234)\n"
+            "\t-c | --connections <N> connections per backend (default 4)\n"
+            "\t-t | --timeout <SEC> idle session timeout (default 60)\n"
+            "\t-R | --response-timeout <MS> upstream response timeout,\n"
+            "\t     backend is ejected on it (default 2000)\n"
+            "\t-T | --cache-ttl <MS> forecast cache ttl, 0 - only coalesce\n"
+            "\t     concurrent requests (default 1000)\n"
+            "\t-H | --hedge <PERCENTILE> duplicate request to other backend\n"
+            "\t     after this percentile of latency, 0 - off (default 0)\n"
+            "\t-B | --hedge-budget <PERCENT> max hedges per upstream\n"
+            "\t     requests (default 5)\n"
+            "\t-L | --log <syslog|stderr|FILE> connections log (default syslog)\n"
+            "\t-l | --log-level <err|warning|notice|info|debug> (default info)\n"
+            "\t-N | --log-sample <N> log one of N connections events (default 1)\n");
+    exit(1);
+}
+
+int main(int argc, char *const argv[]) {
+    int ec = 0, pid;
+    int background = 0;
+    int closefds = FD_NOCLOSE;
+    const char *name = "astroproxy";
+    struct config conf;
+    conf.ip = NULL;
+    conf.port = 1235;
+    parse_addr("127.0.0.1:1234", &conf.backends[0]);
+    conf.nbackends = 0; /* default used without -u */
+    conf.connections = UPSTREAM_CONNECTIONS;
+    conf.timeout = SESSION_TIMEOUT;
+    conf.up_timeout = UPSTREAM_TIMEOUT;
+    conf.cache_ttl = CACHE_TTL;
+    conf.hedge = 0;
+    conf.hedge_budget = HEDGE_BUDGET;
+    const char *log_output = NULL;
+    int log_level = LOG_INFO;
+    int log_sample = 1;
+
+    int opt = 0;
+    int opt_idx = 0;
+
+    const char *opts = "hba:p:u:c:t:R:T:H:B:L:l:N:";
+    const struct option long_opts[] = {
+        /* Use flags like so:
+        {"verbose",	no_argument,	&verbose_flag, 'V'}*/
+        /* Argument styles: no_argument, required_argument, optional_argument */
+        {"help", no_argument, 0, 'h'},
+        {"background", no_argument, 0, 'b'},
+        {"address", required_argument, 0, 'a'},
+        {"port", required_argument, 0, 'p'},
+        {"upstream", required_argument, 0, 'u'},
+        {"connections", required_argument, 0, 'c'},
+        {"timeout", required_argument, 0, 't'},
+        {"response-timeout", required_argument, 0, 'R'},
+        {"cache-ttl", required_argument, 0, 'T'},
+        {"hedge", required_argument, 0, 'H'},
+        {"hedge-budget", required_argument, 0, 'B'},
+        {"log", required_argument, 0, 'L'},
+        {"log-level", required_argument, 0, 'l'},
+        {"log-sample", required_argument, 0, 'N'},
+        {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, opts, long_opts, &opt_idx)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'b':
+            background = 1;
+            break;
+        case 'a':
+            conf.ip = optarg;
+            break;
+        case 'p':
+            conf.port = atoi(optarg);
+            if (conf.port <= 0) {
+                fprintf(stderr, "invalid port: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'u':
+            if (conf.nbackends == MAX_BACKENDS) {
+                fprintf(stderr, "too many upstreams, max %d\n", MAX_BACKENDS);
+                return EXIT_FAILURE;
+            }
+            if (parse_addr(optarg, &conf.backends[conf.nbackends]) == -1) {
+                fprintf(stderr, "invalid upstream: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            conf.nbackends++;
+            break;
+        case 'c':
+            conf.connections = atoi(optarg);
+            if (conf.connections <= 0 ||
+                conf.connections > MAX_UPSTREAM_CONNECTIONS) {
+                fprintf(stderr, "invalid connections: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            conf.timeout = atoi(optarg);
+            if (conf.timeout <= 0) {
+                fprintf(stderr, "invalid timeout: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'R':
+            conf.up_timeout = atoi(optarg);
+            if (conf.up_timeout <= 0) {
+                fprintf(stderr, "invalid response timeout: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T': {
+            int ttl = atoi(optarg);
+            if (ttl < 0) {
+                fprintf(stderr, "invalid cache ttl: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            conf.cache_ttl = ttl;
+            break;
+        }
+        case 'H':
+            conf.hedge = atof(optarg);
+            if (conf.hedge < 0 || conf.hedge >= 100) {
+                fprintf(stderr, "invalid hedge percentile: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'B':
+            conf.hedge_budget = atoi(optarg);
+            if (conf.hedge_budget <= 0 || conf.hedge_budget > 100) {
+                fprintf(stderr, "invalid hedge budget: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            log_output = optarg;
+            break;
+        case 'l':
+            if ((log_level = alog_level_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid log level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            log_sample = atoi(optarg);
+            if (log_sample <= 0) {
+                fprintf(stderr, "invalid log sample: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 0: /* binded option, set by getopt */
+            break;
+        case '?':
+            /* getopt_long will have already printed an error */
+            return -1;
+        default:
+            /* Not sure how to get here... */
+            return -1;
+        }
+    }
+    if (optind < argc) {
+        fprintf(stderr, "Non-option arguments: ");
+        while (optind < argc)
+            fprintf(stderr, "%s ", argv[optind++]);
+        fprintf(stderr, "\n");
+        return EXIT_FAILURE;
+    }
+    if (conf.nbackends == 0)
+        conf.nbackends = 1;
+
+    /* single process, one ring */
+    if (alog_init(name, log_output, LOG_LOCAL0, log_level, 1, log_sample) ==
+        -1) {
+        fprintf(stderr, "init log %s: %s\n", log_output ? log_output : "syslog",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (sig_handlers_init()) {
+        ec = 1;
+        goto EXIT;
+    }
+
+    openlog(name, LOG_CONS | LOG_PID | LOG_NDELAY, LOG_LOCAL0);
+
+    if (background)
+        closefds = FD_CLOSE_STD;
+
+    pid = daemon_init(background, 1, closefds);
+    if (pid == 0) { /* child process */
+        ec = start_server(&conf);
+    } else if (pid < 0) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "fork");
+        ec = EXIT_FAILURE;
+    } else { /* parent, check child status */
+        int wstatus;
+        if (waitpid(pid, &wstatus, WNOHANG) != 0) {
+            ec = EXIT_FAILURE;
+            perror("check forked process");
+        } else {
+            if (WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) {
+                ec = EXIT_FAILURE;
+            }
+        }
+    }
+EXIT:
+    if (ec != 0) {
+        fprintf(stderr, "exit with error, check log\n");
+    }
+    return ec;
+}
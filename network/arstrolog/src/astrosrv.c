@@ -7,8 +7,10 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -17,160 +19,219 @@
 #include <netutils/netutils.h>
 #include <strutils.h>
 
+#include <srvcommon/asynclog.h>
+
+#include "astroproto.h"
+#include "astrosrv.h"
+
 /* #define BACKLOG 20 */
 #define BACKLOG SOMAXCONN
 
-#define RESPSIZE 80
-#define REQSIZE 22
-
 int running = 1;
+int worker = 0; /* set to 1 in worker process */
 
-struct config {
-    char *ip;
-    int port;
-};
+void *root_logger;
 
-enum SESS_STATE {
-    SESS_INIT = 0,
-    SESS_CLIENT = 1,
-    SESS_STAR = 2,
-    SESS_ERR = -1
-};
+struct forecast_table *forecasts;
+struct sub_table *subscriptions;
 
-void *root_logger;
+static pid_t *worker_pids; /* indexed by worker, -1 if not running */
+static int *srv_fds;       /* reuseport listeners, one per worker */
+static int nworkers;
 
-int session_start(int sess_fd, const char *ip, const u_short port, char *buf) {
-    size_t n = recv(sess_fd, buf, 22, MSG_NOSIGNAL);
-    if (n > 0)
-        buf[n] = '\0';
-    if (n != REQSIZE) {
-        if (n < 0) {
-            _LOG_ERROR_ERRNO(root_logger,
-                             "recv on client connection from %s:%d: %s", errno,
-                             ip, port);
-        } else {
-            _LOG_ERROR(root_logger, "length error for %s:%d: %s", ip, port,
-                       buf);
-        }
-        return SESS_ERR;
-    }
-}
+/* listener for worker, kernel balance connections over reuseport group */
+int listen_socket(const struct config *conf) {
+    int srv_fd;
+    int reuse = 1;
+    SA_IN srv_addr;
 
-int server_session(int sess_fd, const char *ip, const u_short port,
-                   const struct config *conf) {
-    char buf[RESPSIZE + 1];
-    int status = SESS_INIT;
+    if ((srv_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "socket");
+        return -1;
+    }
+    if (setsockopt(srv_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) ==
+        -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "SO_REUSEPORT");
+        goto ERROR;
+    }
 
-    while (running) {
-        if (status == SESS_INIT) {
-            status = session_start(sess_fd, ip, port, buf);
-            if (status == SESS_CLIENT) {
+    srv_addr.sin_family = AF_INET;
+    srv_addr.sin_port = htons(conf->port);
+    if (conf->ip == NULL)
+        srv_addr.sin_addr.s_addr = htonl(INADDR_ANY); /* List on any IP */
+    else if (inet_aton(conf->ip, &srv_addr.sin_addr) == 0) {
+        _LOG_ERROR(root_logger, "invalid address: %s", conf->ip);
+        goto ERROR;
+    }
 
-            } else if (status == SESS_STAR) {
+    if (bind(srv_fd, (SA *) &srv_addr, sizeof(srv_addr)) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "bind");
+        goto ERROR;
+    }
 
-            } else
-                break;
-        }
+    if (listen(srv_fd, BACKLOG) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "listen");
+        goto ERROR;
     }
+    return srv_fd;
+ERROR:
+    close(srv_fd);
+    return -1;
+}
 
-    /*
-    strcpy(buf, "Hi there!\n");
-    ssize_t len = strlen(buf);
-    for (int i = 0; i < 5; i++) {
-        if (send(sess_fd, buf, len, MSG_NOSIGNAL) == -1) {
-            _LOG_ERROR_ERRNO(root_logger,
-                             "send on client connection from %s:%d: %s", errno,
-                             ip, port);
-            break;
+pid_t worker_start(int idx, const struct config *conf) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int ec;
+        worker = 1;
+        alog_set_ring(idx + 1); /* ring 0 is master ring */
+        /* use own listener, other listeners belongs to other workers */
+        for (int i = 0; i < conf->workers; i++) {
+            if (i != idx)
+                close(srv_fds[i]);
         }
+        if (affinity_apply(&conf->affinity, idx) == -1)
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "worker affinity");
+        ec = worker_loop(idx, srv_fds[idx], conf);
+        exit(ec ? EXIT_FAILURE : 0);
+    } else if (pid < 0) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "fork worker");
+    } else {
+        worker_pids[idx] = pid;
     }
-    */
-    /* _LOG_INFO(root_logger, "close client connection from %s:%d", ip, port);
-     */
-    close(sess_fd);
+    return pid;
 }
 
-int listener_loop(int srv_fd, const struct config *conf) {
-    int ec = 0;
-    SA_IN client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    char ipbuf[INET_ADDRSTRLEN];
+/* wait workers, restart died */
+void master_loop(const struct config *conf) {
     while (running) {
-        int sess_fd = accept(srv_fd, (SA *) &client_addr, &client_addr_len);
-        if (sess_fd == -1) {
-            if (errno != EINTR)
-                _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
-                                 "accept", srv_fd);
-            continue;
+        int status, idx;
+        pid_t pid = wait(&status);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "wait");
+            break;
         }
-
-        /* Format client IP address */
-        if (getnameinfo((SA *) &client_addr, client_addr_len, ipbuf,
-                        INET_ADDRSTRLEN, 0, 0, NI_NUMERICHOST) == 0) {
-            _LOG_INFO(root_logger, "connect from %s:%d", ipbuf,
-                      client_addr.sin_port);
-        } else {
-            _LOG_ERROR(root_logger, "invalid address for socket %d", sess_fd);
+        for (idx = 0; idx < conf->workers; idx++) {
+            if (worker_pids[idx] == pid)
+                break;
         }
-        server_session(sess_fd, ipbuf, client_addr.sin_port, conf);
+        if (idx == conf->workers)
+            continue;
+        worker_pids[idx] = -1;
+        if (!running)
+            break;
+        sub_reset(subscriptions, idx);
+        if (WIFEXITED(status))
+            _LOG_ERROR(root_logger, "worker %d exited with status %d", pid,
+                       WEXITSTATUS(status));
+        else if (WIFSIGNALED(status))
+            _LOG_ERROR(root_logger, "worker %d killed with signal '%s'", pid,
+                       strsignal(WTERMSIG(status)));
+        sleep(1); /* don't spin on permanent failure */
+        if (running)
+            worker_start(idx, conf);
     }
-EXIT:
-    close(srv_fd);
-    return ec;
 }
 
 int start_server(const struct config *conf) {
     int ec = 0;
-    int srv_fd; /* server socket */
-    SA_IN srv_addr;
+    int status;
+    int restored = 0;
 
-    if ((srv_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    worker_pids = (pid_t *) malloc(sizeof(pid_t) * conf->workers);
+    srv_fds = (int *) malloc(sizeof(int) * conf->workers);
+    if (worker_pids == NULL || srv_fds == NULL) {
         ec = -1;
-        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "socket");
+        _LOG_ERROR(root_logger, "%s", "alloc workers");
         goto EXIT;
     }
-    /*
-    set_reuseaddr(srv_fd);
-    */
+    for (int i = 0; i < conf->workers; i++) {
+        worker_pids[i] = -1;
+        srv_fds[i] = -1;
+    }
+    nworkers = conf->workers;
 
-    srv_addr.sin_family = AF_INET;
-    srv_addr.sin_port = htons(conf->port);
-    if (conf->ip == NULL)
-        srv_addr.sin_addr.s_addr = htonl(INADDR_ANY); /* List on any IP */
-    else if (inet_aton(conf->ip, &srv_addr.sin_addr) == 0) {
+    if ((forecasts = forecast_create(conf->store, &restored)) == NULL) {
         ec = -1;
-        _LOG_ERROR(root_logger, "invalid address: %s", conf->ip);
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno,
+                         conf->store ? conf->store : "forecast table");
         goto EXIT;
     }
 
-    if (bind(srv_fd, (SA *) &srv_addr, sizeof(srv_addr)) == -1) {
+    if ((subscriptions = sub_create(conf->workers)) == NULL) {
         ec = -1;
-        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "bind");
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "subscriptions table");
         goto EXIT;
     }
 
-    /* set_nonblock(srv_fd); */
+    for (int i = 0; i < conf->workers; i++) {
+        if ((srv_fds[i] = listen_socket(conf)) == -1) {
+            ec = -1;
+            goto EXIT;
+        }
+    }
 
-    if (listen(srv_fd, BACKLOG) == -1) {
+    /* flusher thread started before fork, so serve all workers rings */
+    if (alog_start() == -1) {
         ec = -1;
-        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "listen");
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "start log flusher");
         goto EXIT;
     }
 
-    _LOG_NOTICE(root_logger, "%s", "startup");
+    if (conf->store)
+        _LOG_NOTICE(root_logger, "startup (%d workers, %d forecasts from %s)",
+                    conf->workers, restored, conf->store);
+    else
+        _LOG_NOTICE(root_logger, "startup (%d workers)", conf->workers);
 
-    ec = listener_loop(srv_fd, conf);
+    for (int i = 0; i < conf->workers; i++) {
+        if (worker_start(i, conf) < 0) {
+            ec = -1;
+            goto EXIT;
+        }
+    }
+
+    master_loop(conf);
 
 EXIT:
+    running = 0;
+    for (int i = 0; worker_pids && i < conf->workers; i++) {
+        if (worker_pids[i] > 0)
+            kill(worker_pids[i], SIGTERM);
+    }
+    while (wait(&status) > 0) {
+    }
+    alog_stop();
+    for (int i = 0; srv_fds && i < conf->workers; i++) {
+        if (srv_fds[i] >= 0)
+            close(srv_fds[i]);
+    }
+    nworkers = 0;
+    free(srv_fds);
+    free(worker_pids);
+    if (forecasts && forecast_sync(forecasts, 1) == -1)
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "msync forecasts");
+    forecast_destroy(forecasts);
+    sub_destroy(subscriptions);
     if (ec)
         _LOG_NOTICE(root_logger, "%s", "shutdown with error");
+    else
+        _LOG_NOTICE(root_logger, "%s", "shutdown");
     return ec;
 }
 
 void app_shutdown() {
     running = 0;
-    sleep(1);
-    exit(0);
+    if (worker)
+        return; /* event loop exit after epoll_wait */
+    _LOG_NOTICE(root_logger, "%s", "shutdown initiate");
+    /* master wake up from wait, when workers exit */
+    for (int i = 0; worker_pids && i < nworkers; i++) {
+        if (worker_pids[i] > 0)
+            kill(worker_pids[i], SIGTERM);
+    }
 }
 
 void sig_handler(int sig) {
@@ -245,7 +306,16 @@ void usage(const char *name) {
     fprintf(stderr, "use: %s [options]\n%s", name,
             "\t-b | --background Fork and run in background\n"
             "\t-a | --address <LISTEN_ADDRESS> (default all)\n"
-            "\t-p | --port <LISTEN_PORT> (default 1234)\n");
+            "\t-p | --port <LISTEN_PORT> (default 1234)\n"
+            "\t-w | --workers <N> event loop processes (default cpus count)\n"
+            "\t-A | --affinity <none|compact|spread|CPU_LIST> pin workers\n"
+            "\t     (default none)\n"
+            "\t-t | --timeout <SEC> idle session timeout (default 60)\n"
+            "\t-s | --store <FILE> keep forecasts in file over restarts\n"
+            "\t     (default memory only)\n"
+            "\t-L | --log <syslog|stderr|FILE> connections log (default syslog)\n"
+            "\t-l | --log-level <err|warning|notice|info|debug> (default info)\n"
+            "\t-N | --log-sample <N> log one of N connections events (default 1)\n");
     exit(1);
 }
 
@@ -257,11 +327,18 @@ int main(int argc, char *const argv[]) {
     struct config conf;
     conf.ip = NULL;
     conf.port = 1234;
+    conf.workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    conf.timeout = SESSION_TIMEOUT;
+    conf.store = NULL;
+    const char *affinity = NULL;
+    const char *log_output = NULL;
+    int log_level = LOG_INFO;
+    int log_sample = 1;
 
     int opt = 0;
     int opt_idx = 0;
 
-    const char *opts = "hba:p:";
+    const char *opts = "hba:p:w:A:t:s:L:l:N:";
     const struct option long_opts[] = {
         /* Use flags like so:
         {"verbose",	no_argument,	&verbose_flag, 'V'}*/
@@ -270,6 +347,13 @@ int main(int argc, char *const argv[]) {
         {"background", no_argument, 0, 'b'},
         {"address", required_argument, 0, 'a'},
         {"port", required_argument, 0, 'p'},
+        {"workers", required_argument, 0, 'w'},
+        {"affinity", required_argument, 0, 'A'},
+        {"timeout", required_argument, 0, 't'},
+        {"store", required_argument, 0, 's'},
+        {"log", required_argument, 0, 'L'},
+        {"log-level", required_argument, 0, 'l'},
+        {"log-sample", required_argument, 0, 'N'},
         {0, 0, 0, 0}};
 
     while ((opt = getopt_long(argc, argv, opts, long_opts, &opt_idx)) != -1) {
@@ -290,6 +374,42 @@ int main(int argc, char *const argv[]) {
                 return EXIT_FAILURE;
             }
             break;
+        case 'w':
+            conf.workers = atoi(optarg);
+            if (conf.workers <= 0 || conf.workers > MAX_WORKERS) {
+                fprintf(stderr, "invalid workers: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'A':
+            affinity = optarg;
+            break;
+        case 't':
+            conf.timeout = atoi(optarg);
+            if (conf.timeout <= 0) {
+                fprintf(stderr, "invalid timeout: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            conf.store = optarg;
+            break;
+        case 'L':
+            log_output = optarg;
+            break;
+        case 'l':
+            if ((log_level = alog_level_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid log level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            log_sample = atoi(optarg);
+            if (log_sample <= 0) {
+                fprintf(stderr, "invalid log sample: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 0: /* binded option, set by getopt */
             break;
         case '?':
@@ -308,6 +428,24 @@ int main(int argc, char *const argv[]) {
         return EXIT_FAILURE;
     }
 
+    if (conf.workers <= 0)
+        conf.workers = 1;
+    else if (conf.workers > MAX_WORKERS)
+        conf.workers = MAX_WORKERS;
+    if (affinity_init(&conf.affinity, affinity, 0) == -1) {
+        fprintf(stderr, "invalid affinity: %s\n",
+                affinity ? affinity : "none");
+        return EXIT_FAILURE;
+    }
+
+    /* master ring and ring per worker */
+    if (alog_init(name, log_output, LOG_LOCAL0, log_level, conf.workers + 1,
+                  log_sample) == -1) {
+        fprintf(stderr, "init log %s: %s\n", log_output ? log_output : "syslog",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
     if (sig_handlers_init()) {
         ec = 1;
         goto EXIT;
@@ -336,6 +474,7 @@ int main(int argc, char *const argv[]) {
         }
     }
 EXIT:
+    affinity_destroy(&conf.affinity);
     if (ec != 0) {
         fprintf(stderr, "exit with error, check log\n");
     }
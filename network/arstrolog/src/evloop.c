@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <logutils/syslogutils.h>
+#include <netutils/netutils.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "astroproto.h"
+#include "astrosrv.h"
+
+#define MAX_EVENTS 256
+
+#define RBUFSIZE 4096 /* many pipelined requests per recv */
+#define OUT_IOV 64     /* responses per writev */
+
+enum SESS_STATE {
+    SESS_WAIT = 0,    /* wait for next event */
+    SESS_EOF = 1,     /* client close connection */
+    SESS_INVALID = 2, /* protocol violation */
+    SESS_ERR = -1
+};
+
+#define SUBS_INIT 16 /* initial capacity of sign subscribers */
+
+/* batch of responses, forecasts are copied by seqlock read */
+struct session_out {
+    struct iovec iov[OUT_IOV];
+    int first; /* first unsent iov (partial iov is advanced) */
+    int cnt;
+    char text[OUT_IOV][ASTRO_FORECAST_SIZE];
+};
+
+struct ev_session {
+    int fd;
+    char ip[INET_ADDRSTRLEN];
+    u_short port;
+    time_t last;                    /* last activity time, for idle timeout */
+    struct ev_session *prev, *next; /* active list, sorted by last */
+    size_t rlen;                    /* buffered incoming bytes */
+    char rbuf[RBUFSIZE];
+    struct session_out out;
+    unsigned int push;              /* signs with forecast to push */
+    int nsubs;                      /* subscribed signs */
+    int sub_idx[ASTRO_SIGNS];       /* index in sign subscribers, -1 */
+    struct ev_session *dirty_next;  /* push batch */
+};
+
+/* subscribers of sign in this worker */
+struct ev_subs {
+    struct ev_session **s;
+    size_t count;
+    size_t cap;
+    unsigned int seq; /* forecast sequence of last push */
+};
+
+static int worker_idx;
+static struct ev_subs subs[ASTRO_SIGNS];
+static unsigned int notify_signs; /* updated by STARS SAY in this loop */
+static char notify_ev; /* epoll data for eventfd */
+
+/* sessions, ordered by last activity (head is oldest) */
+struct ev_list {
+    struct ev_session *head;
+    struct ev_session *tail;
+    long int count;
+};
+
+static void list_remove(struct ev_list *l, struct ev_session *s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        l->head = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    else
+        l->tail = s->prev;
+    s->prev = s->next = NULL;
+}
+
+static void list_append(struct ev_list *l, struct ev_session *s) {
+    s->next = NULL;
+    s->prev = l->tail;
+    if (l->tail)
+        l->tail->next = s;
+    else
+        l->head = s;
+    l->tail = s;
+}
+
+static void session_touch(struct ev_list *l, struct ev_session *s, time_t now) {
+    s->last = now;
+    if (l->tail != s) {
+        list_remove(l, s);
+        list_append(l, s);
+    }
+}
+
+/* send queued responses, return -1 on error or EAGAIN (errno is set) */
+static int out_flush(int fd, struct session_out *out) {
+    while (out->first < out->cnt) {
+        struct iovec *iov = out->iov + out->first;
+        ssize_t n = writev(fd, iov, out->cnt - out->first);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        /* skip sent, partial iov is advanced */
+        while (out->first < out->cnt && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            out->first++;
+        }
+        if (out->first < out->cnt) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    out->first = out->cnt = 0;
+    return 0;
+}
+
+static void out_add(struct session_out *out, const void *buf, size_t len) {
+    out->iov[out->cnt].iov_base = (void *) buf;
+    out->iov[out->cnt].iov_len = len;
+    out->cnt++;
+}
+
+static int session_subscribe(struct ev_session *s, int sign) {
+    struct ev_subs *sb = &subs[sign];
+    if (s->sub_idx[sign] != -1)
+        return 0;
+    if (sb->count == sb->cap) {
+        size_t cap = sb->cap ? sb->cap * 2 : SUBS_INIT;
+        struct ev_session **p = realloc(sb->s, sizeof(*p) * cap);
+        if (p == NULL)
+            return -1;
+        sb->s = p;
+        sb->cap = cap;
+    }
+    s->sub_idx[sign] = sb->count;
+    sb->s[sb->count++] = s;
+    s->nsubs++;
+    /* visible for writers before forecast is read (pair to sub_notify) */
+    atomic_fetch_add(&subscriptions->worker[worker_idx].subscribers[sign], 1);
+    if (sb->count == 1)
+        sb->seq = forecast_seq(forecasts, sign);
+    return 0;
+}
+
+static void session_unsubscribe(struct ev_session *s) {
+    for (int sign = 0; s->nsubs > 0 && sign < ASTRO_SIGNS; sign++) {
+        struct ev_subs *sb = &subs[sign];
+        int idx = s->sub_idx[sign];
+        if (idx == -1)
+            continue;
+        /* move last to free place */
+        sb->s[idx] = sb->s[--sb->count];
+        sb->s[idx]->sub_idx[sign] = idx;
+        s->sub_idx[sign] = -1;
+        s->nsubs--;
+        atomic_fetch_sub(&subscriptions->worker[worker_idx].subscribers[sign],
+                         1);
+    }
+}
+
+/* queue pending pushes, until responses batch is full */
+static void session_push(struct ev_session *s) {
+    while (s->push && s->out.cnt < OUT_IOV) {
+        int sign = ffs(s->push) - 1;
+        char *text = s->out.text[s->out.cnt];
+        s->push &= ~(1u << sign);
+        forecast_read(forecasts, sign, text);
+        out_add(&s->out, text, ASTRO_FORECAST_SIZE);
+    }
+}
+
+/*
+ * Process complete records in read buffer, until responses batch is full.
+ * Return consumed bytes, -1 on invalid request, -2 on error (errno is set).
+ */
+static ssize_t session_process(struct ev_session *s) {
+    size_t pos = 0;
+    while (pos < s->rlen && s->out.cnt < OUT_IOV) {
+        struct astro_req req;
+        ssize_t n = astro_parse(s->rbuf + pos, s->rlen - pos, &req);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            size_t show = s->rlen - pos < ASTRO_REQ_SIZE - 1
+                              ? s->rlen - pos
+                              : ASTRO_REQ_SIZE - 1;
+            ALOG(LOG_ERR, "invalid request from %s:%d: %.*s", s->ip, s->port,
+                 (int) show, s->rbuf + pos);
+            return -1;
+        }
+        if (req.cmd == ASTRO_CMD_STARS_SAY) {
+            forecast_write(forecasts, req.sign, req.forecast);
+            out_add(&s->out, ASTRO_THANKS, ASTRO_REPLY_SIZE);
+            notify_signs |= 1u << req.sign;
+        } else {
+            /* subscription start with current forecast */
+            char *text = s->out.text[s->out.cnt];
+            if (req.cmd == ASTRO_CMD_SUBSCRIBE &&
+                session_subscribe(s, req.sign) == -1) {
+                _LOG_ERROR(root_logger, "%s", "alloc subscribers");
+                errno = ENOMEM;
+                return -2;
+            }
+            forecast_read(forecasts, req.sign, text);
+            out_add(&s->out, text, ASTRO_FORECAST_SIZE);
+        }
+        pos += n;
+    }
+    return pos;
+}
+
+/* edge-triggered io: run until recv or send return EAGAIN */
+static int session_io(struct ev_session *s) {
+    ssize_t n;
+    while (running) {
+        if (s->out.cnt > 0 && out_flush(s->fd, &s->out) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return SESS_WAIT; /* wait for EPOLLOUT */
+            return SESS_ERR;
+        }
+
+        if (s->push) {
+            session_push(s);
+            if (s->out.cnt == OUT_IOV)
+                continue;
+        }
+
+        if ((n = session_process(s)) < 0) {
+            if (n == -2)
+                return SESS_ERR;
+            /* responses before invalid request, if socket accept them */
+            out_flush(s->fd, &s->out);
+            return SESS_INVALID;
+        }
+        if (n > 0) {
+            s->rlen -= n;
+            memmove(s->rbuf, s->rbuf + n, s->rlen);
+        }
+        if (s->out.cnt > 0)
+            continue;
+
+        /* buffer is never full here, incomplete record is less than it */
+        n = recv(s->fd, s->rbuf + s->rlen, RBUFSIZE - s->rlen, 0);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return SESS_WAIT; /* wait for EPOLLIN */
+            else if (errno == EINTR)
+                continue;
+            return SESS_ERR;
+        } else if (n == 0) {
+            if (s->rlen > 0)
+                ALOG(LOG_ERR, "incomplete request from %s:%d (%zu bytes)",
+                     s->ip, s->port, s->rlen);
+            return SESS_EOF;
+        }
+        s->rlen += n;
+    }
+    return SESS_EOF;
+}
+
+static void session_close(struct ev_list *l, struct ev_session *s, int status,
+                          int err) {
+    if (status == SESS_ERR) {
+        ALOG(LOG_ERR, "close client connection from %s:%d: %s", s->ip,
+             s->port, strerror(err));
+    } else if (status == SESS_WAIT) {
+        if (s->rlen > 0)
+            ALOG(LOG_ERR, "close client connection from %s:%d (timeout, "
+                          "incomplete request)",
+                 s->ip, s->port);
+        else
+            ALOG_SAMPLED(LOG_INFO,
+                         "close client connection from %s:%d (timeout)",
+                         s->ip, s->port);
+    } else {
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d", s->ip,
+                     s->port);
+    }
+    session_unsubscribe(s);
+    /* close also remove fd from epoll set */
+    close(s->fd);
+    list_remove(l, s);
+    l->count--;
+    free(s);
+}
+
+static struct ev_session *session_new(int sess_fd, SA_IN *client_addr,
+                                      time_t now) {
+    struct ev_session *s = malloc(sizeof(struct ev_session));
+    if (s == NULL)
+        return NULL;
+    s->fd = sess_fd;
+    s->port = client_addr->sin_port;
+    s->last = now;
+    s->prev = s->next = NULL;
+    s->rlen = 0;
+    s->out.first = s->out.cnt = 0;
+    s->push = 0;
+    s->nsubs = 0;
+    for (int i = 0; i < ASTRO_SIGNS; i++)
+        s->sub_idx[i] = -1;
+
+    /* Format client IP address (numeric, so without getnameinfo overhead) */
+    if (inet_ntop(AF_INET, &client_addr->sin_addr, s->ip, INET_ADDRSTRLEN)) {
+        ALOG_SAMPLED(LOG_INFO, "connect from %s:%d", s->ip, s->port);
+    } else {
+        s->ip[0] = '\0';
+        ALOG(LOG_ERR, "invalid address for socket %d", sess_fd);
+    }
+    return s;
+}
+
+/* accept pending connections, until queue empty or error */
+static void accept_sessions(int ep_fd, int srv_fd, struct ev_list *l,
+                            time_t now) {
+    SA_IN client_addr;
+    socklen_t client_addr_len;
+    struct epoll_event ev;
+    while (running) {
+        struct ev_session *s;
+        int sess_fd;
+        client_addr_len = sizeof(client_addr);
+        sess_fd = accept4(srv_fd, (SA *) &client_addr, &client_addr_len,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sess_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            ALOG(LOG_ERR, "%s on socket %d: %s", "accept", srv_fd,
+                 strerror(errno));
+            /* EMFILE, ENFILE, ENOMEM: retry on next loop */
+            return;
+        }
+
+        if ((s = session_new(sess_fd, &client_addr, now)) == NULL) {
+            _LOG_ERROR(root_logger, "%s", "alloc session");
+            close(sess_fd);
+            return;
+        }
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = s;
+        if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, sess_fd, &ev) == -1) {
+            _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
+                             "epoll_ctl", sess_fd);
+            close(sess_fd);
+            free(s);
+            continue;
+        }
+        list_append(l, s);
+        l->count++;
+    }
+}
+
+/* push changed forecasts to subscribers, one batch per session */
+static void subs_push(struct ev_list *l) {
+    struct ev_session *dirty = NULL;
+    sub_drain(subscriptions, worker_idx);
+    for (int sign = 0; sign < ASTRO_SIGNS; sign++) {
+        struct ev_subs *sb = &subs[sign];
+        unsigned int seq;
+        if (sb->count == 0)
+            continue;
+        seq = forecast_seq(forecasts, sign);
+        if (seq == sb->seq)
+            continue;
+        sb->seq = seq;
+        for (size_t i = 0; i < sb->count; i++) {
+            struct ev_session *s = sb->s[i];
+            /* session with pending push already wait for EPOLLOUT */
+            if (s->push == 0 && s->out.cnt == 0) {
+                s->dirty_next = dirty;
+                dirty = s;
+            }
+            s->push |= 1u << sign;
+        }
+    }
+    while (dirty) {
+        struct ev_session *s = dirty;
+        int status;
+        dirty = s->dirty_next;
+        status = session_io(s);
+        if (status != SESS_WAIT)
+            session_close(l, s, status, errno);
+    }
+}
+
+int worker_loop(int idx, int srv_fd, const struct config *conf) {
+    int ec = 0;
+    int ep_fd;
+    struct epoll_event ev;
+    struct ev_list sessions = {NULL, NULL, 0};
+    struct epoll_event events[MAX_EVENTS];
+
+    worker_idx = idx;
+    if ((ep_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_create");
+        return -1;
+    }
+    /* wake up from other workers STARS SAY, drop wake up of died worker */
+    sub_drain(subscriptions, idx);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &notify_ev;
+    if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, subscriptions->worker[idx].efd, &ev) ==
+        -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s on eventfd: %s", errno, "epoll_ctl");
+        close(ep_fd);
+        return -1;
+    }
+    set_nonblock(srv_fd);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL is listen socket */
+    if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, srv_fd, &ev) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
+                         "epoll_ctl", srv_fd);
+        close(ep_fd);
+        return -1;
+    }
+
+    while (running) {
+        time_t now;
+        int wake = 0;
+        int n = epoll_wait(ep_fd, events, MAX_EVENTS, 1000);
+        if (n == -1) {
+            if (errno != EINTR) {
+                _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_wait");
+                ec = -1;
+                break;
+            }
+            n = 0;
+        }
+        now = time(NULL);
+        for (int i = 0; i < n; i++) {
+            struct ev_session *s = events[i].data.ptr;
+            if (s == NULL) {
+                accept_sessions(ep_fd, srv_fd, &sessions, now);
+            } else if ((void *) s == &notify_ev) {
+                /* after events, push may close sessions from this batch */
+                wake = 1;
+            } else {
+                int status;
+                if (events[i].events & EPOLLERR) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    session_close(&sessions, s, SESS_ERR, err);
+                    continue;
+                }
+                status = session_io(s);
+                if (status == SESS_WAIT)
+                    session_touch(&sessions, s, now);
+                else
+                    session_close(&sessions, s, status, errno);
+            }
+        }
+        if (wake)
+            subs_push(&sessions);
+        /* wake up workers with subscribers of updated signs */
+        if (notify_signs) {
+            sub_notify(subscriptions, notify_signs);
+            notify_signs = 0;
+        }
+        /* write back batch of STARS SAY updates */
+        if (forecast_sync(forecasts, 0) == -1)
+            ALOG(LOG_ERR, "%s: %s", "msync forecasts", strerror(errno));
+        /* close idle sessions (and stuck partial requests) */
+        while (sessions.head && now - sessions.head->last >= conf->timeout) {
+            /* subscriber may be silent, it wait for pushes */
+            if (sessions.head->nsubs > 0)
+                session_touch(&sessions, sessions.head, now);
+            else
+                session_close(&sessions, sessions.head, SESS_WAIT, 0);
+        }
+    }
+
+    while (sessions.head)
+        session_close(&sessions, sessions.head, SESS_EOF, 0);
+    for (int i = 0; i < ASTRO_SIGNS; i++)
+        free(subs[i].s);
+    close(ep_fd);
+    close(srv_fd);
+    return ec;
+}
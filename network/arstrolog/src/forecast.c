@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "forecast.h"
+
+#define FORECAST_UNLUCKY "Вам не везёт"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() atomic_signal_fence(memory_order_seq_cst)
+#endif
+
+/* set before fork, so workers inherit it */
+static int file_backed;
+/* per process, forecast written since last sync */
+static int dirty;
+
+/* FNV-1a */
+static uint32_t forecast_sum(const char *text) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < ASTRO_FORECAST_SIZE; i++) {
+        h ^= (unsigned char) text[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void entry_reset(struct forecast_entry *e) {
+    atomic_init(&e->seq, 0);
+    memset(e->text, ' ', ASTRO_FORECAST_SIZE - 1);
+    memcpy(e->text, FORECAST_UNLUCKY, strlen(FORECAST_UNLUCKY));
+    e->text[ASTRO_FORECAST_SIZE - 1] = '\n';
+    e->sum = forecast_sum(e->text);
+}
+
+static int header_valid(const struct forecast_header *h) {
+    return memcmp(h->magic, FORECAST_MAGIC, sizeof(h->magic)) == 0 &&
+           h->version == FORECAST_VERSION && h->signs == ASTRO_SIGNS &&
+           h->entry_size == sizeof(struct forecast_entry);
+}
+
+/* keep consistent saved forecasts, reset other, return count of kept */
+static int table_load(struct forecast_table *t) {
+    int restored = 0;
+    if (!header_valid(&t->hdr)) {
+        /* new or incompatible store, header is written last */
+        memset(&t->hdr, 0, sizeof(t->hdr));
+        for (int i = 0; i < ASTRO_SIGNS; i++)
+            entry_reset(&t->sign[i]);
+        t->hdr.version = FORECAST_VERSION;
+        t->hdr.signs = ASTRO_SIGNS;
+        t->hdr.entry_size = sizeof(struct forecast_entry);
+        memcpy(t->hdr.magic, FORECAST_MAGIC, sizeof(t->hdr.magic));
+        return 0;
+    }
+    for (int i = 0; i < ASTRO_SIGNS; i++) {
+        struct forecast_entry *e = &t->sign[i];
+        unsigned int seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+        if ((seq & 1) || e->text[ASTRO_FORECAST_SIZE - 1] != '\n' ||
+            e->sum != forecast_sum(e->text))
+            entry_reset(e);
+        else if (seq > 0)
+            restored++;
+    }
+    return restored;
+}
+
+struct forecast_table *forecast_create(const char *path, int *restored) {
+    struct forecast_table *t;
+    int n;
+    if (path == NULL) {
+        t = mmap(NULL, sizeof(struct forecast_table), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (t == MAP_FAILED)
+            return NULL;
+    } else {
+        struct stat st;
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1)
+            return NULL;
+        /* size mismatch is incompatible store, header check reset it */
+        if (fstat(fd, &st) == -1 ||
+            ((size_t) st.st_size != sizeof(struct forecast_table) &&
+             (ftruncate(fd, 0) == -1 ||
+              ftruncate(fd, sizeof(struct forecast_table)) == -1))) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return NULL;
+        }
+        t = mmap(NULL, sizeof(struct forecast_table), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+        close(fd); /* mapping keep file */
+        if (t == MAP_FAILED)
+            return NULL;
+        file_backed = 1;
+    }
+    n = table_load(t);
+    if (restored)
+        *restored = n;
+    return t;
+}
+
+void forecast_destroy(struct forecast_table *t) {
+    if (t)
+        munmap(t, sizeof(struct forecast_table));
+}
+
+int forecast_sync(struct forecast_table *t, int wait) {
+    if (!file_backed || (!dirty && !wait))
+        return 0;
+    dirty = 0;
+    return msync(t, sizeof(struct forecast_table), wait ? MS_SYNC : MS_ASYNC);
+}
+
+unsigned int forecast_read(const struct forecast_table *t, int sign,
+                           char *dst) {
+    struct forecast_entry *e = (struct forecast_entry *) &t->sign[sign];
+    unsigned int s1, s2;
+    for (;;) {
+        s1 = atomic_load_explicit(&e->seq, memory_order_acquire);
+        if (s1 & 1) {
+            cpu_relax();
+            continue;
+        }
+        memcpy(dst, e->text, ASTRO_FORECAST_SIZE);
+        /* copy is done before sequence recheck */
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&e->seq, memory_order_relaxed);
+        if (s1 == s2)
+            return s1;
+    }
+}
+
+unsigned int forecast_seq(const struct forecast_table *t, int sign) {
+    struct forecast_entry *e = (struct forecast_entry *) &t->sign[sign];
+    return atomic_load_explicit(&e->seq, memory_order_acquire) & ~1u;
+}
+
+void forecast_write(struct forecast_table *t, int sign, const char *text) {
+    struct forecast_entry *e = &t->sign[sign];
+    unsigned int s = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    for (;;) {
+        if (s & 1) {
+            cpu_relax();
+            s = atomic_load_explicit(&e->seq, memory_order_relaxed);
+        } else if (atomic_compare_exchange_weak_explicit(
+                       &e->seq, &s, s + 1, memory_order_acquire,
+                       memory_order_relaxed)) {
+            break;
+        }
+    }
+    /* odd sequence is visible before text stores */
+    atomic_thread_fence(memory_order_release);
+    e->sum = forecast_sum(text);
+    memcpy(e->text, text, ASTRO_FORECAST_SIZE);
+    atomic_store_explicit(&e->seq, s + 2, memory_order_release);
+    dirty = 1;
+}
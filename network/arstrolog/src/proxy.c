@@ -0,0 +1,1116 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <logutils/syslogutils.h>
+#include <netutils/netutils.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "astroproto.h"
+#include "astroproxy.h"
+
+#define MAX_EVENTS 256
+
+#define RBUFSIZE 4096 /* many pipelined requests per recv */
+#define PX_SLOTS 64   /* pipelined requests per client */
+#define UP_RBUF (ASTRO_FORECAST_SIZE * 32)
+#define UP_RETRY 1 /* upstream reconnect delay (s) */
+
+#define HEDGE_WINDOW 1000     /* hedge delay recalculation period (ms) */
+#define HEDGE_MIN_SAMPLES 100 /* keep old delay on less responses in window */
+#define HEDGE_MIN_DELAY 100   /* us, don't duplicate on loopback noise */
+#define HEDGE_BURST 10        /* hedges saved in budget */
+
+/* log-linear latency histogram: 8 sub-buckets per power of 2 (us) */
+#define LAT_SUB 8
+#define LAT_BUCKETS (LAT_SUB * 30)
+
+enum SESS_STATE {
+    SESS_WAIT = 0,    /* wait for next event */
+    SESS_EOF = 1,     /* client close connection */
+    SESS_INVALID = 2, /* protocol violation */
+    SESS_ERR = -1
+};
+
+enum px_kind { PX_CLIENT = 1, PX_UPSTREAM };
+
+enum up_state { UP_DOWN = 0, UP_CONNECTING, UP_READY };
+
+/* response in client order, filled by upstream or locally */
+struct px_slot {
+    int ready;
+    size_t len;
+    char data[ASTRO_FORECAST_SIZE];
+};
+
+struct px_client {
+    int kind;
+    int fd; /* -1 if closed, wait for in-flight responses */
+    char ip[INET_ADDRSTRLEN];
+    u_short port;
+    time_t last;                  /* last activity time, for idle timeout */
+    struct px_client *prev, *next; /* active list, sorted by last */
+    int refs;                     /* in-flight upstream requests */
+    int eof;                      /* client send all requests */
+    size_t rlen;                  /* buffered incoming bytes */
+    unsigned int head, tail;      /* slots ring, tail - head is used */
+    size_t head_off;              /* sent bytes of head slot */
+    char rbuf[RBUFSIZE];
+    struct px_slot slots[PX_SLOTS];
+};
+
+/* client request, waiting for sign forecast */
+struct px_waiter {
+    struct px_client *c;
+    unsigned int slot;
+};
+
+/*
+ * Cached forecast of sign. Concurrent misses wait for one upstream request
+ * (singleflight), response fill cache and all waiting slots.
+ */
+struct px_sign {
+    char data[ASTRO_FORECAST_SIZE];
+    uint64_t expires; /* monotonic ms, 0 - not cached */
+    int inflight;     /* upstream request is sent */
+    int retried;      /* request is resent after upstream failure */
+    int hedged;       /* duplicate is sent to other backend */
+    int copies;       /* upstream requests of flight, waiting response */
+    uint32_t gen;     /* flight number, responses of old flights are late */
+    struct px_upstream *primary; /* connection of hedged request */
+    struct px_waiter *wait;
+    size_t wcnt, wcap;
+};
+
+/* request in upstream connection pipeline */
+struct px_flight {
+    int sign;
+    int hedge; /* duplicate of slow request */
+    uint32_t gen;
+    uint64_t sent_us;
+    uint64_t won_us; /* hedge response time, if request lost to it */
+};
+
+/* astrolog instance with own pool of connections */
+struct px_backend {
+    const SA_IN *addr;
+    char name[INET_ADDRSTRLEN + 6];
+    int live;               /* connections not in UP_DOWN state */
+    size_t inflight;        /* requests in flight on all connections */
+    uint64_t ejected_until; /* monotonic ms, not picked before */
+    unsigned int eject_ms;  /* last ejection, doubled on next failure */
+    unsigned long requests, failures;
+};
+
+struct px_upstream {
+    int kind;
+    int idx;
+    struct px_backend *be;
+    int fd;
+    int state;
+    time_t retry;  /* reconnect time */
+    uint64_t last; /* last response (or first request) time, ms */
+    char *wbuf;   /* pipelined requests */
+    size_t wpos, wlen, wcap;
+    size_t rlen;
+    char rbuf[UP_RBUF];
+    struct px_flight *wait; /* FIFO of requests, power of 2 capacity */
+    size_t whead, wcnt, wait_cap;
+};
+
+/* clients, ordered by last activity (head is oldest) */
+struct px_list {
+    struct px_client *head;
+    struct px_client *tail;
+    long int count;
+};
+
+struct px_ctx {
+    int ep_fd;
+    const struct config *conf;
+    struct px_list clients;
+    struct px_client **dead; /* closed in current iteration, freed after */
+    size_t ndead, dead_cap;
+    struct px_backend *backends;
+    int nbackends;
+    struct px_upstream *ups;
+    int nups;
+    uint64_t now_ms; /* monotonic, for cache expire and timeouts */
+    uint64_t now_us; /* monotonic, for upstream latency */
+    struct px_sign signs[ASTRO_SIGNS];
+    unsigned long hits, misses, coalesced;
+    /* response latency in current window, hedge delay from previous */
+    uint32_t lat[LAT_BUCKETS];
+    unsigned long lat_count;
+    uint64_t window_end; /* ms */
+    uint64_t hedge_delay; /* us, 0 - unknown yet */
+    unsigned int hedge_tokens; /* budget, percent of hedge */
+    unsigned long hedges, hedge_wins, hedge_denied;
+    uint64_t hedge_saved; /* us, sum for won hedges with primary response */
+    unsigned long hedge_measured;
+};
+
+static void list_remove(struct px_list *l, struct px_client *c) {
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        l->head = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    else
+        l->tail = c->prev;
+    c->prev = c->next = NULL;
+}
+
+static void list_append(struct px_list *l, struct px_client *c) {
+    c->next = NULL;
+    c->prev = l->tail;
+    if (l->tail)
+        l->tail->next = c;
+    else
+        l->head = c;
+    l->tail = c;
+}
+
+static void client_touch(struct px_list *l, struct px_client *c, time_t now) {
+    c->last = now;
+    if (l->tail != c) {
+        list_remove(l, c);
+        list_append(l, c);
+    }
+}
+
+/* free is deferred, pending epoll events may point to client */
+static void client_release(struct px_ctx *ctx, struct px_client *c) {
+    if (c->fd != -1 || c->refs > 0)
+        return;
+    if (ctx->ndead == ctx->dead_cap) {
+        size_t cap = ctx->dead_cap ? ctx->dead_cap * 2 : 64;
+        struct px_client **p = realloc(ctx->dead, cap * sizeof(*p));
+        if (p == NULL) {
+            _LOG_ERROR(root_logger, "%s", "alloc dead clients");
+            return; /* leak, better than use after free */
+        }
+        ctx->dead = p;
+        ctx->dead_cap = cap;
+    }
+    ctx->dead[ctx->ndead++] = c;
+}
+
+static void client_close(struct px_ctx *ctx, struct px_client *c, int status,
+                         int err) {
+    if (c->fd == -1)
+        return;
+    if (status == SESS_ERR) {
+        ALOG(LOG_ERR, "close client connection from %s:%d: %s", c->ip,
+             c->port, strerror(err));
+    } else if (status == SESS_WAIT) {
+        if (c->rlen > 0 || c->refs > 0)
+            ALOG(LOG_ERR,
+                 "close client connection from %s:%d (timeout, "
+                 "incomplete request)",
+                 c->ip, c->port);
+        else
+            ALOG_SAMPLED(LOG_INFO,
+                         "close client connection from %s:%d (timeout)",
+                         c->ip, c->port);
+    } else {
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d", c->ip,
+                     c->port);
+    }
+    /* close also remove fd from epoll set */
+    close(c->fd);
+    c->fd = -1;
+    list_remove(&ctx->clients, c);
+    ctx->clients.count--;
+    client_release(ctx, c);
+}
+
+static int flights_push(struct px_upstream *up, const struct px_flight *f) {
+    if (up->wcnt == up->wait_cap) {
+        size_t cap = up->wait_cap ? up->wait_cap * 2 : 64;
+        struct px_flight *w = malloc(cap * sizeof(*w));
+        if (w == NULL)
+            return -1;
+        /* unwrap ring in FIFO order */
+        for (size_t i = 0; i < up->wcnt; i++)
+            w[i] = up->wait[(up->whead + i) & (up->wait_cap - 1)];
+        free(up->wait);
+        up->wait = w;
+        up->wait_cap = cap;
+        up->whead = 0;
+    }
+    up->wait[(up->whead + up->wcnt) & (up->wait_cap - 1)] = *f;
+    up->wcnt++;
+    up->be->inflight++;
+    return 0;
+}
+
+static struct px_flight flights_pop(struct px_upstream *up) {
+    struct px_flight f = up->wait[up->whead];
+    up->whead = (up->whead + 1) & (up->wait_cap - 1);
+    up->wcnt--;
+    up->be->inflight--;
+    return f;
+}
+
+/* response to other copy of flight is already used */
+static int flight_late(const struct px_ctx *ctx, const struct px_flight *f) {
+    const struct px_sign *sg = &ctx->signs[f->sign];
+    return !sg->inflight || sg->gen != f->gen;
+}
+
+static unsigned int lat_bucket(uint64_t us) {
+    unsigned int msb, b;
+    if (us < LAT_SUB)
+        return us;
+    msb = 63 - __builtin_clzll(us);
+    b = (msb - 2) * LAT_SUB + ((us >> (msb - 3)) & (LAT_SUB - 1));
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+/* upper bound of bucket values */
+static uint64_t lat_value(unsigned int b) {
+    unsigned int msb;
+    if (b < LAT_SUB)
+        return b;
+    msb = b / LAT_SUB + 2;
+    return ((uint64_t) (LAT_SUB + b % LAT_SUB + 1) << (msb - 3)) - 1;
+}
+
+/* hedge response is first, mark primary request to measure saved time */
+static void hedge_won(struct px_ctx *ctx, const struct px_flight *f) {
+    struct px_upstream *up = ctx->signs[f->sign].primary;
+    ctx->hedge_wins++;
+    if (up == NULL)
+        return;
+    for (size_t j = 0; j < up->wcnt; j++) {
+        struct px_flight *p = &up->wait[(up->whead + j) & (up->wait_cap - 1)];
+        if (p->sign == f->sign && p->gen == f->gen && !p->hedge) {
+            p->won_us = ctx->now_us;
+            return;
+        }
+    }
+}
+
+/* slow primary request lost to hedge: time hedge saved */
+static void hedge_saved(struct px_ctx *ctx, const struct px_flight *f) {
+    if (f->won_us) {
+        ctx->hedge_saved += ctx->now_us - f->won_us;
+        ctx->hedge_measured++;
+    }
+}
+
+/* hedge delay is percentile of response latency of last window */
+static void hedge_window(struct px_ctx *ctx) {
+    uint64_t need, sum = 0;
+    unsigned int b;
+    if (ctx->now_ms < ctx->window_end)
+        return;
+    ctx->window_end = ctx->now_ms + HEDGE_WINDOW;
+    if (ctx->lat_count < HEDGE_MIN_SAMPLES)
+        return;
+    need = (uint64_t) (ctx->lat_count * ctx->conf->hedge / 100.0);
+    for (b = 0; b < LAT_BUCKETS - 1; b++) {
+        sum += ctx->lat[b];
+        if (sum > need)
+            break;
+    }
+    ctx->hedge_delay = lat_value(b);
+    if (ctx->hedge_delay < HEDGE_MIN_DELAY)
+        ctx->hedge_delay = HEDGE_MIN_DELAY;
+    memset(ctx->lat, 0, sizeof(ctx->lat));
+    ctx->lat_count = 0;
+}
+
+static int sign_wait(struct px_sign *sg, struct px_client *c,
+                     unsigned int slot) {
+    if (sg->wcnt == sg->wcap) {
+        size_t cap = sg->wcap ? sg->wcap * 2 : 16;
+        struct px_waiter *w = realloc(sg->wait, cap * sizeof(*w));
+        if (w == NULL)
+            return -1;
+        sg->wait = w;
+        sg->wcap = cap;
+    }
+    sg->wait[sg->wcnt++] = (struct px_waiter){c, slot};
+    c->refs++;
+    return 0;
+}
+
+static void client_event(struct px_ctx *ctx, struct px_client *c, time_t now);
+
+/*
+ * Upstream request for sign is done: fill waiting slots with DATA, or close
+ * waiting clients with ERR if DATA is NULL.
+ */
+static void sign_done(struct px_ctx *ctx, int sign, const char *data, int err,
+                      time_t now) {
+    struct px_sign *sg = &ctx->signs[sign];
+    struct px_waiter *wait = sg->wait;
+    size_t wcnt = sg->wcnt;
+
+    /* new misses from resumed clients start new request */
+    sg->inflight = 0;
+    sg->retried = 0;
+    sg->hedged = 0;
+    sg->copies = 0;
+    sg->primary = NULL;
+    sg->wait = NULL;
+    sg->wcnt = sg->wcap = 0;
+    if (data) {
+        memcpy(sg->data, data, ASTRO_FORECAST_SIZE);
+        if (ctx->conf->cache_ttl > 0)
+            sg->expires = ctx->now_ms + ctx->conf->cache_ttl;
+    }
+    for (size_t i = 0; i < wcnt; i++) {
+        struct px_client *c = wait[i].c;
+        c->refs--;
+        if (c->fd == -1) {
+            client_release(ctx, c);
+        } else if (data) {
+            struct px_slot *s = &c->slots[wait[i].slot % PX_SLOTS];
+            memcpy(s->data, data, ASTRO_FORECAST_SIZE);
+            s->ready = 1;
+            /* flush and resume paused client (may queue to upstreams) */
+            client_event(ctx, c, now);
+        } else {
+            client_close(ctx, c, SESS_ERR, err);
+        }
+    }
+    free(wait);
+}
+
+static void up_reset(struct px_upstream *up, time_t retry) {
+    if (up->state != UP_DOWN)
+        up->be->live--;
+    if (up->fd != -1)
+        close(up->fd);
+    up->fd = -1;
+    up->state = UP_DOWN;
+    up->retry = retry;
+    up->wpos = up->wlen = 0;
+    up->rlen = 0;
+}
+
+/* don't pick failed backend for a while, longer on repeated failures */
+static void backend_eject(struct px_ctx *ctx, struct px_backend *be) {
+    be->failures++;
+    if (be->ejected_until > ctx->now_ms)
+        return; /* other connection of ejected backend */
+    if (be->eject_ms == 0)
+        be->eject_ms = EJECT_TIME;
+    else if (be->eject_ms < MAX_EJECT_TIME)
+        be->eject_ms = be->eject_ms * 2 < MAX_EJECT_TIME ? be->eject_ms * 2
+                                                         : MAX_EJECT_TIME;
+    be->ejected_until = ctx->now_ms + be->eject_ms;
+    _LOG_WARN(root_logger, "backend %s ejected for %u ms", be->name,
+              be->eject_ms);
+}
+
+/* power of two choices: less loaded of two random backends */
+static struct px_backend *backend_pick(struct px_ctx *ctx,
+                                       const struct px_backend *exclude) {
+    struct px_backend *cand[MAX_BACKENDS];
+    int n = 0, i, j;
+    for (i = 0; i < ctx->nbackends; i++) {
+        struct px_backend *be = &ctx->backends[i];
+        if (be != exclude && be->live > 0 && be->ejected_until <= ctx->now_ms)
+            cand[n++] = be;
+    }
+    if (n == 0) {
+        /* all ejected, better try them than fail all requests */
+        for (i = 0; i < ctx->nbackends; i++) {
+            struct px_backend *be = &ctx->backends[i];
+            if (be != exclude && be->live > 0)
+                cand[n++] = be;
+        }
+    }
+    if (n <= 1)
+        return n ? cand[0] : NULL;
+    i = random() % n;
+    j = random() % (n - 1);
+    if (j >= i)
+        j++;
+    return cand[i]->inflight <= cand[j]->inflight ? cand[i] : cand[j];
+}
+
+static int up_send(struct px_ctx *ctx, struct px_upstream *up, int sign,
+                   int hedge);
+
+/* least loaded of live connections of picked backend */
+static struct px_upstream *up_pick(struct px_ctx *ctx,
+                                   const struct px_backend *exclude) {
+    struct px_upstream *best = NULL;
+    struct px_backend *be = backend_pick(ctx, exclude);
+    int first;
+    if (be == NULL)
+        return NULL;
+    first = (be - ctx->backends) * ctx->conf->connections;
+    for (int i = first; i < first + ctx->conf->connections; i++) {
+        struct px_upstream *up = &ctx->ups[i];
+        if (up->state == UP_DOWN)
+            continue;
+        if (best == NULL || up->wcnt < best->wcnt)
+            best = up;
+    }
+    return best;
+}
+
+/*
+ * upstream connection lost, resend in-flight requests to other backend
+ * (if other copy of request is not in flight already)
+ */
+static void up_fail(struct px_ctx *ctx, struct px_upstream *up, int err,
+                    time_t now) {
+    _LOG_ERROR(root_logger, "upstream %s connection %d: %s", up->be->name,
+               up->idx, err ? strerror(err) : "protocol error");
+    up_reset(up, now + UP_RETRY);
+    backend_eject(ctx, up->be);
+    while (up->wcnt > 0) {
+        struct px_flight f = flights_pop(up);
+        struct px_sign *sg = &ctx->signs[f.sign];
+        struct px_upstream *other;
+        if (flight_late(ctx, &f)) {
+            hedge_saved(ctx, &f); /* at least */
+            continue;
+        }
+        if (sg->copies > 1)
+            sg->copies--;
+        else if (!sg->retried && (other = up_pick(ctx, up->be)) != NULL &&
+                 up_send(ctx, other, f.sign, 0) == 0) {
+            sg->copies--; /* replaced by resent */
+            sg->retried = 1;
+        } else
+            sign_done(ctx, f.sign, NULL, err ? err : EPROTO, now);
+    }
+}
+
+/*
+ * Duplicate requests without response for hedge delay to other backend,
+ * while budget (percent of primary requests) allows.
+ */
+static void hedge_check(struct px_ctx *ctx) {
+    if (ctx->hedge_delay == 0)
+        return;
+    for (int i = 0; i < ctx->nups; i++) {
+        struct px_upstream *up = &ctx->ups[i];
+        for (size_t j = 0; j < up->wcnt; j++) {
+            size_t k = (up->whead + j) & (up->wait_cap - 1);
+            struct px_flight *f = &up->wait[k];
+            struct px_sign *sg = &ctx->signs[f->sign];
+            struct px_upstream *other;
+            /* FIFO is in send order, rest is younger */
+            if (ctx->now_us - f->sent_us < ctx->hedge_delay)
+                break;
+            if (f->hedge || sg->hedged || flight_late(ctx, f))
+                continue;
+            if (ctx->hedge_tokens < 100) {
+                ctx->hedge_denied++;
+                sg->hedged = 1; /* don't count it again */
+                continue;
+            }
+            if ((other = up_pick(ctx, up->be)) == NULL)
+                return; /* no other backend */
+            if (up_send(ctx, other, f->sign, 1) == -1)
+                return;
+            /* FIFO of this upstream isn't changed, f is valid */
+            ctx->hedge_tokens -= 100;
+            ctx->hedges++;
+            sg->hedged = 1;
+            sg->primary = up;
+        }
+    }
+}
+
+static void up_connect(struct px_ctx *ctx, struct px_upstream *up,
+                       time_t now) {
+    struct epoll_event ev;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        up->retry = now + UP_RETRY;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "upstream socket");
+        return;
+    }
+    up->fd = fd;
+    up->state = UP_CONNECTING;
+    up->be->live++;
+    up->last = ctx->now_ms;
+    if (connect(fd, (SA *) up->be->addr, sizeof(SA_IN)) == -1 &&
+        errno != EINPROGRESS) {
+        up_fail(ctx, up, errno, now);
+        return;
+    }
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = up;
+    if (epoll_ctl(ctx->ep_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        up_fail(ctx, up, errno, now);
+        return;
+    }
+}
+
+static int up_flush(struct px_ctx *ctx, struct px_upstream *up, time_t now) {
+    while (up->wpos < up->wlen) {
+        ssize_t n = send(up->fd, up->wbuf + up->wpos, up->wlen - up->wpos,
+                         MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0; /* wait for EPOLLOUT */
+            else if (errno == EINTR)
+                continue;
+            up_fail(ctx, up, errno, now);
+            return -1;
+        }
+        up->wpos += n;
+    }
+    up->wpos = up->wlen = 0;
+    return 0;
+}
+
+/* queue request for sign, sent by up_flush at end of loop iteration */
+static int up_send(struct px_ctx *ctx, struct px_upstream *up, int sign,
+                   int hedge) {
+    struct px_sign *sg = &ctx->signs[sign];
+    struct px_flight f = {sign, hedge, sg->gen, ctx->now_us, 0};
+    char *req;
+    if (up->wlen + ASTRO_REQ_SIZE > up->wcap) {
+        size_t cap;
+        char *p;
+        if (up->wpos > 0) {
+            memmove(up->wbuf, up->wbuf + up->wpos, up->wlen - up->wpos);
+            up->wlen -= up->wpos;
+            up->wpos = 0;
+        }
+        cap = up->wcap ? up->wcap : 4096;
+        while (up->wlen + ASTRO_REQ_SIZE > cap)
+            cap *= 2;
+        if (cap != up->wcap) {
+            if ((p = realloc(up->wbuf, cap)) == NULL)
+                return -1;
+            up->wbuf = p;
+            up->wcap = cap;
+        }
+    }
+    if (flights_push(up, &f) == -1)
+        return -1;
+    sg->copies++;
+    if (up->wcnt == 1)
+        up->last = ctx->now_ms; /* response timeout from first request */
+    req = up->wbuf + up->wlen;
+    memcpy(req, ASTRO_HOROSCOPE, ASTRO_CMD_SIZE);
+    memcpy(req + ASTRO_CMD_SIZE, astro_sign_name(sign), ASTRO_SIGN_SIZE);
+    req[ASTRO_REQ_SIZE - 1] = '\n';
+    up->wlen += ASTRO_REQ_SIZE;
+    up->be->requests++;
+    return 0;
+}
+
+/* send ready responses in client order, return -1 on error or EAGAIN */
+static int client_flush(struct px_client *c) {
+    while (c->head != c->tail) {
+        struct iovec iov[PX_SLOTS];
+        int cnt = 0;
+        ssize_t n;
+        for (unsigned int i = c->head; i != c->tail; i++) {
+            struct px_slot *s = &c->slots[i % PX_SLOTS];
+            if (!s->ready)
+                break;
+            iov[cnt].iov_base = s->data;
+            iov[cnt].iov_len = s->len;
+            cnt++;
+        }
+        if (cnt == 0)
+            return 0;
+        iov[0].iov_base = (char *) iov[0].iov_base + c->head_off;
+        iov[0].iov_len -= c->head_off;
+        n = writev(c->fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        n += c->head_off;
+        c->head_off = 0;
+        while (c->head != c->tail) {
+            struct px_slot *s = &c->slots[c->head % PX_SLOTS];
+            if (!s->ready || (size_t) n < s->len)
+                break;
+            n -= s->len;
+            s->ready = 0;
+            c->head++;
+        }
+        if (n > 0)
+            c->head_off = n;
+    }
+    return 0;
+}
+
+/* parse requests while free slots, return -1 on invalid request */
+static int client_process(struct px_ctx *ctx, struct px_client *c) {
+    size_t pos = 0;
+    while (pos < c->rlen && c->tail - c->head < PX_SLOTS) {
+        struct astro_req req;
+        struct px_slot *s = &c->slots[c->tail % PX_SLOTS];
+        ssize_t n = astro_parse(c->rbuf + pos, c->rlen - pos, &req);
+        if (n == 0)
+            break;
+        if (n == -1) {
+            size_t show = c->rlen - pos < ASTRO_REQ_SIZE - 1
+                              ? c->rlen - pos
+                              : ASTRO_REQ_SIZE - 1;
+            ALOG(LOG_ERR, "invalid request from %s:%d: %.*s", c->ip, c->port,
+                 (int) show, c->rbuf + pos);
+            return -1;
+        }
+        if (req.cmd != ASTRO_CMD_HOROSCOPE) {
+            /*
+             * secretary never pass star forecast to astrolog, and push
+             * subscription can't share pipelined upstream connection
+             */
+            memcpy(s->data, ASTRO_DENIED, ASTRO_REPLY_SIZE);
+            s->len = ASTRO_REPLY_SIZE;
+            s->ready = 1;
+        } else if (ctx->signs[req.sign].expires > ctx->now_ms) {
+            memcpy(s->data, ctx->signs[req.sign].data, ASTRO_FORECAST_SIZE);
+            s->len = ASTRO_FORECAST_SIZE;
+            s->ready = 1;
+            ctx->hits++;
+        } else {
+            struct px_sign *sg = &ctx->signs[req.sign];
+            if (sg->inflight) {
+                ctx->coalesced++;
+            } else {
+                struct px_upstream *up = up_pick(ctx, NULL);
+                if (up == NULL) {
+                    ALOG(LOG_ERR, "no upstream for %s:%d", c->ip, c->port);
+                    return -1;
+                }
+                sg->gen++;
+                if (up_send(ctx, up, req.sign, 0) == -1) {
+                    _LOG_ERROR(root_logger, "%s", "alloc upstream queue");
+                    return -1;
+                }
+                sg->inflight = 1;
+                ctx->misses++;
+                if (ctx->conf->hedge > 0 &&
+                    ctx->hedge_tokens < HEDGE_BURST * 100)
+                    ctx->hedge_tokens += ctx->conf->hedge_budget;
+            }
+            s->len = ASTRO_FORECAST_SIZE;
+            s->ready = 0;
+            if (sign_wait(sg, c, c->tail) == -1) {
+                _LOG_ERROR(root_logger, "%s", "alloc sign waiters");
+                return -1;
+            }
+        }
+        c->tail++;
+        pos += n;
+    }
+    if (pos > 0) {
+        c->rlen -= pos;
+        memmove(c->rbuf, c->rbuf + pos, c->rlen);
+    }
+    return 0;
+}
+
+/* edge-triggered io: run until recv or send return EAGAIN or pause */
+static int client_io(struct px_ctx *ctx, struct px_client *c) {
+    while (running) {
+        ssize_t n;
+        if (client_flush(c) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return SESS_WAIT; /* wait for EPOLLOUT */
+            return SESS_ERR;
+        }
+        if (client_process(ctx, c) == -1) {
+            client_flush(c);
+            return SESS_INVALID;
+        }
+        if (c->head != c->tail && c->slots[c->head % PX_SLOTS].ready)
+            continue; /* local responses */
+        if (c->eof)
+            return c->head == c->tail ? SESS_EOF : SESS_WAIT;
+        if (c->tail - c->head == PX_SLOTS)
+            return SESS_WAIT; /* paused until upstream responses */
+
+        n = recv(c->fd, c->rbuf + c->rlen, RBUFSIZE - c->rlen, 0);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return SESS_WAIT; /* wait for EPOLLIN */
+            else if (errno == EINTR)
+                continue;
+            return SESS_ERR;
+        } else if (n == 0) {
+            /* deliver in-flight responses before close */
+            if (c->rlen > 0)
+                ALOG(LOG_ERR, "incomplete request from %s:%d (%zu bytes)",
+                     c->ip, c->port, c->rlen);
+            c->eof = 1;
+            continue;
+        }
+        c->rlen += n;
+    }
+    return SESS_EOF;
+}
+
+static void client_event(struct px_ctx *ctx, struct px_client *c,
+                         time_t now) {
+    int status = client_io(ctx, c);
+    if (status == SESS_WAIT)
+        client_touch(&ctx->clients, c, now);
+    else
+        client_close(ctx, c, status, errno);
+}
+
+/* first response of flight is used, late copy is dropped */
+static void up_response(struct px_ctx *ctx, struct px_upstream *up,
+                        const char *rec, time_t now) {
+    struct px_flight f = flights_pop(up);
+    ctx->lat[lat_bucket(ctx->now_us - f.sent_us)]++;
+    ctx->lat_count++;
+    if (flight_late(ctx, &f)) {
+        hedge_saved(ctx, &f);
+        return;
+    }
+    if (f.hedge)
+        hedge_won(ctx, &f);
+    sign_done(ctx, f.sign, rec, 0, now);
+}
+
+/* read responses, fill slots of waiting clients */
+static void up_read(struct px_ctx *ctx, struct px_upstream *up, time_t now) {
+    while (up->state == UP_READY) {
+        size_t pos = 0;
+        ssize_t n = recv(up->fd, up->rbuf + up->rlen, UP_RBUF - up->rlen, 0);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            else if (errno == EINTR)
+                continue;
+            up_fail(ctx, up, errno, now);
+            return;
+        } else if (n == 0) {
+            if (up->wcnt == 0 && up->rlen == 0) {
+                /* idle connection closed by astrolog, reconnect now */
+                _LOG_INFO(root_logger, "upstream %s connection %d closed",
+                          up->be->name, up->idx);
+                up_reset(up, now);
+            } else {
+                up_fail(ctx, up, ECONNRESET, now);
+            }
+            return;
+        }
+        up->rlen += n;
+        up->last = ctx->now_ms;
+        /* backend answers, next failure start from short ejection */
+        up->be->eject_ms = 0;
+        while (up->rlen - pos >= ASTRO_FORECAST_SIZE) {
+            const char *rec = up->rbuf + pos;
+            if (up->wcnt == 0 || rec[ASTRO_FORECAST_SIZE - 1] != '\n') {
+                up_fail(ctx, up, 0, now);
+                return;
+            }
+            up_response(ctx, up, rec, now);
+            pos += ASTRO_FORECAST_SIZE;
+        }
+        up->rlen -= pos;
+        memmove(up->rbuf, up->rbuf + pos, up->rlen);
+    }
+}
+
+static void up_event(struct px_ctx *ctx, struct px_upstream *up,
+                     uint32_t events, time_t now) {
+    if (up->state == UP_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            return;
+        getsockopt(up->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) {
+            up_fail(ctx, up, err, now);
+            return;
+        }
+        up->state = UP_READY;
+        up->last = ctx->now_ms;
+        _LOG_INFO(root_logger, "upstream %s connection %d ready", up->be->name,
+                  up->idx);
+    }
+    if (up->state == UP_READY && (events & EPOLLOUT))
+        up_flush(ctx, up, now);
+    if (up->state == UP_READY)
+        up_read(ctx, up, now);
+}
+
+static struct px_client *client_new(int sess_fd, SA_IN *client_addr,
+                                    time_t now) {
+    struct px_client *c = malloc(sizeof(struct px_client));
+    if (c == NULL)
+        return NULL;
+    c->kind = PX_CLIENT;
+    c->fd = sess_fd;
+    c->port = client_addr->sin_port;
+    c->last = now;
+    c->prev = c->next = NULL;
+    c->refs = 0;
+    c->eof = 0;
+    c->rlen = 0;
+    c->head = c->tail = 0;
+    c->head_off = 0;
+
+    /* Format client IP address (numeric, so without getnameinfo overhead) */
+    if (inet_ntop(AF_INET, &client_addr->sin_addr, c->ip, INET_ADDRSTRLEN)) {
+        ALOG_SAMPLED(LOG_INFO, "connect from %s:%d", c->ip, c->port);
+    } else {
+        c->ip[0] = '\0';
+        ALOG(LOG_ERR, "invalid address for socket %d", sess_fd);
+    }
+    return c;
+}
+
+/* accept pending connections, until queue empty or error */
+static void accept_clients(struct px_ctx *ctx, int srv_fd, time_t now) {
+    SA_IN client_addr;
+    socklen_t client_addr_len;
+    struct epoll_event ev;
+    while (running) {
+        struct px_client *c;
+        int sess_fd;
+        client_addr_len = sizeof(client_addr);
+        sess_fd = accept4(srv_fd, (SA *) &client_addr, &client_addr_len,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sess_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            ALOG(LOG_ERR, "%s on socket %d: %s", "accept", srv_fd,
+                 strerror(errno));
+            /* EMFILE, ENFILE, ENOMEM: retry on next loop */
+            return;
+        }
+
+        if ((c = client_new(sess_fd, &client_addr, now)) == NULL) {
+            _LOG_ERROR(root_logger, "%s", "alloc session");
+            close(sess_fd);
+            return;
+        }
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(ctx->ep_fd, EPOLL_CTL_ADD, sess_fd, &ev) == -1) {
+            _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
+                             "epoll_ctl", sess_fd);
+            close(sess_fd);
+            free(c);
+            continue;
+        }
+        list_append(&ctx->clients, c);
+        ctx->clients.count++;
+    }
+}
+
+static uint64_t clock_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void clock_update(struct px_ctx *ctx) {
+    ctx->now_us = clock_us();
+    ctx->now_ms = ctx->now_us / 1000;
+}
+
+static void stats_log(const struct px_ctx *ctx) {
+    _LOG_INFO(root_logger,
+              "cache: hits %lu, misses %lu, coalesced %lu, clients %ld",
+              ctx->hits, ctx->misses, ctx->coalesced, ctx->clients.count);
+    for (int i = 0; i < ctx->nbackends; i++) {
+        const struct px_backend *be = &ctx->backends[i];
+        _LOG_INFO(root_logger,
+                  "backend %s: requests %lu, failures %lu, in flight %zu%s",
+                  be->name, be->requests, be->failures, be->inflight,
+                  be->ejected_until > ctx->now_ms ? ", ejected" : "");
+    }
+    if (ctx->conf->hedge > 0)
+        _LOG_INFO(root_logger,
+                  "hedge: delay %lu us, sent %lu (%.2f%% of misses), won %lu, "
+                  "saved avg %lu us, over budget %lu",
+                  (unsigned long) ctx->hedge_delay, ctx->hedges,
+                  ctx->misses ? 100.0 * ctx->hedges / ctx->misses : 0.0,
+                  ctx->hedge_wins,
+                  ctx->hedge_measured ? (unsigned long) (ctx->hedge_saved /
+                                                         ctx->hedge_measured)
+                                      : 0,
+                  ctx->hedge_denied);
+}
+
+int proxy_loop(int srv_fd, const struct config *conf) {
+    int ec = 0;
+    struct epoll_event ev;
+    struct epoll_event events[MAX_EVENTS];
+    struct px_ctx ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.ep_fd = -1;
+    ctx.conf = conf;
+    clock_update(&ctx);
+    ctx.window_end = ctx.now_ms + HEDGE_WINDOW;
+    ctx.hedge_tokens = HEDGE_BURST * 100;
+    srandom(time(NULL) ^ getpid());
+    ctx.nbackends = conf->nbackends;
+    ctx.nups = conf->nbackends * conf->connections;
+    ctx.backends = calloc(ctx.nbackends, sizeof(struct px_backend));
+    ctx.ups = calloc(ctx.nups, sizeof(struct px_upstream));
+    if (ctx.backends == NULL || ctx.ups == NULL) {
+        ec = -1;
+        _LOG_ERROR(root_logger, "%s", "alloc upstreams");
+        goto EXIT;
+    }
+    for (int i = 0; i < ctx.nbackends; i++) {
+        struct px_backend *be = &ctx.backends[i];
+        be->addr = &conf->backends[i];
+        snprintf(be->name, sizeof(be->name), "%s:%d",
+                 inet_ntoa(be->addr->sin_addr), ntohs(be->addr->sin_port));
+    }
+    for (int i = 0; i < ctx.nups; i++) {
+        ctx.ups[i].kind = PX_UPSTREAM;
+        ctx.ups[i].idx = i % conf->connections;
+        ctx.ups[i].be = &ctx.backends[i / conf->connections];
+        ctx.ups[i].fd = -1;
+        ctx.ups[i].state = UP_DOWN;
+    }
+
+    if ((ctx.ep_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_create");
+        goto EXIT;
+    }
+    set_nonblock(srv_fd);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* NULL is listen socket */
+    if (epoll_ctl(ctx.ep_fd, EPOLL_CTL_ADD, srv_fd, &ev) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
+                         "epoll_ctl", srv_fd);
+        goto EXIT;
+    }
+
+    while (running) {
+        time_t now = time(NULL);
+        int n, wait_ms = 1000;
+
+        clock_update(&ctx);
+        for (int i = 0; i < ctx.nups; i++) {
+            struct px_upstream *up = &ctx.ups[i];
+            if (up->state == UP_DOWN && up->retry <= now)
+                up_connect(&ctx, up, now);
+            else if (up->state != UP_DOWN && up->wcnt > 0 &&
+                     ctx.now_ms - up->last >= (uint64_t) conf->up_timeout)
+                up_fail(&ctx, up, ETIMEDOUT, now);
+        }
+        if (conf->hedge > 0) {
+            hedge_window(&ctx);
+            hedge_check(&ctx);
+        }
+        /* response timeouts are checked more often than idle clients */
+        for (int i = 0; i < ctx.nups; i++) {
+            if (ctx.ups[i].wcnt > 0) {
+                wait_ms = conf->up_timeout < 400 ? conf->up_timeout / 4 + 1
+                                                 : 100;
+                if (ctx.hedge_delay > 0)
+                    wait_ms = 1; /* hedge delay is often below 1 ms */
+                break;
+            }
+        }
+        /* flush requests, resent by failed upstreams or hedged */
+        for (int i = 0; i < ctx.nups; i++) {
+            if (ctx.ups[i].state == UP_READY && ctx.ups[i].wlen > 0)
+                up_flush(&ctx, &ctx.ups[i], now);
+        }
+
+        n = epoll_wait(ctx.ep_fd, events, MAX_EVENTS, wait_ms);
+        if (n == -1) {
+            if (errno != EINTR) {
+                _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_wait");
+                ec = -1;
+                break;
+            }
+            n = 0;
+        }
+        now = time(NULL);
+        clock_update(&ctx);
+        if (stats_dump) {
+            stats_dump = 0;
+            stats_log(&ctx);
+        }
+        for (int i = 0; i < n; i++) {
+            int *kind = events[i].data.ptr;
+            if (kind == NULL) {
+                accept_clients(&ctx, srv_fd, now);
+            } else if (*kind == PX_UPSTREAM) {
+                up_event(&ctx, (struct px_upstream *) kind, events[i].events,
+                         now);
+            } else {
+                struct px_client *c = (struct px_client *) kind;
+                if (c->fd == -1)
+                    continue; /* closed in this iteration */
+                if (events[i].events & EPOLLERR) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    client_close(&ctx, c, SESS_ERR, err);
+                    continue;
+                }
+                client_event(&ctx, c, now);
+            }
+        }
+        /* send requests, queued in this iteration, in batch */
+        for (int i = 0; i < ctx.nups; i++) {
+            if (ctx.ups[i].state == UP_READY && ctx.ups[i].wlen > 0)
+                up_flush(&ctx, &ctx.ups[i], now);
+        }
+        for (size_t i = 0; i < ctx.ndead; i++)
+            free(ctx.dead[i]);
+        ctx.ndead = 0;
+        /* close idle clients */
+        while (ctx.clients.head &&
+               now - ctx.clients.head->last >= conf->timeout)
+            client_close(&ctx, ctx.clients.head, SESS_WAIT, 0);
+    }
+
+EXIT:
+    stats_log(&ctx);
+    while (ctx.clients.head)
+        client_close(&ctx, ctx.clients.head, SESS_EOF, 0);
+    for (int i = 0; ctx.ups && i < ctx.nups; i++) {
+        /* closed clients are released by last in-flight request */
+        while (ctx.ups[i].wcnt > 0) {
+            struct px_flight f = flights_pop(&ctx.ups[i]);
+            if (!flight_late(&ctx, &f))
+                sign_done(&ctx, f.sign, NULL, ECANCELED, 0);
+        }
+        if (ctx.ups[i].fd != -1)
+            close(ctx.ups[i].fd);
+        free(ctx.ups[i].wbuf);
+        free(ctx.ups[i].wait);
+    }
+    free(ctx.ups);
+    free(ctx.backends);
+    for (size_t i = 0; i < ctx.ndead; i++)
+        free(ctx.dead[i]);
+    free(ctx.dead);
+    if (ctx.ep_fd != -1)
+        close(ctx.ep_fd);
+    close(srv_fd);
+    return ec;
+}
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "subscribe.h"
+
+static size_t sub_size(int workers) {
+    return sizeof(struct sub_table) + sizeof(struct sub_worker) * workers;
+}
+
+struct sub_table *sub_create(int workers) {
+    struct sub_table *t = mmap(NULL, sub_size(workers), PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED)
+        return NULL;
+    t->workers = workers;
+    for (int i = 0; i < workers; i++) {
+        struct sub_worker *w = &t->worker[i];
+        for (int s = 0; s < ASTRO_SIGNS; s++)
+            atomic_init(&w->subscribers[s], 0);
+        atomic_init(&w->notified, 0);
+        w->efd = -1;
+    }
+    for (int i = 0; i < workers; i++) {
+        /* inherited by workers, respawned worker reuse it */
+        t->worker[i].efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (t->worker[i].efd == -1) {
+            sub_destroy(t);
+            return NULL;
+        }
+    }
+    return t;
+}
+
+void sub_destroy(struct sub_table *t) {
+    if (t == NULL)
+        return;
+    for (int i = 0; i < t->workers; i++) {
+        if (t->worker[i].efd != -1)
+            close(t->worker[i].efd);
+    }
+    munmap(t, sub_size(t->workers));
+}
+
+void sub_reset(struct sub_table *t, int worker) {
+    struct sub_worker *w = &t->worker[worker];
+    for (int s = 0; s < ASTRO_SIGNS; s++)
+        atomic_store_explicit(&w->subscribers[s], 0, memory_order_relaxed);
+    sub_drain(t, worker);
+}
+
+void sub_notify(struct sub_table *t, unsigned int signs) {
+    uint64_t one = 1;
+    /* forecast is written before subscribers check (pair to subscribe) */
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int i = 0; i < t->workers; i++) {
+        struct sub_worker *w = &t->worker[i];
+        int found = 0;
+        for (int s = 0; s < ASTRO_SIGNS && !found; s++) {
+            if ((signs & (1u << s)) &&
+                atomic_load_explicit(&w->subscribers[s], memory_order_relaxed))
+                found = 1;
+        }
+        /* one eventfd write until worker drain it */
+        if (found && !atomic_exchange(&w->notified, 1)) {
+            ssize_t n = write(w->efd, &one, sizeof(one));
+            (void) n; /* EAGAIN only on counter overflow, already signaled */
+        }
+    }
+}
+
+void sub_drain(struct sub_table *t, int worker) {
+    struct sub_worker *w = &t->worker[worker];
+    uint64_t cnt;
+    /* clear flag before read, so later notify signal again */
+    atomic_store(&w->notified, 0);
+    while (read(w->efd, &cnt, sizeof(cnt)) > 0) {
+    }
+}
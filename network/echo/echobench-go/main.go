@@ -10,6 +10,7 @@ import (
 	"net"
 	"os"
 	"os/signal"
+	"sync"
 	"syscall"
 	"time"
 )
@@ -31,6 +32,9 @@ type Config struct {
 	Connections int           // number of opened connections, reused in workers
 	Send        int           // count of messages, sended in one connection
 	Delay       time.Duration // delay beetween send
+	Trace       int           // raw records per second in stat file, 0 - all
+	Rate        float64       // requests per second of all workers, 0 - closed loop
+	Arrival     Arrival       // inter-arrival times in open loop
 	Duration    time.Duration // test duration
 	ConTimeout  time.Duration // connection timeout
 	Timeout     time.Duration // send/recv timeout
@@ -70,6 +74,7 @@ func parseArgs() (Config, error) {
 		timeout    string
 		duration   string
 		delay      string
+		arrival    string
 		err        error
 	)
 
@@ -80,6 +85,8 @@ func parseArgs() (Config, error) {
 	flag.IntVar(&config.Connections, "connections", 0, "number of opened connections, reused in workers, by default - equal to workers count")
 	flag.IntVar(&config.Send, "send", 1, "count of messages, sended in one connection")
 	flag.StringVar(&delay, "delay", "0", "delay beetween send messages")
+	flag.Float64Var(&config.Rate, "rate", 0, "open loop: requests per second of all workers, latency from scheduled send time (0 - closed loop)")
+	flag.StringVar(&arrival, "arrival", "const", "open loop inter-arrival times: const or poisson")
 	flag.StringVar(&duration, "duration", "60s", "test duration")
 
 	flag.StringVar(&conTimeout, "c", "200ms", "connect timeout")
@@ -87,6 +94,7 @@ func parseArgs() (Config, error) {
 
 	flag.BoolVar(&config.Verbose, "verbose", false, "verbose")
 	flag.StringVar(&config.Stat, "stat", "", "stat file")
+	flag.IntVar(&config.Trace, "trace", 0, "max raw records per second in stat file, summary include all (0 - unlimited)")
 
 	flag.IntVar(&config.Size, "size", 512, "message size")
 
@@ -118,10 +126,22 @@ func parseArgs() (Config, error) {
 	if config.Size < 1 {
 		return config, fmt.Errorf("Invalid size value: %d", config.Size)
 	}
+	if config.Trace < 0 {
+		return config, fmt.Errorf("Invalid trace value: %d", config.Trace)
+	}
 	config.Delay, err = ParseDurationMin(delay, 0, "delay")
 	if err != nil {
 		return config, err
 	}
+	if config.Rate < 0 {
+		return config, fmt.Errorf("Invalid rate value: %g", config.Rate)
+	} else if config.Rate > 0 && config.Delay > 0 {
+		return config, fmt.Errorf("Delay can't be set with rate")
+	}
+	config.Arrival, err = ParseArrival(arrival)
+	if err != nil {
+		return config, err
+	}
 	config.Duration, err = ParseDurationMin(duration, 10*time.Second, "duration")
 	if err != nil {
 		return config, err
@@ -145,8 +165,16 @@ func DumpConfig(w io.Writer, config Config) {
 	fmt.Fprintf(w, "#connections: %d\n", config.Connections)
 	fmt.Fprintf(w, "#send: %d per connection\n", config.Send)
 	fmt.Fprintf(w, "#delay: %s\n", config.Delay)
+	if config.Rate > 0 {
+		fmt.Fprintf(w, "#rate: %g per second (%s arrival)\n", config.Rate, config.Arrival)
+	} else {
+		fmt.Fprintf(w, "#rate: closed loop\n")
+	}
 	fmt.Fprintf(w, "#connect timeout: %s\n", config.ConTimeout)
 	fmt.Fprintf(w, "#send/recv timeout: %s\n", config.Timeout)
+	if config.Trace > 0 {
+		fmt.Fprintf(w, "#trace: %d per second\n", config.Trace)
+	}
 
 	fmt.Fprintf(w, "#timestamp(ns)\ttesthost\tsession\tproto\tremote_address\toper\tduration(us)\tsize\tstatus\n")
 }
@@ -191,41 +219,48 @@ func main() {
 	signal.Notify(sigs, syscall.SIGINT, syscall.SIGTERM)
 
 	running = true
-	workers := config.Workers
-	result := make(chan Result, config.Workers*10000)
+	// workers write raw records in own buffers and count own stat,
+	// main only merge them at end
+	writer := StatWriterNew(bwstat, hostname, config)
+	stats := make([]*WorkerStat, config.Workers)
+	var wg sync.WaitGroup
 	b = cb.New(config.Workers + 1)
 	for i := 0; i < config.Workers; i++ {
-		go TcpWorker(i, config, result)
+		stats[i] = WorkerStatNew(writer)
+		wg.Add(1)
+		go func(id int) {
+			defer wg.Done()
+			TcpWorker(id, config, stats[id])
+		}(i)
 	}
+	done := make(chan struct{})
+	go func() {
+		wg.Wait()
+		close(done)
+	}()
 	timer_duration := time.NewTimer(config.Duration)
 	b.Await()
-	fmt.Fprintf(bwstat, "#%s\n", time.Now().Format(time.RFC3339))
+	start := time.Now()
+	// workers are started and may flush trace already
+	writer.mutex.Lock()
+	fmt.Fprintf(bwstat, "#%s\n", start.Format(time.RFC3339))
+	writer.mutex.Unlock()
 	log.Printf("Starting %d workers, duration %s\n", config.Workers, config.Duration)
-LOOP:
-	for workers > 0 {
-		select {
-		case <-sigs:
-			running = false
-			log.Println("Shutting down with interrupt")
-		case <-timer_duration.C:
-			running = false
-			log.Println("Shutting down")
-		case r := <-result:
-			if r.Status == Ended {
-				workers--
-				if workers == 0 {
-					break LOOP
-				}
-			} else {
-				// Log format
-				// epochtimestamp testhostname proto host:port operation status duration_ms size
-				fmt.Fprintf(bwstat, "%d\t%s\t%d\t%s\t%s\t%s\t%d\t%d\t%s\n",
-					r.Timestamp.UnixNano()/1000000, hostname, r.Id,
-					r.Proto, config.Addr, r.Operation,
-					r.Duration.Nanoseconds()/1000, r.Size,
-					r.Status)
-			}
-		}
+	select {
+	case <-sigs:
+		log.Println("Shutting down with interrupt")
+	case <-timer_duration.C:
+		log.Println("Shutting down")
+	case <-done:
 	}
+	running = false
+	<-done
+	elapsed := time.Since(start)
 
+	summary := WorkerStatNew(writer)
+	for i := range stats {
+		summary.Merge(stats[i])
+	}
+	summary.DumpSummary(os.Stderr, "", elapsed)
+	summary.DumpSummary(bwstat, "#", elapsed)
 }
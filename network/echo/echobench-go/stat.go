@@ -0,0 +1,211 @@
+package main
+
+import (
+	"fmt"
+	"io"
+	"strconv"
+	"sync"
+	"time"
+)
+
+// Log-linear latency histogram (us): 8 sub-buckets per power of 2,
+// relative error below 12.5%
+const (
+	histSub     = 8
+	histBuckets = histSub * 40
+)
+
+type Histogram struct {
+	Counts [histBuckets]uint64
+	Total  uint64
+	Max    time.Duration
+}
+
+func histBucket(us uint64) int {
+	if us < histSub {
+		return int(us)
+	}
+	msb := 63
+	for us>>uint(msb) == 0 {
+		msb--
+	}
+	b := (msb-2)*histSub + int((us>>uint(msb-3))&(histSub-1))
+	if b >= histBuckets {
+		return histBuckets - 1
+	}
+	return b
+}
+
+// upper bound of bucket values, us
+func histValue(b int) uint64 {
+	if b < histSub {
+		return uint64(b)
+	}
+	msb := b/histSub + 2
+	return (uint64(histSub+b%histSub+1) << uint(msb-3)) - 1
+}
+
+func (h *Histogram) Record(d time.Duration) {
+	h.Counts[histBucket(uint64(d/time.Microsecond))]++
+	h.Total++
+	if d > h.Max {
+		h.Max = d
+	}
+}
+
+func (h *Histogram) Merge(o *Histogram) {
+	for i := range h.Counts {
+		h.Counts[i] += o.Counts[i]
+	}
+	h.Total += o.Total
+	if o.Max > h.Max {
+		h.Max = o.Max
+	}
+}
+
+// Quantile return upper bound of bucket with q (0..1) quantile, us
+func (h *Histogram) Quantile(q float64) uint64 {
+	need := uint64(float64(h.Total) * q)
+	var sum uint64
+	for b := range h.Counts {
+		sum += h.Counts[b]
+		if sum > need {
+			if v := histValue(b); v < uint64(h.Max/time.Microsecond) {
+				return v
+			}
+			break
+		}
+	}
+	return uint64(h.Max / time.Microsecond)
+}
+
+// StatWriter is shared raw trace (statplot TSV) output of workers
+type StatWriter struct {
+	mutex    sync.Mutex
+	w        io.Writer
+	hostname string
+	addr     string
+	limit    int // records per second of one worker, 0 - unlimited
+}
+
+func StatWriterNew(w io.Writer, hostname string, config Config) *StatWriter {
+	s := &StatWriter{w: w, hostname: hostname, addr: config.Addr}
+	if config.Trace > 0 {
+		s.limit = (config.Trace + config.Workers - 1) / config.Workers
+	}
+	return s
+}
+
+const traceBufSize = 65536
+
+// WorkerStat is owned by one worker, merged in main after workers end, so
+// worker loop don't synchronize or allocate for results
+type WorkerStat struct {
+	Count   [OperationMax][StatusMax]uint64
+	Latency [OperationMax]Histogram // successful operations
+
+	out      *StatWriter
+	buf      []byte
+	traceSec int64 // current second of trace limit
+	traced   int
+	dropped  uint64 // records over trace limit
+}
+
+func WorkerStatNew(out *StatWriter) *WorkerStat {
+	return &WorkerStat{out: out, buf: make([]byte, 0, traceBufSize)}
+}
+
+func (s *WorkerStat) Add(r *Result) {
+	s.Count[r.Operation][r.Status]++
+	if r.Status == NetSuccess {
+		s.Latency[r.Operation].Record(r.Duration)
+	}
+	if s.out.limit > 0 {
+		sec := r.Timestamp.Unix()
+		if sec != s.traceSec {
+			s.traceSec = sec
+			s.traced = 0
+		}
+		if s.traced == s.out.limit {
+			s.dropped++
+			return
+		}
+		s.traced++
+	}
+	// Log format
+	// epochtimestamp testhostname proto host:port operation status duration_ms size
+	b := s.buf
+	b = strconv.AppendInt(b, r.Timestamp.UnixNano()/1000000, 10)
+	b = append(b, '\t')
+	b = append(b, s.out.hostname...)
+	b = append(b, '\t')
+	b = strconv.AppendInt(b, int64(r.Id), 10)
+	b = append(b, '\t')
+	b = append(b, r.Proto.String()...)
+	b = append(b, '\t')
+	b = append(b, s.out.addr...)
+	b = append(b, '\t')
+	b = append(b, r.Operation.String()...)
+	b = append(b, '\t')
+	b = strconv.AppendInt(b, r.Duration.Nanoseconds()/1000, 10)
+	b = append(b, '\t')
+	b = strconv.AppendInt(b, int64(r.Size), 10)
+	b = append(b, '\t')
+	b = append(b, r.Status.String()...)
+	b = append(b, '\n')
+	s.buf = b
+	if len(s.buf) > traceBufSize-512 {
+		s.Flush()
+	}
+}
+
+func (s *WorkerStat) Flush() {
+	if len(s.buf) == 0 {
+		return
+	}
+	s.out.mutex.Lock()
+	s.out.w.Write(s.buf)
+	s.out.mutex.Unlock()
+	s.buf = s.buf[:0]
+}
+
+func (s *WorkerStat) Merge(o *WorkerStat) {
+	for op := range s.Count {
+		for st := range s.Count[op] {
+			s.Count[op][st] += o.Count[op][st]
+		}
+		s.Latency[op].Merge(&o.Latency[op])
+	}
+	s.dropped += o.dropped
+}
+
+// DumpSummary write counters and latency percentiles, prefix is for
+// comment lines in stat file
+func (s *WorkerStat) DumpSummary(w io.Writer, prefix string, duration time.Duration) {
+	for op := Operation(0); op < OperationMax; op++ {
+		var total uint64
+		line := ""
+		for st := Status(0); st < StatusMax; st++ {
+			if n := s.Count[op][st]; n > 0 {
+				if line != "" {
+					line += ", "
+				}
+				line += fmt.Sprintf("%s %d", st, n)
+				total += n
+			}
+		}
+		if total == 0 {
+			continue
+		}
+		fmt.Fprintf(w, "%s%s: %s (%.0f per second)\n", prefix, op, line,
+			float64(total)/duration.Seconds())
+		if h := &s.Latency[op]; h.Total > 0 {
+			fmt.Fprintf(w, "%s%s latency (us): p50 %d, p90 %d, p99 %d, p99.9 %d, max %d\n",
+				prefix, op, h.Quantile(0.5), h.Quantile(0.9), h.Quantile(0.99),
+				h.Quantile(0.999), h.Max/time.Microsecond)
+		}
+	}
+	if s.dropped > 0 {
+		fmt.Fprintf(w, "%srecords over trace limit: %d\n", prefix, s.dropped)
+	}
+}
@@ -1,6 +1,8 @@
 package main
 
 import (
+	"bytes"
+	"fmt"
 	"io"
 	"log"
 	"math/rand"
@@ -30,18 +32,18 @@ const (
 	NetConEOF            // Connection closed
 	OtherError           // Unparsed error
 	Mismatch             // Result mismatch
-	Ended                // Set when worker go to shutdown
+	StatusMax
 )
 
 func (s Status) String() string {
-	return [...]string{"SUCCESS", "TIMEOUT", "REFUSED", "ERRLOOKUP", "EOF", "ERROTHER", "MISMATCH", "ENDED"}[s]
+	return [...]string{"SUCCESS", "TIMEOUT", "REFUSED", "ERRLOOKUP", "EOF", "ERROTHER", "MISMATCH"}[s]
 }
 
 func GetNetError(err error) Status {
 	if err == nil {
 		return NetSuccess
 	}
-	if err == io.EOF {
+	if err == io.EOF || err == io.ErrUnexpectedEOF {
 		return NetConEOF
 	}
 	netErr, ok := err.(net.Error)
@@ -69,12 +71,72 @@ const (
 	Recv               // Recv
 	SendRecv           // Send/Recv summary
 	Close              // Close
+	OperationMax
 )
 
 func (o Operation) String() string {
 	return [...]string{"CONNECT", "SEND", "RECV", "MSG", "CLOSE"}[o]
 }
 
+// Arrival is inter-arrival times distribution of open loop requests
+type Arrival int
+
+const (
+	Constant Arrival = iota
+	Poisson
+)
+
+func (a Arrival) String() string {
+	return [...]string{"const", "poisson"}[a]
+}
+
+func ParseArrival(s string) (Arrival, error) {
+	switch s {
+	case "const":
+		return Constant, nil
+	case "poisson":
+		return Poisson, nil
+	}
+	return Constant, fmt.Errorf("Invalid arrival value: %s", s)
+}
+
+// Schedule is open loop send times of worker. Request sent late (server
+// stall) keeps its scheduled time, so latency include waiting for send
+// (no coordinated omission), and next requests are sent without pause
+// until worker catch up the schedule.
+type Schedule struct {
+	arrival  Arrival
+	interval float64 // mean, ns
+	next     time.Time
+	rnd      *rand.Rand
+}
+
+func ScheduleNew(config Config, seed int64) *Schedule {
+	s := new(Schedule)
+	s.arrival = config.Arrival
+	s.interval = float64(time.Second) * float64(config.Workers) / config.Rate
+	s.rnd = rand.New(rand.NewSource(seed))
+	return s
+}
+
+func (s *Schedule) Start(t time.Time) {
+	s.next = t
+}
+
+// Wait for next scheduled time and return it
+func (s *Schedule) Wait() time.Time {
+	intended := s.next
+	if s.arrival == Poisson {
+		s.next = s.next.Add(time.Duration(s.rnd.ExpFloat64() * s.interval))
+	} else {
+		s.next = s.next.Add(time.Duration(s.interval))
+	}
+	if d := time.Until(intended); d > 0 {
+		time.Sleep(d)
+	}
+	return intended
+}
+
 type Result struct {
 	Id        int
 	Worker    int
@@ -104,16 +166,29 @@ func RandBytes(n int) []byte {
 	return b
 }
 
-func TcpWorker(id int, config Config, out chan<- Result) {
+// StampSeq write message number in hex at payload start (up to 16 digits,
+// last byte is reserved for newline), so stale or reordered echo is mismatch
+func StampSeq(b []byte, seq uint64) {
+	const hex = "0123456789abcdef"
+	n := len(b) - 1
+	if n > 16 {
+		n = 16
+	}
+	for i := n - 1; i >= 0; i-- {
+		b[i] = hex[seq&0xf]
+		seq >>= 4
+	}
+}
+
+func TcpWorker(id int, config Config, out *WorkerStat) {
 	r := ResultNew(id, Tcp)
 
-	defer func(ch chan<- Result) {
-		r.Status = Ended
-		ch <- *r
-	}(out)
+	defer out.Flush()
 
-	bytes := RandBytes(config.Size)
-	bytes[config.Size-1] = '\n'
+	payload := RandBytes(config.Size)
+	payload[config.Size-1] = '\n'
+	inbytes := make([]byte, len(payload))
+	var seq uint64
 	count := config.Connections / config.Workers
 	if config.Connections%config.Workers > 0 {
 		count++
@@ -124,14 +199,34 @@ func TcpWorker(id int, config Config, out chan<- Result) {
 		end = config.Connections
 	}
 	pos := start
+	var (
+		schedule  *Schedule
+		intended  time.Time
+		msgStart  time.Time
+		msgStatus Status
+		msgSize   int
+		sent      bool
+	)
+	if config.Rate > 0 {
+		schedule = ScheduleNew(config, time.Now().UnixNano()+int64(id))
+	}
 	b.Await()
 	if config.Verbose {
 		log.Printf("Started TCP worker %d\n", id)
 	}
+	if schedule != nil {
+		schedule.Start(time.Now())
+	}
 	for running {
 		if pos == end {
 			pos = start
 		}
+		if schedule != nil {
+			intended = schedule.Wait()
+			if !running {
+				break
+			}
+		}
 		r.Id = pos
 		if conns[pos].Connected && conns[pos].Count >= config.Send {
 			// sended messages per connection reached, close
@@ -144,7 +239,7 @@ func TcpWorker(id int, config Config, out chan<- Result) {
 			r.Duration = 0
 			conns[pos].Connected = false
 			conns[pos].Count = 0
-			out <- *r
+			out.Add(r)
 		}
 		if !conns[pos].Connected {
 			var err error
@@ -161,17 +256,25 @@ func TcpWorker(id int, config Config, out chan<- Result) {
 			if config.Verbose && r.Status == OtherError {
 				log.Print(err.Error())
 			}
-			out <- *r
+			out.Add(r)
 		}
+		msgStatus = r.Status
+		msgSize = 0
+		sent = false
 		if conns[pos].Connected {
+			seq++
+			StampSeq(payload, seq)
 			r.Operation = Send
 			r.Timestamp = time.Now()
+			msgStart = r.Timestamp
+			sent = true
 			conns[pos].Conn.SetDeadline(r.Timestamp.Add(config.Timeout))
-			n, err := conns[pos].Conn.Write(bytes)
+			n, err := conns[pos].Conn.Write(payload)
 			r.Duration = time.Since(r.Timestamp)
 			r.Size = n
 			r.Status = GetNetError(err)
-			out <- *r
+			out.Add(r)
+			msgStatus = r.Status
 			if err != nil {
 				conns[pos].Connected = false
 				conns[pos].Conn.Close()
@@ -180,24 +283,50 @@ func TcpWorker(id int, config Config, out chan<- Result) {
 				}
 			} else {
 				conns[pos].Count++
-				inbytes := make([]byte, len(bytes))
 				r.Operation = Recv
 				r.Timestamp = time.Now()
-				n, err := conns[pos].Conn.Read(inbytes)
+				// echo may come in several segments
+				n, err := io.ReadFull(conns[pos].Conn, inbytes)
 				r.Duration = time.Since(r.Timestamp)
 				r.Size = n
 				r.Status = GetNetError(err)
-				if err != nil {
+				if err == nil && !bytes.Equal(inbytes, payload) {
+					r.Status = Mismatch
+				}
+				if r.Status != NetSuccess {
+					// stream position is unknown after error or mismatch
 					conns[pos].Connected = false
 					conns[pos].Conn.Close()
 					if config.Verbose && r.Status == OtherError {
 						log.Print(err.Error())
+					} else if config.Verbose && r.Status == Mismatch {
+						log.Printf("Echo mismatch on connection %d: %q, sent %q\n",
+							pos, inbytes, payload)
 					}
 				}
-				out <- *r
+				out.Add(r)
+				msgStatus = r.Status
+				msgSize = n
 			}
 		}
-		time.Sleep(config.Delay)
+		if schedule != nil {
+			// open loop: request latency from scheduled send time,
+			// failed connect is failed request too
+			msgStart = intended
+			sent = true
+		}
+		if sent {
+			// round trip: send start to last echo byte
+			r.Operation = SendRecv
+			r.Timestamp = msgStart
+			r.Duration = time.Since(msgStart)
+			r.Size = msgSize
+			r.Status = msgStatus
+			out.Add(r)
+		}
+		if schedule == nil {
+			time.Sleep(config.Delay)
+		}
 		pos++
 	}
 	if config.Verbose {
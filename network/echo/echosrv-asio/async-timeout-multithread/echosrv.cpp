@@ -84,16 +84,23 @@ void Session::do_write(std::size_t length) {
 //######################################################
 // Server class
 
-Server::Server(boost::asio::io_context &io_context, short port)
-    : acceptor_(io_context, tcp::endpoint(tcp::v4(), port)) {
+Server::Server(boost::asio::io_context &io_context,
+               std::vector<boost::asio::io_context *> workers, short port)
+    : acceptor_(io_context, tcp::endpoint(tcp::v4(), port)),
+      workers_(std::move(workers)) {
 	do_accept();
 }
 
 void Server::do_accept() {
+	boost::asio::io_context &worker = *workers_[next_];
+	next_ = (next_ + 1) % workers_.size();
+	// socket is bound to worker, session is created in worker thread
 	acceptor_.async_accept(
-	    [this](boost::system::error_code ec, tcp::socket socket) {
+	    worker, [this, &worker](boost::system::error_code ec, tcp::socket socket) {
 		    if (!ec) {
-			    std::make_shared<Session>(std::move(socket))->start();
+			    boost::asio::post(worker, [s = std::move(socket)]() mutable {
+				    std::make_shared<Session>(std::move(s))->start();
+			    });
 		    }
 
 		    do_accept();
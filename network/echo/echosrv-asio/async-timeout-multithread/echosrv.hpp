@@ -8,6 +8,7 @@
 #include <iostream>
 #include <memory>
 #include <utility>
+#include <vector>
 
 using boost::asio::steady_timer;
 using boost::asio::ip::tcp;
@@ -32,14 +33,19 @@ class Session : public std::enable_shared_from_this<Session> {
 	steady_timer deadline_{socket_.get_executor().context()};
 };
 
+// Accept on io_context and hand sessions round-robin to workers, each run
+// by one thread, so session handlers and buffers stay on that thread
 class Server {
   public:
-	Server(boost::asio::io_context &io_context, short port);
+	Server(boost::asio::io_context &io_context,
+	       std::vector<boost::asio::io_context *> workers, short port);
 
   private:
 	void do_accept();
 
-	tcp::acceptor acceptor_;
+	tcp::acceptor                          acceptor_;
+	std::vector<boost::asio::io_context *> workers_;
+	std::size_t                            next_ = 0;
 };
 
 #endif /* _ECHOSRV_HPP_ */
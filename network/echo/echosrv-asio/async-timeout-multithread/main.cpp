@@ -2,13 +2,19 @@
 #include <boost/thread.hpp>
 
 #include <chrono>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <utility>
+#include <vector>
 
+#include <getopt.h>
 #include <signal.h>
 
+#include <srvcommon/affinity.h>
+
 #include <echosrv.hpp>
 
 int running = 1;
@@ -21,37 +27,87 @@ void handler(const boost::system::error_code &error, int signal_number) {
 	}
 }
 
+void usage(const char *name) {
+	std::cerr << "Usage: " << name << " [-t THREADS] [-a AFFINITY] [-r PRIORITY] <port>\n"
+	          << "\t-t threads (default hardware concurrency)\n"
+	          << "\t-a <none|compact|spread|CPU_LIST> pin threads (default none)\n"
+	          << "\t-r SCHED_FIFO threads priority (default 0 - disabled)\n";
+}
+
 int main(int argc, char *argv[]) {
+	struct affinity aff;
 	try {
-		if (argc != 2) {
-			std::cerr << "Usage: " << argv[0] << " <port>\n";
+		const char *affinity = nullptr;
+		int         rt_prio = 0;
+		int         cores_number = boost::thread::hardware_concurrency();
+		int         opt;
+		while ((opt = getopt(argc, argv, "ht:a:r:")) != -1) {
+			switch (opt) {
+			case 't':
+				cores_number = std::atoi(optarg);
+				break;
+			case 'a':
+				affinity = optarg;
+				break;
+			case 'r':
+				rt_prio = std::atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+			}
+		}
+		if (optind != argc - 1 || cores_number < 1 || rt_prio < 0) {
+			usage(argv[0]);
+			return 1;
+		}
+		if (affinity_init(&aff, affinity, rt_prio) == -1) {
+			std::cerr << "invalid affinity: " << (affinity ? affinity : "none") << "\n";
 			return 1;
 		}
 
-		boost::asio::io_context        io_context;
-		boost::asio::io_service::work *work;
-		boost::thread_group            threads;
+		using work_guard = boost::asio::executor_work_guard<
+		    boost::asio::io_context::executor_type>;
+
+		// one io_context per thread: session is served by one pinned thread
+		std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+		std::vector<boost::asio::io_context *>               workers;
+		std::vector<work_guard>                               works;
+		boost::thread_group                                   threads;
+		for (int i = 0; i < cores_number; ++i) {
+			contexts.emplace_back(new boost::asio::io_context(1));
+			workers.push_back(contexts.back().get());
+			works.push_back(boost::asio::make_work_guard(*contexts.back()));
+		}
 
 		// Wait for signals indicating time to shut down.
-		boost::asio::signal_set signals(io_context);
+		boost::asio::signal_set signals(*contexts[0]);
 		signals.add(SIGINT);
 		signals.add(SIGTERM);
 
 		signals.async_wait(handler);
 
-		Server s(io_context, std::atoi(argv[1]));
+		// accept in first thread
+		Server s(*contexts[0], workers, std::atoi(argv[optind]));
 
-		int cores_number = boost::thread::hardware_concurrency();
-		for (std::size_t i = 0; i < cores_number; ++i) {
-			threads.create_thread(
-			    boost::bind(&boost::asio::io_context::run, &io_context));
+		for (int i = 0; i < cores_number; ++i) {
+			boost::asio::io_context *io_context = contexts[i].get();
+			threads.create_thread([io_context, &aff, i]() {
+				// pin before run, so session allocations is node local
+				if (affinity_apply(&aff, i) == -1)
+					std::cerr << "thread " << i
+					          << " affinity: " << std::strerror(errno) << "\n";
+				io_context->run();
+			});
 		}
 
 		while (running) {
 			boost::this_thread::sleep(boost::posix_time::milliseconds(500));
 		}
-		io_context.stop();
+		for (auto &io_context : contexts)
+			io_context->stop();
 		threads.join_all();
+		affinity_destroy(&aff);
 	} catch (std::exception &e) {
 		std::cerr << "Exception: " << e.what() << "\n";
 	}
@@ -0,0 +1,47 @@
+#!/bin/sh
+
+# Compare accept serialization modes: run echobench-go against echosrv-wrk
+# for each mode with one message per connection, so accept dominates.
+# Client statistic saved in OUT_DIR/accept-MODE.txt (process with statplot),
+# server wakeups and accept queue wait dumped to syslog ("stat total").
+
+[ -z "$1" -o -z "$2" -o -z "$3" ] && {
+	echo "use: $0 echosrv-wrk echobench-go out_dir [server options]" >&2
+	echo "env: PORT (default 1234), DURATION (default 30s), WORKERS (default 100)," >&2
+	echo "     MODES (default 'none mutex exclusive reuseport')" >&2
+	exit 1
+}
+
+SRV="$1"
+BENCH="$2"
+OUT="$3"
+shift 3
+
+PORT=${PORT:-1234}
+DURATION=${DURATION:-30s}
+WORKERS=${WORKERS:-100}
+MODES=${MODES:-"none mutex exclusive reuseport"}
+
+mkdir -p "${OUT}" || exit 1
+
+for mode in ${MODES}; do
+	stat="${OUT}/accept-${mode}.txt"
+	[ -e "${stat}" ] && {
+		echo "${stat} already exists" >&2
+		exit 1
+	}
+	echo "accept mode ${mode}"
+	"${SRV}" -p ${PORT} -x ${mode} "$@" &
+	pid=$!
+	sleep 1
+	kill -0 ${pid} 2>/dev/null || {
+		echo "server start failed" >&2
+		exit 1
+	}
+	"${BENCH}" -port ${PORT} -workers ${WORKERS} -send 1 \
+		-duration ${DURATION} -stat "${stat}"
+	kill -USR1 ${pid}
+	sleep 1
+	kill ${pid}
+	wait ${pid}
+done
@@ -0,0 +1,51 @@
+#ifndef _ECHOSRV_H_
+#define _ECHOSRV_H_
+
+#include <sys/types.h>
+
+#include <srvcommon/acceptlock.h>
+#include <srvcommon/affinity.h>
+#include <srvcommon/scoreboard.h>
+#include <srvcommon/wrkstat.h>
+
+#define BUFSIZE 4096
+
+#define SESSION_TIMEOUT 60 /* idle session timeout (s) */
+
+#define MAX_WORKERS 256
+
+enum engine {
+    ENGINE_BLOCK = 0, /* one blocking session per worker */
+    ENGINE_EPOLL = 1  /* many non-blocking sessions per worker */
+};
+
+struct config {
+    char *ip;
+    int port;
+    long int max_connect; /* max connections per worker (epoll engine) */
+    unsigned int delay;
+    int workers;     /* start (and minimum) workers */
+    int max_workers; /* workers limit, equal to workers for fixed pool */
+    int min_spare;   /* minimum idle workers */
+    int max_spare;   /* maximum idle workers */
+    int engine;
+    int accept_mode; /* accept serialization (enum accept_mode) */
+    int cpu_steering; /* steer connections to worker, pinned on cpu */
+    struct affinity affinity; /* workers placement */
+};
+
+extern short running;
+extern short stopping; /* graceful stop requested (worker) */
+
+extern struct sb_slot *wslot; /* worker own scoreboard slot */
+extern struct wrkstat *wstat; /* worker own statistic slot */
+
+extern struct accept_lock *alock; /* accept mutex (mutex accept mode) */
+
+/* publish worker state, if graceful stop not requested */
+void worker_set_state(int state);
+
+/* epoll event loop, run in worker process */
+int worker_loop_epoll(int srv_fd, const struct config *conf);
+
+#endif /* _ECHOSRV_H_ */
@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <c_procs/logutils/syslogutils.h>
+#include <c_procs/netutils/netutils.h>
+
+#include <srvcommon/asynclog.h>
+
+#include <echosrv.h>
+
+#define MAX_EVENTS 256
+
+#define ACCEPT_LOCK_DELAY 50 /* accept lock retry interval (ms) */
+
+enum SESS_STATE {
+    SESS_WAIT = 0,   /* wait for next event */
+    SESS_QUIT = 1,   /* client send quit */
+    SESS_EOF = 2,    /* client close connection */
+    SESS_ERR = -1
+};
+
+struct ev_session {
+    int fd;
+    char ip[INET_ADDRSTRLEN];
+    u_short port;
+    time_t last; /* last activity time, for idle timeout */
+    uint64_t start; /* first unanswered byte read time (us), for latency */
+    struct ev_session *prev, *next; /* active list, sorted by last */
+    size_t rlen;       /* buffered incoming bytes */
+    size_t wpos, wlen; /* pending outgoing bytes */
+    int quit;          /* close after lines before quit are echoed */
+    char rbuf[BUFSIZE];
+    char wbuf[BUFSIZE];
+};
+
+/* sessions, ordered by last activity (head is oldest) */
+struct ev_list {
+    struct ev_session *head;
+    struct ev_session *tail;
+    long int count;
+};
+
+static void list_remove(struct ev_list *l, struct ev_session *s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        l->head = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+    else
+        l->tail = s->prev;
+    s->prev = s->next = NULL;
+}
+
+static void list_append(struct ev_list *l, struct ev_session *s) {
+    s->next = NULL;
+    s->prev = l->tail;
+    if (l->tail)
+        l->tail->next = s;
+    else
+        l->head = s;
+    l->tail = s;
+}
+
+static void session_touch(struct ev_list *l, struct ev_session *s, time_t now) {
+    s->last = now;
+    if (l->tail != s) {
+        list_remove(l, s);
+        list_append(l, s);
+    }
+}
+
+/* move complete lines from read buffer to write buffer */
+static int session_process(struct ev_session *s) {
+    while (s->rlen > 0) {
+        size_t len;
+        char *nl = memchr(s->rbuf, '\n', s->rlen);
+        if (nl) {
+            len = nl - s->rbuf + 1;
+            if ((len == 5 && memcmp(s->rbuf, "quit\n", 5) == 0) ||
+                (len == 6 && memcmp(s->rbuf, "quit\r\n", 6) == 0)) {
+                s->quit = 1;
+                s->rlen = 0; /* rest after quit is ignored */
+                break;
+            }
+        } else if (s->rlen == BUFSIZE) {
+            /* line is too long, echo buffer as is */
+            len = s->rlen;
+        } else {
+            break;
+        }
+        if (len > BUFSIZE - s->wlen)
+            break; /* flush write buffer before */
+        memcpy(s->wbuf + s->wlen, s->rbuf, len);
+        s->wlen += len;
+        s->rlen -= len;
+        if (s->rlen > 0)
+            memmove(s->rbuf, s->rbuf + len, s->rlen);
+    }
+    return SESS_WAIT;
+}
+
+/* edge-triggered io: run until recv or send return EAGAIN */
+static int session_io(struct ev_session *s) {
+    ssize_t n;
+    int status;
+    while (running) {
+        while (s->wpos < s->wlen) {
+            n = send(s->fd, s->wbuf + s->wpos, s->wlen - s->wpos, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return SESS_WAIT; /* wait for EPOLLOUT */
+                else if (errno == EINTR)
+                    continue;
+                return SESS_ERR;
+            }
+            s->wpos += n;
+            wrkstat_add(&wstat->bytes_out, n);
+        }
+        if (s->wlen > 0 && s->rlen == 0) {
+            /* all received data echoed */
+            wrkstat_latency(wstat, s->start);
+            s->start = 0;
+        }
+        s->wpos = s->wlen = 0;
+
+        status = session_process(s);
+        if (status != SESS_WAIT)
+            return status;
+        if (s->wlen > 0)
+            continue;
+        if (s->quit)
+            return SESS_QUIT; /* echo before quit is sent */
+
+        n = recv(s->fd, s->rbuf + s->rlen, BUFSIZE - s->rlen, 0);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return SESS_WAIT; /* wait for EPOLLIN */
+            else if (errno == EINTR)
+                continue;
+            return SESS_ERR;
+        } else if (n == 0) {
+            return SESS_EOF;
+        }
+        if (s->start == 0)
+            s->start = wrkstat_now_us();
+        s->rlen += n;
+        wrkstat_add(&wstat->bytes_in, n);
+    }
+    return SESS_EOF;
+}
+
+static void session_close(struct ev_list *l, struct ev_session *s, int status,
+                          int err) {
+    if (status == SESS_ERR) {
+        wrkstat_add(&wstat->errors, 1);
+        ALOG(LOG_ERR, "close client connection from %s:%d: %s", s->ip,
+             s->port, strerror(err));
+    } else if (status == SESS_WAIT) {
+        wrkstat_add(&wstat->timeouts, 1);
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d (timeout)",
+                     s->ip, s->port);
+    } else {
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d", s->ip,
+                     s->port);
+    }
+    /* close also remove fd from epoll set */
+    close(s->fd);
+    list_remove(l, s);
+    l->count--;
+    free(s);
+    atomic_store_explicit(&wslot->connections, l->count, memory_order_relaxed);
+}
+
+static struct ev_session *session_new(int sess_fd, SA_IN *client_addr,
+                                      time_t now) {
+    struct ev_session *s = malloc(sizeof(struct ev_session));
+    if (s == NULL)
+        return NULL;
+    s->fd = sess_fd;
+    s->port = client_addr->sin_port;
+    s->last = now;
+    s->prev = s->next = NULL;
+    s->rlen = s->wpos = s->wlen = 0;
+    s->start = 0;
+    s->quit = 0;
+
+    /* Format client IP address (numeric, so without getnameinfo overhead) */
+    if (inet_ntop(AF_INET, &client_addr->sin_addr, s->ip, INET_ADDRSTRLEN)) {
+        ALOG_SAMPLED(LOG_INFO, "connect from %s:%d", s->ip, s->port);
+    } else {
+        s->ip[0] = '\0';
+        ALOG(LOG_ERR, "invalid address for socket %d", sess_fd);
+    }
+    return s;
+}
+
+/* enable or disable listen socket polling, return new state */
+static int listen_poll(int ep_fd, int srv_fd, int enable, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = NULL; /* NULL is listen socket */
+    if (epoll_ctl(ep_fd, enable ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, srv_fd,
+                  &ev) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
+                         "epoll_ctl", srv_fd);
+        return !enable;
+    }
+    return enable;
+}
+
+/* accept pending connections, until queue empty, limit reached or error */
+static void accept_sessions(int ep_fd, int srv_fd, struct ev_list *l,
+                            const struct config *conf, time_t now) {
+    SA_IN client_addr;
+    socklen_t client_addr_len;
+    struct epoll_event ev;
+    int accepted = 0;
+    wrkstat_add(&wstat->wakeups, 1);
+    while (running && l->count < conf->max_connect) {
+        struct ev_session *s;
+        int sess_fd;
+        client_addr_len = sizeof(client_addr);
+        sess_fd = accept4(srv_fd, (SA *) &client_addr, &client_addr_len,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sess_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* other worker was faster */
+                if (accepted == 0)
+                    wrkstat_add(&wstat->wakeups_empty, 1);
+                return;
+            }
+            ALOG(LOG_ERR, "%s on socket %d: %s", "accept", srv_fd,
+                 strerror(errno));
+            /* EMFILE, ENFILE, ENOMEM: retry on next loop */
+            return;
+        }
+        accepted++;
+        wrkstat_accepted(wstat, sess_fd);
+        set_keepalive(sess_fd);
+
+        if ((s = session_new(sess_fd, &client_addr, now)) ==
+            NULL) {
+            _LOG_ERROR(root_logger, "%s", "alloc session");
+            close(sess_fd);
+            return;
+        }
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = s;
+        if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, sess_fd, &ev) == -1) {
+            _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
+                             "epoll_ctl", sess_fd);
+            close(sess_fd);
+            free(s);
+            continue;
+        }
+        list_append(l, s);
+        l->count++;
+        atomic_store_explicit(&wslot->connections, l->count,
+                              memory_order_relaxed);
+    }
+}
+
+int worker_loop_epoll(int srv_fd, const struct config *conf) {
+    int ec = 0;
+    int ep_fd;
+    int listen_on = 0;
+    int locked = 0;
+    uint32_t listen_events = EPOLLIN;
+    struct ev_list sessions = {NULL, NULL, 0};
+    struct epoll_event events[MAX_EVENTS];
+
+    if ((ep_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_create");
+        return -1;
+    }
+    /* listen socket shared with other workers, so accept is non-blocking */
+    set_nonblock(srv_fd);
+    if (conf->accept_mode == ACCEPT_EXCLUSIVE)
+        listen_events |= EPOLLEXCLUSIVE; /* wake up one of waiting workers */
+
+    /* on graceful stop serve already accepted sessions */
+    while (running && (!stopping || sessions.count > 0)) {
+        time_t now;
+        int n, timeout = 1000;
+        int accept_on = !stopping && sessions.count < conf->max_connect;
+        /* busy from half of max connections, so master start spare workers
+           before this one is full (idle state is not load for epoll) */
+        worker_set_state(accept_on && sessions.count < (conf->max_connect + 1) / 2
+                             ? SB_IDLE
+                             : SB_BUSY);
+        if (accept_on && alock) {
+            /* only lock holder poll listener, other retry after delay */
+            if (accept_lock_acquire(alock, 0) == 1) {
+                locked = 1;
+            } else {
+                accept_on = 0;
+                timeout = ACCEPT_LOCK_DELAY;
+            }
+        }
+        if (accept_on != listen_on) {
+            listen_on = listen_poll(ep_fd, srv_fd, accept_on, listen_events);
+            if (accept_on && !listen_on) {
+                ec = -1;
+                break;
+            }
+        }
+
+        n = epoll_wait(ep_fd, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno != EINTR) {
+                _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_wait");
+                ec = -1;
+                break;
+            }
+            n = 0;
+        }
+        now = time(NULL);
+        for (int i = 0; i < n; i++) {
+            struct ev_session *s = events[i].data.ptr;
+            if (s == NULL) {
+                accept_sessions(ep_fd, srv_fd, &sessions, conf, now);
+            } else {
+                int status;
+                if (events[i].events & EPOLLERR) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    session_close(&sessions, s, SESS_ERR, err);
+                    continue;
+                }
+                status = session_io(s);
+                if (status == SESS_WAIT)
+                    session_touch(&sessions, s, now);
+                else
+                    session_close(&sessions, s, status, errno);
+            }
+        }
+        if (locked) {
+            accept_lock_release(alock);
+            locked = 0;
+        }
+        /* close idle sessions */
+        while (sessions.head && now - sessions.head->last >= SESSION_TIMEOUT)
+            session_close(&sessions, sessions.head, SESS_WAIT, 0);
+    }
+
+    if (locked)
+        accept_lock_release(alock);
+    while (sessions.head)
+        session_close(&sessions, sessions.head, SESS_EOF, 0);
+    close(ep_fd);
+    return ec;
+}
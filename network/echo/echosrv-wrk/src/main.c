@@ -1,12 +1,20 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <linux/filter.h>
 #include <netdb.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -17,27 +25,32 @@
 #include <c_procs/netutils/netutils.h>
 #include <c_procs/strutils.h>
 
-struct config {
-    char *ip;
-    int port;
-    /* long int max_connect; */ /* max connections */
-    unsigned int delay;
-    int workers;
-};
+#include <srvcommon/affinity.h>
+#include <srvcommon/asynclog.h>
+
+#include <echosrv.h>
 
 const char *name = "echosrv";
 
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
 /* #define BACKLOG 20 */
 #define BACKLOG SOMAXCONN
 
-#define BUFSIZE 4096
-
 short running = 1;
+short stopping = 0;
 
-int workers = 0;     /* number of workers */
-int worker_died = 0; /* set to 1 in signal handler if worker died */
+int workers = 0; /* number of workers */
 
-pid_t *wpids = NULL;
+struct scoreboard *sb = NULL;
+struct sb_slot *wslot = NULL;
+
+struct wrkstat *stats = NULL; /* workers statistic, indexed by slot */
+struct wrkstat *wstat = NULL;
+
+struct accept_lock *alock = NULL;
 
 struct config conf;
 
@@ -47,7 +60,7 @@ int server_session(int sess_fd, const char *ip, const u_short port,
     ssize_t r, s;
     size_t rsize, wsize;
     struct timeval tv;
-    tv.tv_sec = 60;
+    tv.tv_sec = SESSION_TIMEOUT;
     tv.tv_usec = 0;
     set_keepalive(sess_fd);
 
@@ -56,172 +69,474 @@ int server_session(int sess_fd, const char *ip, const u_short port,
     errno = 0;
 
     while (running) {
+        uint64_t start;
         r = recv_try(sess_fd, buf, BUFSIZE - 1, MSG_NOSIGNAL, &rsize, &running, '\n');
         //_LOG_INFO(root_logger, "read %lu from %s:%d", rsize, ip, port);
         // if (r == -1)
         if (r < 1 || running == 0)
             break;
+        start = wrkstat_now_us();
+        wrkstat_add(&wstat->bytes_in, rsize);
         buf[r] = '\0';
         if (strcmp(buf, "quit\r\n") == 0 || strcmp(buf, "quit\n") == 0)
             break;
         s = send_try(sess_fd, buf, rsize, MSG_NOSIGNAL, &wsize, &running);
         //_LOG_INFO(root_logger, "write %d to %s:%d", wsize, ip, port);
+        wrkstat_add(&wstat->bytes_out, wsize);
         if (s < 1)
             break;
+        wrkstat_latency(wstat, start);
     }
 
     if (errno == EAGAIN) {
-        _LOG_INFO(root_logger, "close client connection from %s:%d (timeout)", ip, port);
+        wrkstat_add(&wstat->timeouts, 1);
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d (timeout)",
+                     ip, port);
     } else if (errno) {
-        _LOG_ERROR_ERRNO(root_logger, "close client connection from %s:%d: %s", errno, ip, port);
+        wrkstat_add(&wstat->errors, 1);
+        ALOG(LOG_ERR, "close client connection from %s:%d: %s", ip, port,
+             strerror(errno));
     } else {
-        _LOG_INFO(root_logger, "close client connection from %s:%d", ip, port);
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d", ip, port);
     }
     close(sess_fd);
 }
 
-pid_t loop_child(int srv_fd, const struct config *conf) {
-    pid_t pid = fork();
+void worker_set_state(int state) {
+    int cur = sb_get_state(wslot);
+    if (cur != SB_EXITING)
+        sb_cas_state(wslot, cur, state);
+}
+
+/*
+ * Wait for connection with configured accept serialization.
+ * Return -1 without connection (interrupted, timeout or lost race).
+ */
+int worker_accept(int srv_fd, int ep_fd, SA_IN *client_addr,
+                  socklen_t *client_addr_len) {
+    int sess_fd;
+    int locked = 0;
+    if (alock) {
+        /* wait with timeout, so graceful stop is not delayed by lock holder */
+        if ((locked = accept_lock_acquire(alock, 1000)) == -1)
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "accept lock");
+        if (locked < 1)
+            return -1;
+    } else if (ep_fd >= 0) {
+        struct epoll_event ev;
+        int n = epoll_wait(ep_fd, &ev, 1, 1000);
+        if (n == -1 && errno != EINTR)
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_wait");
+        if (n < 1)
+            return -1;
+    }
+    *client_addr_len = sizeof(*client_addr);
+    sess_fd = accept(srv_fd, (SA *) client_addr, client_addr_len);
+    if (locked)
+        accept_lock_release(alock);
+    if (sess_fd == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            wrkstat_add(&wstat->wakeups, 1);
+            wrkstat_add(&wstat->wakeups_empty, 1);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            ALOG(LOG_ERR, "%s on socket %d: %s", "accept", srv_fd,
+                 strerror(errno));
+        }
+        return -1;
+    }
+    wrkstat_add(&wstat->wakeups, 1);
+    wrkstat_accepted(wstat, sess_fd);
+    return sess_fd;
+}
+
+int worker_loop_block(int srv_fd, const struct config *conf) {
+    SA_IN client_addr;
+    socklen_t client_addr_len;
+    char ipbuf[INET_ADDRSTRLEN];
+    int ep_fd = -1;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+
+    if (conf->accept_mode == ACCEPT_EXCLUSIVE) {
+        /* wait in own epoll, kernel wake up one exclusive waiter */
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = srv_fd;
+        set_nonblock(srv_fd);
+        if ((ep_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+            epoll_ctl(ep_fd, EPOLL_CTL_ADD, srv_fd, &ev) == -1) {
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "accept epoll");
+            if (ep_fd >= 0)
+                close(ep_fd);
+            return -1;
+        }
+    }
+
+    worker_set_state(SB_IDLE);
+    while (running && !stopping) {
+        int sess_fd =
+            worker_accept(srv_fd, ep_fd, &client_addr, &client_addr_len);
+        if (sess_fd == -1)
+            continue;
+        if (running == 0)
+            break;
+        /* graceful stop is delayed until session end */
+        sigprocmask(SIG_BLOCK, &mask, NULL);
+        worker_set_state(SB_BUSY);
+        atomic_store_explicit(&wslot->connections, 1, memory_order_relaxed);
+
+        /* Format client IP address (numeric, so without getnameinfo) */
+        if (inet_ntop(AF_INET, &client_addr.sin_addr, ipbuf, INET_ADDRSTRLEN)) {
+            ALOG_SAMPLED(LOG_INFO, "connect from %s:%d", ipbuf,
+                         client_addr.sin_port);
+        } else {
+            ipbuf[0] = '\0';
+            ALOG(LOG_ERR, "invalid address for socket %d", sess_fd);
+        }
+
+        server_session(sess_fd, ipbuf, client_addr.sin_port, conf);
+
+        atomic_store_explicit(&wslot->connections, 0, memory_order_relaxed);
+        worker_set_state(SB_IDLE);
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    }
+    if (ep_fd >= 0)
+        close(ep_fd);
+    return 0;
+}
+
+pid_t loop_child(int *srv_fds, int idx, const struct config *conf) {
+    struct sb_slot *slot = &sb->slots[idx];
+    pid_t pid;
+    atomic_store_explicit(&slot->connections, 0, memory_order_relaxed);
+    sb_set_state(slot, SB_STARTING);
+    pid = fork();
     if (pid == 0) {
-        int ec = 0;
-        SA_IN client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
-        char ipbuf[INET_ADDRSTRLEN];
+        int ec;
+        int srv_fd = srv_fds[0];
+        sigset_t mask;
         workers = -1; /* set to -1 in worker */
-        while (running) {
-            int sess_fd = accept(srv_fd, (SA *) &client_addr, &client_addr_len);
-            if (sess_fd == -1) {
-                if (errno != EINTR)
-                    _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
-                                     "accept", srv_fd);
-                continue;
+        wslot = slot;
+        atomic_store_explicit(&wslot->pid, getpid(), memory_order_relaxed);
+        wstat = &stats[idx];
+        wrkstat_start(wstat, getpid());
+        alog_set_ring(idx + 1); /* ring 0 is master ring */
+        /* SIGCHLD blocked in master for signalfd */
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        if (conf->accept_mode == ACCEPT_REUSEPORT) {
+            /* use own listener, other listeners belongs to other workers */
+            srv_fd = srv_fds[idx];
+            for (int i = 0; i < conf->workers; i++) {
+                if (i != idx && srv_fds[i] >= 0)
+                    close(srv_fds[i]);
             }
-            if (running == 0)
-                break;
+        }
+        if (affinity_apply(&conf->affinity, idx) == -1)
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "worker affinity");
+        if (conf->engine == ENGINE_EPOLL)
+            ec = worker_loop_epoll(srv_fd, conf);
+        else
+            ec = worker_loop_block(srv_fd, conf);
+        exit(ec ? EXIT_FAILURE : 0);
+    } else if (pid < 0) {
+        sb_set_state(slot, SB_FREE);
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "fork worker");
+    } else {
+        atomic_store_explicit(&slot->pid, pid, memory_order_relaxed);
+    }
+    return pid;
+}
 
-            /* Format client IP address */
-            if (getnameinfo((SA *) &client_addr, client_addr_len, ipbuf,
-                            INET_ADDRSTRLEN, 0, 0, NI_NUMERICHOST) == 0) {
-                _LOG_INFO(root_logger, "connect from %s:%d", ipbuf,
-                          client_addr.sin_port);
-            } else {
-                _LOG_ERROR(root_logger, "invalid address for socket %d",
-                           sess_fd);
+/* reap died workers and free their scoreboard slots */
+void reap_workers() {
+    pid_t pid;
+    int wstatus;
+    while ((pid = waitpid((pid_t)(-1), &wstatus, WNOHANG)) > 0) {
+        int state = SB_FREE;
+        int i = scoreboard_find(sb, pid);
+        if (i >= 0) {
+            state = sb_get_state(&sb->slots[i]);
+            atomic_store_explicit(&sb->slots[i].pid, 0, memory_order_relaxed);
+            atomic_store_explicit(&sb->slots[i].connections, 0,
+                                  memory_order_relaxed);
+            sb_set_state(&sb->slots[i], SB_FREE);
+            workers--;
+        }
+        if (state == SB_EXITING && WIFEXITED(wstatus) &&
+            WEXITSTATUS(wstatus) == 0) {
+            _LOG_INFO(root_logger, "worker %d stopped", pid);
+        } else if (WIFEXITED(wstatus)) {
+            _LOG_ERROR(root_logger, "worker %d exited with status %d", pid,
+                       WEXITSTATUS(wstatus));
+        } else if (WIFSIGNALED(wstatus)) {
+            _LOG_ERROR(root_logger, "worker %d killed with signal '%s'", pid,
+                       strsignal(WTERMSIG(wstatus)));
+        }
+    }
+}
+
+/*
+ * Keep workers count between conf->workers and conf->max_workers and idle
+ * workers count between conf->min_spare and conf->max_spare (if possible).
+ */
+void pool_maintain(int *srv_fds, const struct config *conf) {
+    int total, idle, need;
+    scoreboard_count(sb, &total, &idle);
+
+    need = conf->workers - total;
+    if (need < conf->min_spare - idle)
+        need = conf->min_spare - idle;
+    if (need > sb->size - total)
+        need = sb->size - total;
+    if (need > 0) {
+        int started = 0;
+        for (int n = 0; n < need && running; n++) {
+            int i = scoreboard_find_free(sb);
+            if (i == -1 || loop_child(srv_fds, i, conf) < 0)
+                break;
+            workers++;
+            started++;
+        }
+        if (started > 0)
+            _LOG_INFO(root_logger, "%d workers started (%d idle of %d)",
+                      started, idle, total);
+        else
+            _LOG_ERROR(root_logger, "%s", "worker start failed");
+    } else if (idle > conf->max_spare && total > conf->workers) {
+        /* stop one idle worker without connections per call */
+        for (int i = 0; i < sb->size; i++) {
+            struct sb_slot *slot = &sb->slots[i];
+            if (atomic_load_explicit(&slot->connections,
+                                     memory_order_relaxed) == 0 &&
+                sb_cas_state(slot, SB_IDLE, SB_EXITING)) {
+                kill(atomic_load_explicit(&slot->pid, memory_order_relaxed),
+                     SIGUSR2);
+                _LOG_INFO(root_logger, "stop spare worker (%d idle of %d)",
+                          idle, total);
+                break;
             }
-            /*
-            if (connected >= conf->max_connect) {
-                const char *buf = "Too many connections\n";
-                send(sess_fd, buf, strlen(buf), MSG_NOSIGNAL);
-                close(sess_fd);
-                _LOG_ERROR(root_logger, "%s", "too many connections");
+        }
+    }
+}
+
+int master_loop(int sig_fd, int *srv_fds, const struct config *conf) {
+    struct pollfd pfd;
+    pfd.fd = sig_fd;
+    pfd.events = POLLIN;
+    while (running) {
+        int n = poll(&pfd, 1, 1000);
+        if (n == -1) {
+            if (errno == EINTR)
                 continue;
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "poll");
+            return -1;
+        }
+        if (n > 0) {
+            struct signalfd_siginfo si[16];
+            ssize_t len;
+            int chld = 0;
+            while ((len = read(sig_fd, si, sizeof(si))) > 0) {
+                for (size_t i = 0; i < len / sizeof(si[0]); i++) {
+                    if (si[i].ssi_signo == SIGCHLD)
+                        chld = 1;
+                    else if (si[i].ssi_signo == SIGUSR1)
+                        wrkstat_dump(stats, conf->max_workers);
+                }
             }
-            */
-
-            server_session(sess_fd, ipbuf, client_addr.sin_port, conf);
+            /* pending SIGCHLD are merged, so reap all */
+            if (chld)
+                reap_workers();
         }
-        exit(0);
-    } else if (pid < 0) {
-        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "fork worker");
+        if (running)
+            pool_maintain(srv_fds, conf);
     }
-    return pid;
+    return 0;
 }
 
-int start_server(const struct config *conf) {
+/*
+ * Steer connection to listener of worker, pinned on receiving cpu. Listeners
+ * are added to reuseport group in worker index order, so index in group is
+ * worker index. Connections from cpu without worker steered to (cpu % n).
+ */
+int attach_cpu_steering(int srv_fd, int n, const struct affinity *aff) {
     int ec = 0;
-    int srv_fd; /* server socket */
-    SA_IN srv_addr;
-    int reuse = 1;
-    int status;
-    pid_t wpid;
-
-    wpids = (pid_t *) calloc(sizeof(pid_t), conf->workers);
-    if (wpids == NULL) {
-        _LOG_ERROR(root_logger, "%s", "alloc workers");
+    int len = 0;
+    struct sock_fprog prog;
+    struct sock_filter *code = malloc(sizeof(struct sock_filter) * (2 * n + 3));
+    if (code == NULL) {
+        _LOG_ERROR(root_logger, "%s", "alloc cbpf");
         return -1;
     }
+    /* A = raw_smp_processor_id() */
+    code[len++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                                SKF_AD_OFF + SKF_AD_CPU);
+    for (int i = 0; i < n; i++) {
+        /* if (A == cpu(i)) return i */
+        code[len++] = (struct sock_filter) BPF_JUMP(
+            BPF_JMP | BPF_JEQ | BPF_K, affinity_cpu(aff, i), 0, 1);
+        code[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    /* return A % n */
+    code[len++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n);
+    code[len++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+    prog.len = len;
+    prog.filter = code;
+    if (setsockopt(srv_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                   sizeof(prog)) == -1) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno,
+                         "attach reuseport cbpf");
+        ec = -1;
+    }
+    free(code);
+    return ec;
+}
+
+int listen_socket(const struct config *conf) {
+    int srv_fd; /* server socket */
+    SA_IN srv_addr;
 
     if ((srv_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
-        ec = -1;
         _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "socket");
-        goto EXIT;
+        return -1;
     }
     set_reuseaddr(srv_fd);
+    if (conf->accept_mode == ACCEPT_REUSEPORT) {
+        int reuse = 1;
+        if (setsockopt(srv_fd, SOL_SOCKET, SO_REUSEPORT, &reuse,
+                       sizeof(reuse)) == -1) {
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "SO_REUSEPORT");
+            goto ERROR;
+        }
+    }
 
     srv_addr.sin_family = AF_INET;
     srv_addr.sin_port = htons(conf->port);
     if (conf->ip == NULL)
         srv_addr.sin_addr.s_addr = htonl(INADDR_ANY); /* List on any IP */
     else if (inet_aton(conf->ip, &srv_addr.sin_addr) == 0) {
-        ec = -1;
         _LOG_ERROR(root_logger, "invalid address: %s", conf->ip);
-        goto EXIT;
+        goto ERROR;
     }
 
     if (bind(srv_fd, (SA *) &srv_addr, sizeof(srv_addr)) == -1) {
-        ec = -1;
         _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "bind");
-        goto EXIT;
+        goto ERROR;
     }
 
     /* set_nonblock(srv_fd); */
 
     if (listen(srv_fd, BACKLOG) == -1) {
-        ec = -1;
         _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "listen");
-        goto EXIT;
+        goto ERROR;
     }
+    return srv_fd;
+ERROR:
+    close(srv_fd);
+    return -1;
+}
 
-    _LOG_NOTICE(root_logger, "%s", "startup");
+int start_server(const struct config *conf) {
+    int ec = 0;
+    int *srv_fds; /* server sockets, one per worker in reuseport mode */
+    int listeners;
+    int status;
+    int sig_fd = -1;
+    sigset_t mask;
 
-    /* run workers */
-    if (workers < conf->workers) {
-        for (int i = 0; i < conf->workers; i++) {
-            wpids[i] = loop_child(srv_fd, conf);
-            if (wpids[i] < 0) {
-                ec = -1;
-                running = 0;
-                break;
-            }
-            workers++;
+    listeners = conf->accept_mode == ACCEPT_REUSEPORT ? conf->workers : 1;
+
+    sb = scoreboard_new(conf->max_workers);
+    stats = wrkstat_new(conf->max_workers);
+    srv_fds = (int *) malloc(sizeof(int) * conf->max_workers);
+    if (sb == NULL || stats == NULL || srv_fds == NULL) {
+        _LOG_ERROR(root_logger, "%s", "alloc workers");
+        scoreboard_free(sb);
+        wrkstat_free(stats, conf->max_workers);
+        free(srv_fds);
+        return -1;
+    }
+    for (int i = 0; i < conf->max_workers; i++)
+        srv_fds[i] = -1;
+    if (conf->accept_mode == ACCEPT_MUTEX &&
+        (alock = accept_lock_new()) == NULL) {
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "accept lock");
+        ec = -1;
+        goto EXIT;
+    }
+
+    /* listeners created before workers, so reuseport group order is fixed */
+    for (int i = 0; i < listeners; i++) {
+        if ((srv_fds[i] = listen_socket(conf)) == -1) {
+            ec = -1;
+            goto EXIT;
         }
     }
+    if (conf->cpu_steering && attach_cpu_steering(srv_fds[0], listeners,
+                                                   &conf->affinity)) {
+        ec = -1;
+        goto EXIT;
+    }
 
-    /* respawn died workers */
-    while (running) {
-        if (worker_died) {
-            if (running) {
-                _LOG_WARN(root_logger, "%s", "worker died");
-            }
-            worker_died = 0;
-            for (int i = 0; i < conf->workers; i++) {
-                if (wpids[i] <= 0) {
-                    if (running == 0) {
-                        break;
-                    }
-                    wpids[i] = loop_child(srv_fd, conf);
-                    if (wpids[i] < 0) {
-                        ec = -1;
-                        workers--;
-                        _LOG_INFO(root_logger, "%s", "worker start faled");
-                        if (workers <= 0)
-                            break;
-                    } else {
-                        _LOG_INFO(root_logger, "%s", "worker started");
-                        workers++;
-                    }
-                }
-            }
-        } else {
-            sleep(1);
+    /*
+     * died workers are reaped and respawned from signalfd events,
+     * SIGUSR1 dump workers statistic
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1 ||
+        (sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "signalfd");
+        goto EXIT;
+    }
+
+    _LOG_NOTICE(root_logger, "startup (accept %s)",
+                accept_mode_name(conf->accept_mode));
+
+    /* flusher thread started before fork, so serve all workers rings */
+    if (alog_start() == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "start async log");
+        goto EXIT;
+    }
+
+    /* run workers */
+    for (int i = 0; i < conf->workers; i++) {
+        if (loop_child(srv_fds, i, conf) < 0) {
+            ec = -1;
+            running = 0;
+            break;
         }
+        workers++;
     }
+
+    if (running && master_loop(sig_fd, srv_fds, conf))
+        ec = -1;
+
 EXIT:
+    running = 0;
     while (wait(&status) > 0) {
     }
-    if (srv_fd)
-        close(srv_fd);
-    free(wpids);
+    alog_stop();
+    if (sig_fd >= 0)
+        close(sig_fd);
+    for (int i = 0; i < listeners; i++) {
+        if (srv_fds[i] >= 0)
+            close(srv_fds[i]);
+    }
+    free(srv_fds);
+    accept_lock_free(alock);
+    alock = NULL;
+    if (ec == 0)
+        wrkstat_dump(stats, conf->max_workers);
+    wrkstat_free(stats, conf->max_workers);
+    stats = NULL;
+    scoreboard_free(sb);
+    sb = NULL;
     if (ec) {
         _LOG_NOTICE(root_logger, "%s", "shutdown with error");
     } else {
@@ -234,9 +549,11 @@ void app_shutdown() {
     running = 0;
     if (workers >= 0) {
         _LOG_NOTICE(root_logger, "%s", "shutdown initiate");
-        for (int i = 0; i < conf.workers; i++) {
-            if (wpids[i] > 0) {
-                kill(wpids[i], SIGTERM);
+        for (int i = 0; sb && i < sb->size; i++) {
+            pid_t pid =
+                atomic_load_explicit(&sb->slots[i].pid, memory_order_relaxed);
+            if (pid > 0) {
+                kill(pid, SIGTERM);
             }
         }
     } else {
@@ -246,29 +563,6 @@ void app_shutdown() {
     }
 }
 
-void handle_sigchld() {
-    pid_t pid;
-    int wstatus;
-    while ((pid = waitpid((pid_t)(-1), &wstatus, WNOHANG)) > 0) {
-        if (pid > 0) {
-            for (int i = 0; i < conf.workers; i++) {
-                if (wpids[i] == pid) {
-                    wpids[i] = 0;
-                }
-            }
-            worker_died = 1;
-            if (WIFEXITED(wstatus)) {
-                _LOG_ERROR(root_logger, "worker exited with status %d",
-                           WEXITSTATUS(wstatus));
-            } else if (WIFSIGNALED(wstatus)) {
-                _LOG_ERROR(root_logger, "worker killed with signal '%s'",
-                           strsignal(WTERMSIG(wstatus)));
-            }
-        }
-    }
-    workers--;
-}
-
 void sig_handler(int sig) {
     int saved_errno = errno;
     switch (sig) {
@@ -282,9 +576,10 @@ void sig_handler(int sig) {
     case SIGTERM:
         app_shutdown();
         break;
-    case SIGCHLD:
-        /* _LOG_INFO(root_logger, "%s", "received SIGCHLD signal"); */
-        handle_sigchld();
+    case SIGUSR2:
+        /* graceful worker stop */
+        if (workers < 0)
+            stopping = 1;
         break;
     }
     errno = saved_errno;
@@ -335,20 +630,14 @@ int sig_handlers_init() {
         ec = 1;
     }
 
-    /* SIGCHLD for cleanup zombie child processes */
-    if (sigaction(SIGCHLD, &sa, NULL) == -1) {
-        perror("Cannot handle SIGCHLD");
+    /* SIGUSR2 must interrupt blocked accept, so without SA_RESTART */
+    sa.sa_flags = 0;
+    if (sigaction(SIGUSR2, &sa, NULL) == -1) {
+        perror("Error: cannot handle SIGUSR2");
         ec = 1;
     }
 
-    /* Ignore SIGICHLD for auto-cleanup zombie child processes, if don't need
-     * custom handler */
-    /*
-    if (sigaction(SIGCHLD, &(struct sigaction){SIG_IGN}, NULL) == -1) {
-        perror("Error: cannot handle SIGCHLD");
-        ec = 1;
-    }
-    */
+    /* SIGCHLD is handled with signalfd in master loop */
 
     return ec;
 }
@@ -359,7 +648,25 @@ void usage(const char *name) {
             "\t-a | --address <LISTEN_ADDRESS> (default all)\n"
             "\t-p | --port <LISTEN_PORT> (default 1234)\n"
             "\t-d | --delay <DELAY> (default 0)\n"
-            "\t-w | --workers <WORKERS> (default 2)\n");
+            "\t-w | --workers <WORKERS> start and minimum workers (default 2)\n"
+            "\t-W | --max-workers <WORKERS> (default equal to workers)\n"
+            "\t-s | --min-spare <WORKERS> minimum idle workers (default 1)\n"
+            "\t-S | --max-spare <WORKERS> maximum idle workers (default 4)\n"
+            "\t     (epoll worker is idle below half of max connections)\n"
+            "\t-e | --engine <block|epoll> worker engine (default epoll)\n"
+            "\t-m | --max <MAX_CONNECTIONS> per worker, epoll engine (default 1024)\n"
+            "\t-x | --accept <none|mutex|exclusive|reuseport> accept\n"
+            "\t     serialization (default none)\n"
+            "\t-r | --reuseport Own SO_REUSEPORT listener in each worker\n"
+            "\t     (alias for --accept reuseport)\n"
+            "\t-c | --cpu-steering Steer connections to worker, pinned on\n"
+            "\t     receiving cpu (implies --reuseport, default affinity compact)\n"
+            "\t-A | --affinity <none|compact|spread|CPU_LIST> pin workers\n"
+            "\t     (default none), CPU_LIST like 0,2,4-7\n"
+            "\t-R | --sched-rt <PRIORITY> SCHED_FIFO workers priority (default 0 - disabled)\n"
+            "\t-L | --log <syslog|stderr|FILE> connections log (default syslog)\n"
+            "\t-l | --log-level <err|warning|notice|info|debug> (default info)\n"
+            "\t-N | --log-sample <N> log one of N connections events (default 1)\n");
     exit(1);
 }
 
@@ -370,13 +677,24 @@ int main(int argc, char *const argv[]) {
     conf.ip = NULL;
     conf.port = 1234;
     conf.workers = 2;
-    /* conf.max_connect = INT_MAX; */
+    conf.max_workers = 0;
+    conf.min_spare = 1;
+    conf.max_spare = 4;
+    conf.max_connect = 1024;
     conf.delay = 0;
+    conf.engine = ENGINE_EPOLL;
+    conf.accept_mode = ACCEPT_NONE;
+    conf.cpu_steering = 0;
+    const char *affinity = NULL;
+    int rt_prio = 0;
+    const char *log_output = NULL;
+    int log_level = LOG_INFO;
+    int log_sample = 1;
 
     int opt = 0;
     int opt_idx = 0;
 
-    const char *opts = "hba:p:w:d:";
+    const char *opts = "hba:p:w:W:s:S:d:e:m:x:rcA:R:L:l:N:";
     const struct option long_opts[] = {
         /* Use flags like so:
         {"verbose",	no_argument,	&verbose_flag, 'V'}*/
@@ -387,6 +705,19 @@ int main(int argc, char *const argv[]) {
         {"port", optional_argument, 0, 'p'},
         {"delay", required_argument, 0, 'd'},
         {"workers", required_argument, 0, 'w'},
+        {"max-workers", required_argument, 0, 'W'},
+        {"min-spare", required_argument, 0, 's'},
+        {"max-spare", required_argument, 0, 'S'},
+        {"engine", required_argument, 0, 'e'},
+        {"max", required_argument, 0, 'm'},
+        {"accept", required_argument, 0, 'x'},
+        {"reuseport", no_argument, 0, 'r'},
+        {"cpu-steering", no_argument, 0, 'c'},
+        {"affinity", required_argument, 0, 'A'},
+        {"sched-rt", required_argument, 0, 'R'},
+        {"log", required_argument, 0, 'L'},
+        {"log-level", required_argument, 0, 'l'},
+        {"log-sample", required_argument, 0, 'N'},
         {0, 0, 0, 0}};
 
     while ((opt = getopt_long(argc, argv, opts, long_opts, &opt_idx)) != -1) {
@@ -421,12 +752,93 @@ int main(int argc, char *const argv[]) {
         case 'w': {
             char *endptr;
             conf.workers = atoi(optarg);
-            if (conf.workers <= 0 || conf.workers > 8) {
+            if (conf.workers <= 0 || conf.workers > MAX_WORKERS) {
                 fprintf(stderr, "invalid workers: %s\n", optarg);
                 return EXIT_FAILURE;
             }
             break;
         }
+        case 'W':
+            conf.max_workers = atoi(optarg);
+            if (conf.max_workers <= 0 || conf.max_workers > MAX_WORKERS) {
+                fprintf(stderr, "invalid max workers: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            conf.min_spare = atoi(optarg);
+            if (conf.min_spare < 0 || conf.min_spare > MAX_WORKERS) {
+                fprintf(stderr, "invalid min spare: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            conf.max_spare = atoi(optarg);
+            if (conf.max_spare <= 0 || conf.max_spare > MAX_WORKERS) {
+                fprintf(stderr, "invalid max spare: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "epoll") == 0) {
+                conf.engine = ENGINE_EPOLL;
+            } else if (strcmp(optarg, "block") == 0) {
+                conf.engine = ENGINE_BLOCK;
+            } else {
+                fprintf(stderr, "invalid engine: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'm': {
+            char *endptr;
+            long int n = str2l(optarg, &endptr, 10);
+            if (errno || n <= 0 || n > INT_MAX) {
+                fprintf(stderr, "invalid max_connect: %s\n", optarg);
+                return EXIT_FAILURE;
+            } else {
+                conf.max_connect = n;
+            }
+            break;
+        }
+        case 'x':
+            if ((conf.accept_mode = accept_mode_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid accept mode: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            conf.accept_mode = ACCEPT_REUSEPORT;
+            break;
+        case 'c':
+            conf.accept_mode = ACCEPT_REUSEPORT;
+            conf.cpu_steering = 1;
+            break;
+        case 'A':
+            affinity = optarg;
+            break;
+        case 'R':
+            rt_prio = atoi(optarg);
+            if (rt_prio <= 0) {
+                fprintf(stderr, "invalid realtime priority: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            log_output = optarg;
+            break;
+        case 'l':
+            if ((log_level = alog_level_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid log level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            log_sample = atoi(optarg);
+            if (log_sample <= 0) {
+                fprintf(stderr, "invalid log sample: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 0: /* binded option, set by getopt */
             break;
         case '?':
@@ -445,6 +857,48 @@ int main(int argc, char *const argv[]) {
         return EXIT_FAILURE;
     }
 
+    if (conf.max_workers == 0) {
+        conf.max_workers = conf.workers;
+    } else if (conf.max_workers < conf.workers) {
+        fprintf(stderr, "max workers must be equal workers or greater\n");
+        return EXIT_FAILURE;
+    }
+    if (conf.max_spare < conf.min_spare) {
+        fprintf(stderr, "max spare must be equal min spare or greater\n");
+        return EXIT_FAILURE;
+    }
+    if (conf.max_workers > conf.workers &&
+        conf.accept_mode == ACCEPT_REUSEPORT) {
+        /* listener without worker in reuseport group lost connections */
+        fprintf(stderr, "dynamic workers pool require shared listener\n");
+        return EXIT_FAILURE;
+    }
+
+    if (conf.cpu_steering && conf.accept_mode != ACCEPT_REUSEPORT) {
+        fprintf(stderr, "cpu steering require reuseport accept mode\n");
+        return EXIT_FAILURE;
+    }
+
+    if (conf.cpu_steering && affinity == NULL)
+        affinity = "compact";
+    if (affinity_init(&conf.affinity, affinity, rt_prio) == -1) {
+        fprintf(stderr, "invalid affinity: %s\n",
+                affinity ? affinity : "none");
+        return EXIT_FAILURE;
+    }
+    if (conf.cpu_steering && conf.affinity.policy == AFFINITY_NONE) {
+        fprintf(stderr, "cpu steering require workers affinity\n");
+        return EXIT_FAILURE;
+    }
+
+    /* one ring per worker and one for master */
+    if (alog_init(name, log_output, LOG_LOCAL0, log_level,
+                  conf.max_workers + 1, log_sample) == -1) {
+        fprintf(stderr, "init log %s: %s\n", log_output ? log_output : "syslog",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
     if (sig_handlers_init()) {
         ec = 1;
         goto EXIT;
@@ -0,0 +1,11 @@
+#ifndef _ECHOSRV_SESSION_H_
+#define _ECHOSRV_SESSION_H_
+
+#include <sys/types.h>
+
+extern short running;
+
+/* serve client connection, used by forked child and session executable */
+void server_session(int sess_fd, const char *ip, const u_short port);
+
+#endif /* _ECHOSRV_SESSION_H_ */
@@ -0,0 +1,45 @@
+#ifndef _ECHOSRV_STANDBY_H_
+#define _ECHOSRV_STANDBY_H_
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+
+/*
+ * Pool of idle pre-forked session processes. Master pass accepted client
+ * socket to one of them over unix socketpair (SCM_RIGHTS), so fork is out
+ * of accept-to-first-byte path. Every process serve one connection and exit,
+ * master replenish pool, while no pending connections.
+ */
+
+struct standby_sess {
+    int fd;
+    char ip[INET_ADDRSTRLEN];
+    u_short port;
+};
+
+/* allocate pool of SIZE processes, return -1 on error */
+int standby_init(int size);
+
+/* pool is not full (died idle processes are dropped) */
+int standby_need();
+
+/* close pool sockets (forked child, shutdown) */
+void standby_close();
+
+/*
+ * Fork idle process into pool. Return pid in master, -1 on error (errno is
+ * set). Child return 0 with received connection in SESS (exit, if master is
+ * gone).
+ */
+pid_t standby_fork(int srv_fd, struct standby_sess *sess);
+
+/*
+ * Pass client socket to idle process. Return it's pid or -1, if pool is
+ * empty.
+ */
+pid_t standby_handoff(int sess_fd, const char *ip, u_short port);
+
+/* forget reaped process, return 1 if it was idle */
+int standby_reap(pid_t pid);
+
+#endif /* _ECHOSRV_STANDBY_H_ */
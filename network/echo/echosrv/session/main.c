@@ -0,0 +1,46 @@
+/*
+ * echosrv-session: serve one client connection (passed as stdin/stdout),
+ * started by echosrv in vfork or spawn mode.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "session.h"
+
+short running = 1;
+
+void sig_handler(int sig) {
+    (void) sig;
+    running = 0;
+}
+
+int main(int argc, char *const argv[]) {
+    struct sigaction sa;
+    int port;
+
+    if (argc != 3) {
+        fprintf(stderr, "use: %s IP PORT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    port = atoi(argv[2]);
+
+    sigaction(SIGPIPE, &(struct sigaction){SIG_IGN}, NULL);
+    /* no SA_RESTART, interrupt session on shutdown */
+    sa.sa_handler = &sig_handler;
+    sa.sa_flags = 0;
+    sigfillset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    /* server rings, synchronous syslog without them */
+    if (alog_attach(ALOG_SHM_FD) == -1)
+        openlog("echosrv", LOG_CONS | LOG_PID | LOG_NDELAY, LOG_LOCAL0);
+
+    server_session(STDIN_FILENO, argv[1], port);
+    return 0;
+}
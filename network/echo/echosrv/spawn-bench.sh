@@ -0,0 +1,51 @@
+#!/bin/sh
+
+# Compare session spawn modes: run echobench-go against echosrv for each mode
+# with one message per connection, so process creation dominates.
+# Mode standby is fork with pool of pre-forked session processes.
+# Client statistic saved in OUT_DIR/spawn-MODE.txt (process with statplot).
+
+[ -z "$1" -o -z "$2" -o -z "$3" ] && {
+	echo "use: $0 echosrv echobench-go out_dir [server options]" >&2
+	echo "env: PORT (default 1234), DURATION (default 30s), WORKERS (default 100)," >&2
+	echo "     MODES (default 'fork vfork spawn standby'), STANDBY (default 16)" >&2
+	exit 1
+}
+
+SRV="$1"
+BENCH="$2"
+OUT="$3"
+shift 3
+
+PORT=${PORT:-1234}
+DURATION=${DURATION:-30s}
+WORKERS=${WORKERS:-100}
+MODES=${MODES:-"fork vfork spawn standby"}
+STANDBY=${STANDBY:-16}
+
+mkdir -p "${OUT}" || exit 1
+
+for mode in ${MODES}; do
+	stat="${OUT}/spawn-${mode}.txt"
+	[ -e "${stat}" ] && {
+		echo "${stat} already exists" >&2
+		exit 1
+	}
+	echo "spawn mode ${mode}"
+	if [ "${mode}" = "standby" ]; then
+		mopts="-P ${STANDBY}"
+	else
+		mopts="-s ${mode}"
+	fi
+	"${SRV}" -p ${PORT} ${mopts} "$@" &
+	pid=$!
+	sleep 1
+	kill -0 ${pid} 2>/dev/null || {
+		echo "server start failed" >&2
+		exit 1
+	}
+	"${BENCH}" -port ${PORT} -workers ${WORKERS} -send 1 \
+		-duration ${DURATION} -stat "${stat}"
+	kill ${pid}
+	wait ${pid}
+done
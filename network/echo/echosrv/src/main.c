@@ -4,9 +4,13 @@
 #include <limits.h>
 #include <netdb.h>
 #include <signal.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -17,115 +21,214 @@
 #include <c_procs/netutils/netutils.h>
 #include <c_procs/strutils.h>
 
+#include <srvcommon/asynclog.h>
+#include <srvcommon/spawn.h>
+
+#include "session.h"
+#include "standby.h"
+
 /* #define BACKLOG 20 */
 #define BACKLOG SOMAXCONN
 
+#define ALOG_RINGS 8
+
 #define BUFSIZE 4096
 
 short running = 1;
 
 unsigned long int connected = 0; /* number of connections */
-int worker = 0;                  /* set to 1 in worker process */
 
 struct config {
     char *ip;
     int port;
     long int max_connect; /* max connections */
     unsigned int delay;
+    int spawn;                /* session spawn mode */
+    const char *session_exec; /* session executable (vfork, spawn modes) */
+    int standby;              /* idle pre-forked session processes */
+    int shutdown_timeout;     /* wait for sessions on shutdown (s) */
 };
 
-int server_session(int sess_fd, const char *ip, const u_short port,
-                   const struct config *conf) {
-    char buf[BUFSIZE];
-    ssize_t r, s;
-    size_t rsize, wsize;
-    struct timeval tv;
-    tv.tv_sec = 60;
-    tv.tv_usec = 0;
-    set_keepalive(sess_fd);
-
-    set_send_timeout(sess_fd, &tv);
-    set_recv_timeout(sess_fd, &tv);
-    errno = 0;
-
-    while (running) {
-        r = recv_try(sess_fd, buf, BUFSIZE - 1, MSG_NOSIGNAL, &rsize, &running, '\n');
-        //_LOG_INFO(root_logger, "read %lu from %s:%d", rsize, ip, port);
-        // if (r == -1)
-        if (r < 1 || running == 0)
-            break;
-        buf[r] = '\0';
-        if (strcmp(buf, "quit\r\n") == 0 || strcmp(buf, "quit\n") == 0)
-            break;
-        s = send_try(sess_fd, buf, rsize, MSG_NOSIGNAL, &wsize, &running);
-        //_LOG_INFO(root_logger, "write %d to %s:%d", wsize, ip, port);
-        if (s < 1)
-            break;
+static int accept_pending(int srv_fd) {
+    struct pollfd pfd = {.fd = srv_fd, .events = POLLIN};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* forked session process: signals go to handler, not to master signalfd */
+static void session_init(int srv_fd, int sig_fd) {
+    sigset_t none;
+    if (srv_fd != -1)
+        close(srv_fd);
+    close(sig_fd);
+    standby_close();
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+}
+
+static void accept_session(int srv_fd, int sig_fd, const struct config *conf) {
+    SA_IN client_addr;
+    socklen_t client_addr_len = sizeof(client_addr);
+    char ipbuf[INET_ADDRSTRLEN];
+    int sess_fd = accept(srv_fd, (SA *)&client_addr, &client_addr_len);
+    if (sess_fd == -1) {
+        if (errno != EINTR)
+            ALOG(LOG_ERR, "%s on socket %d: %s", "accept", srv_fd,
+                 strerror(errno));
+        return;
+    }
+
+    /* Format client IP address (numeric, so without getnameinfo) */
+    if (inet_ntop(AF_INET, &client_addr.sin_addr, ipbuf, INET_ADDRSTRLEN)) {
+        ALOG_SAMPLED(LOG_INFO, "connect from %s:%d", ipbuf,
+                     client_addr.sin_port);
+    } else {
+        ipbuf[0] = '\0';
+        ALOG(LOG_ERR, "invalid address for socket %d", sess_fd);
+    }
+    if (connected >= conf->max_connect) {
+        const char *buf = "Too many connections\n";
+        send(sess_fd, buf, strlen(buf), MSG_NOSIGNAL);
+        close(sess_fd);
+        ALOG(LOG_ERR, "%s", "too many connections");
+        return;
     }
 
-    if (errno == EAGAIN) {
-        _LOG_INFO(root_logger, "close client connection from %s:%d (timeout)", ip, port);
-    } else if (errno) {
-        _LOG_ERROR_ERRNO(root_logger, "close client connection from %s:%d: %s", errno, ip, port);
+    pid_t pid = standby_handoff(sess_fd, ipbuf, client_addr.sin_port);
+    if (pid != -1) {
+        /* served by standby process */
+    } else if (conf->spawn == SPAWN_FORK) {
+        pid = fork();
+        if (pid == 0) {
+            /* child process */
+            session_init(srv_fd, sig_fd);
+            server_session(sess_fd, ipbuf, client_addr.sin_port);
+            exit(0);
+        }
     } else {
-        _LOG_INFO(root_logger, "close client connection from %s:%d", ip, port);
+        char port[8];
+        char *const args[] = {(char *)"echosrv-session", ipbuf, port, NULL};
+        snprintf(port, sizeof(port), "%d", client_addr.sin_port);
+        pid = spawn_session(conf->spawn, conf->session_exec, args, sess_fd,
+                            alog_shm_fd());
+    }
+    if (pid == -1) {
+        ALOG(LOG_ERR, "%s on client connection from %s:%d: %s",
+             spawn_mode_name(conf->spawn), ipbuf, client_addr.sin_port,
+             strerror(errno));
+    } else {
+        connected++;
     }
     close(sess_fd);
 }
 
-int loop_fork(int srv_fd, const struct config *conf) {
-    int ec = 0;
-    SA_IN client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
-    char ipbuf[INET_ADDRSTRLEN];
-    while (running) {
-        int sess_fd = accept(srv_fd, (SA *)&client_addr, &client_addr_len);
-        if (sess_fd == -1) {
-            if (errno != EINTR)
-                _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
-                                 "accept", srv_fd);
-            continue;
+static void reap_children() {
+    pid_t pid;
+    while ((pid = waitpid((pid_t)(-1), 0, WNOHANG)) > 0) {
+        if (standby_reap(pid))
+            continue; /* idle standby process */
+        if (connected > 0)
+            connected--;
+    }
+}
+
+static void handle_signals(int sig_fd) {
+    struct signalfd_siginfo si;
+    while (read(sig_fd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGHUP:
+            _LOG_INFO(root_logger, "%s", "received SIGHUP signal");
+            break;
+        case SIGUSR1:
+            _LOG_INFO(root_logger, "received SIGUSR1 signal, %lu connections",
+                      connected);
+            break;
+        case SIGINT:
+        case SIGTERM:
+            if (running) {
+                running = 0;
+                _LOG_NOTICE(root_logger, "%s", "shutdown initiate");
+            }
+            break;
+        case SIGCHLD:
+            reap_children();
+            break;
         }
+    }
+}
 
-        /* Format client IP address */
-        if (getnameinfo((SA *)&client_addr, client_addr_len, ipbuf,
-                        INET_ADDRSTRLEN, 0, 0, NI_NUMERICHOST) == 0) {
-            _LOG_INFO(root_logger, "connect from %s:%d", ipbuf,
-                      client_addr.sin_port);
+/*
+ * Master loop: connections and signals (signalfd), so children accounting is
+ * synchronous. On shutdown stop listen and wait for sessions drain.
+ */
+int loop_fork(int srv_fd, int sig_fd, const struct config *conf) {
+    int ec = 0;
+    time_t deadline = 0;
+    struct pollfd pfd[2];
+
+    pfd[0].fd = srv_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sig_fd;
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        int timeout = -1;
+        if (running) {
+            /* replenish standby pool, while no pending connections */
+            while (standby_need() && !accept_pending(srv_fd)) {
+                struct standby_sess sess;
+                pid_t pid = standby_fork(srv_fd, &sess);
+                if (pid == 0) {
+                    /* standby process, got connection */
+                    session_init(-1, sig_fd);
+                    server_session(sess.fd, sess.ip, sess.port);
+                    exit(0);
+                } else if (pid == -1) {
+                    ALOG(LOG_ERR, "standby fork: %s", strerror(errno));
+                    break;
+                }
+            }
         } else {
-            _LOG_ERROR(root_logger, "invalid address for socket %d", sess_fd);
-        }
-        if (connected >= conf->max_connect) {
-            const char *buf = "Too many connections\n";
-            send(sess_fd, buf, strlen(buf), MSG_NOSIGNAL);
-            close(sess_fd);
-            _LOG_ERROR(root_logger, "%s", "too many connections");
-            continue;
+            time_t now = time(NULL);
+            if (deadline == 0) {
+                deadline = now + conf->shutdown_timeout;
+                close(srv_fd);
+                srv_fd = -1;
+                pfd[0].fd = -1;
+                standby_close(); /* idle processes exit on EOF */
+            }
+            if (connected == 0)
+                break;
+            if (now >= deadline) {
+                _LOG_NOTICE(root_logger, "shutdown timeout, %lu connections",
+                            connected);
+                break;
+            }
+            timeout = (deadline - now) * 1000;
         }
 
-        pid_t pid = fork();
-        if (pid == -1) {
-            _LOG_ERROR_ERRNO(root_logger,
-                             "fork on client connection from %s:%d: %s", errno,
-                             ipbuf, client_addr.sin_port);
-        } else if (pid == 0) {
-            /* child process */
-            worker = 1;
-            close(srv_fd);
-            server_session(sess_fd, ipbuf, client_addr.sin_port, conf);
-            exit(0);
+        if (poll(pfd, 2, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            ec = -1;
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "poll");
+            break;
         }
-        connected++;
-        close(sess_fd);
+        if (pfd[1].revents & POLLIN)
+            handle_signals(sig_fd);
+        if (running && (pfd[0].revents & POLLIN))
+            accept_session(srv_fd, sig_fd, conf);
     }
-EXIT:
-    close(srv_fd);
+
+    if (srv_fd != -1)
+        close(srv_fd);
     return ec;
 }
 
 int start_server(const struct config *conf) {
     int ec = 0;
-    int srv_fd; /* server socket */
+    int srv_fd = -1; /* server socket */
+    int sig_fd = -1;
+    sigset_t mask;
     SA_IN srv_addr;
 
     if ((srv_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
@@ -161,55 +264,59 @@ int start_server(const struct config *conf) {
         goto EXIT;
     }
 
-    _LOG_NOTICE(root_logger, "%s", "startup");
+    if (alog_start() == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "start log flusher");
+        goto EXIT;
+    }
+
+    if (conf->standby > 0 && standby_init(conf->standby) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "standby pool");
+        goto EXIT;
+    }
+
+    /* master signals are read in loop, session processes unblock them */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1 ||
+        (sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "signalfd");
+        goto EXIT;
+    }
+
+    _LOG_NOTICE(root_logger, "startup (spawn %s, standby %d)",
+                spawn_mode_name(conf->spawn), conf->standby);
 
-    ec = loop_fork(srv_fd, conf);
+    ec = loop_fork(srv_fd, sig_fd, conf);
+    srv_fd = -1;
 
 EXIT:
+    if (srv_fd != -1)
+        close(srv_fd);
+    if (sig_fd != -1)
+        close(sig_fd);
+    alog_stop();
     if (ec)
         _LOG_NOTICE(root_logger, "%s", "shutdown with error");
-    return ec;
-}
-
-void app_shutdown() {
-    running = 0;
-    if (!worker)
-        _LOG_NOTICE(root_logger, "%s", "shutdown initiate");
-    if (connected > 0)
-        sleep(10);
     else
-        sleep(1);
-    if (!worker)
         _LOG_NOTICE(root_logger, "%s", "shutdown");
-    exit(0);
-}
-
-void handle_sigchld() {
-    while (waitpid((pid_t)(-1), 0, WNOHANG) > 0) {
-        if (connected > 0)
-            connected--;
-    }
+    return ec;
 }
 
+/* session process handler, master read signals from signalfd */
 void sig_handler(int sig) {
-    int saved_errno = errno;
     switch (sig) {
-    case SIGHUP:
-        _LOG_INFO(root_logger, "%s", "received SIGHUP signal");
-        break;
-    case SIGUSR1:
-        _LOG_INFO(root_logger, "%s", "received SIGUSR1 signal");
-        break;
     case SIGINT:
     case SIGTERM:
-        app_shutdown();
-        break;
-    case SIGCHLD:
-        /* _LOG_INFO(root_logger, "%s", "received SIGCHLD signal"); */
-        handle_sigchld();
+        running = 0;
         break;
     }
-    errno = saved_errno;
 }
 
 int sig_handlers_init() {
@@ -220,10 +327,8 @@ int sig_handlers_init() {
     /* Setup the signal handler */
     sa.sa_handler = &sig_handler;
 
-    /* Restart the system call, if at all possible */
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-
-    /* sa.sa_flags = 0; */
+    /* Interrupt session recv/send on shutdown */
+    sa.sa_flags = 0;
 
     /* Block every signal during the handler */
     sigfillset(&sa.sa_mask);
@@ -257,20 +362,7 @@ int sig_handlers_init() {
         ec = 1;
     }
 
-    /* SIGCHLD for cleanup zombie child processes */
-    if (sigaction(SIGCHLD, &sa, NULL) == -1) {
-        perror("Cannot handle SIGCHLD");
-        ec = 1;
-    }
-
-    /* Ignore SIGICHLD for auto-cleanup zombie child processes, if don't need
-     * custom handler */
-    /*
-    if (sigaction(SIGCHLD, &(struct sigaction){SIG_IGN}, NULL) == -1) {
-        perror("Error: cannot handle SIGCHLD");
-        ec = 1;
-    }
-    */
+    /* SIGCHLD is read by master from signalfd, don't ignore it */
 
     return ec;
 }
@@ -280,8 +372,18 @@ void usage(const char *name) {
             "\t-b | --background Fork and run in background\n"
             "\t-a | --address <LISTEN_ADDRESS> (default all)\n"
             "\t-p | --port <LISTEN_PORT> (default 1234)\n"
+            "\t-L | --log <syslog|stderr|FILE> connections log (default syslog)\n"
+            "\t-l | --log-level <err|warning|notice|info|debug> (default info)\n"
+            "\t-N | --log-sample <N> log one of N connections events (default 1)\n"
             "\t-d | --delay <DELAY> (default 0)\n"
-            "\t-m | --max <MAX_CONNECTIONS> (default unlimited)\n");
+            "\t-m | --max <MAX_CONNECTIONS> (default unlimited)\n"
+            "\t-s | --spawn <fork|vfork|spawn> session process (default fork)\n"
+            "\t-E | --session-exec <PATH> session executable for vfork/spawn\n"
+            "\t     (default echosrv-session near server executable)\n"
+            "\t-P | --standby <N> idle pre-forked session processes, connection\n"
+            "\t     passed with SCM_RIGHTS, fallback to spawn mode (default 0)\n"
+            "\t-T | --shutdown-timeout <SEC> wait for sessions on shutdown\n"
+            "\t     (default 10)\n");
     exit(1);
 }
 
@@ -295,11 +397,19 @@ int main(int argc, char *const argv[]) {
     conf.port = 1234;
     conf.max_connect = INT_MAX;
     conf.delay = 0;
+    conf.spawn = SPAWN_FORK;
+    conf.session_exec = NULL;
+    conf.standby = 0;
+    conf.shutdown_timeout = 10;
+    char session_exec[PATH_MAX];
+    const char *log_output = NULL;
+    int log_level = LOG_INFO;
+    int log_sample = 1;
 
     int opt = 0;
     int opt_idx = 0;
 
-    const char *opts = "hba:p:m:d:";
+    const char *opts = "hba:p:m:d:L:l:N:s:E:P:T:";
     const struct option long_opts[] = {
         /* Use flags like so:
         {"verbose",	no_argument,	&verbose_flag, 'V'}*/
@@ -310,6 +420,13 @@ int main(int argc, char *const argv[]) {
         {"port", required_argument, 0, 'p'},
         {"delay", required_argument, 0, 'd'},
         {"max", required_argument, 0, 'm'},
+        {"log", required_argument, 0, 'L'},
+        {"log-level", required_argument, 0, 'l'},
+        {"log-sample", required_argument, 0, 'N'},
+        {"spawn", required_argument, 0, 's'},
+        {"session-exec", required_argument, 0, 'E'},
+        {"standby", required_argument, 0, 'P'},
+        {"shutdown-timeout", required_argument, 0, 'T'},
         {0, 0, 0, 0}};
 
     while ((opt = getopt_long(argc, argv, opts, long_opts, &opt_idx)) != -1) {
@@ -352,6 +469,45 @@ int main(int argc, char *const argv[]) {
             }
             break;
         }
+        case 'L':
+            log_output = optarg;
+            break;
+        case 'l':
+            if ((log_level = alog_level_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid log level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            log_sample = atoi(optarg);
+            if (log_sample <= 0) {
+                fprintf(stderr, "invalid log sample: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            if ((conf.spawn = spawn_mode_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid spawn mode: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'E':
+            conf.session_exec = optarg;
+            break;
+        case 'P':
+            conf.standby = atoi(optarg);
+            if (conf.standby < 0) {
+                fprintf(stderr, "invalid standby: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'T':
+            conf.shutdown_timeout = atoi(optarg);
+            if (conf.shutdown_timeout < 0) {
+                fprintf(stderr, "invalid shutdown timeout: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 0: /* binded option, set by getopt */
             break;
         case '?':
@@ -370,6 +526,30 @@ int main(int argc, char *const argv[]) {
         return EXIT_FAILURE;
     }
 
+    if (conf.spawn != SPAWN_FORK) {
+        if (conf.session_exec == NULL) {
+            if (spawn_exec_path(session_exec, sizeof(session_exec),
+                                "echosrv-session") == -1) {
+                perror("session executable");
+                return EXIT_FAILURE;
+            }
+            conf.session_exec = session_exec;
+        }
+        if (access(conf.session_exec, X_OK) == -1) {
+            fprintf(stderr, "session executable %s: %s\n", conf.session_exec,
+                    strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* children share rings by pid hash */
+    if (alog_init(name, log_output, LOG_LOCAL0, log_level, ALOG_RINGS,
+                  log_sample) == -1) {
+        fprintf(stderr, "init log %s: %s\n", log_output ? log_output : "syslog",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
     if (sig_handlers_init()) {
         ec = 1;
         goto EXIT;
@@ -0,0 +1,54 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <c_procs/netutils/netutils.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "session.h"
+
+#define BUFSIZE 4096
+
+void server_session(int sess_fd, const char *ip, const u_short port) {
+    char buf[BUFSIZE];
+    ssize_t r, s;
+    size_t rsize, wsize;
+    struct timeval tv;
+    tv.tv_sec = 60;
+    tv.tv_usec = 0;
+    set_keepalive(sess_fd);
+
+    set_send_timeout(sess_fd, &tv);
+    set_recv_timeout(sess_fd, &tv);
+    errno = 0;
+
+    while (running) {
+        r = recv_try(sess_fd, buf, BUFSIZE - 1, MSG_NOSIGNAL, &rsize, &running, '\n');
+        //_LOG_INFO(root_logger, "read %lu from %s:%d", rsize, ip, port);
+        // if (r == -1)
+        if (r < 1 || running == 0)
+            break;
+        buf[r] = '\0';
+        if (strcmp(buf, "quit\r\n") == 0 || strcmp(buf, "quit\n") == 0)
+            break;
+        s = send_try(sess_fd, buf, rsize, MSG_NOSIGNAL, &wsize, &running);
+        //_LOG_INFO(root_logger, "write %d to %s:%d", wsize, ip, port);
+        if (s < 1)
+            break;
+    }
+
+    if (errno == EAGAIN) {
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d (timeout)",
+                     ip, port);
+    } else if (errno) {
+        ALOG(LOG_ERR, "close client connection from %s:%d: %s", ip, port,
+             strerror(errno));
+    } else {
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d", ip, port);
+    }
+    close(sess_fd);
+}
@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "standby.h"
+
+struct standby_slot {
+    pid_t pid; /* 0 - free, -1 - died while idle */
+    int dead;  /* handoff failed, pid is kept until reaped */
+    int fd;    /* master side of socketpair */
+};
+
+struct standby_msg {
+    char ip[INET_ADDRSTRLEN];
+    u_short port;
+};
+
+static struct standby_slot *slots = NULL;
+static int nslots = 0;
+static int idle = 0;
+
+static void slot_free(struct standby_slot *s) {
+    if (s->fd != -1)
+        close(s->fd);
+    s->fd = -1;
+    s->pid = 0;
+    s->dead = 0;
+    idle--;
+}
+
+int standby_init(int size) {
+    slots = calloc(size, sizeof(struct standby_slot));
+    if (slots == NULL)
+        return -1;
+    for (int i = 0; i < size; i++)
+        slots[i].fd = -1;
+    nslots = size;
+    return 0;
+}
+
+int standby_need() {
+    for (int i = 0; i < nslots; i++) {
+        if (slots[i].pid == -1)
+            slot_free(&slots[i]);
+    }
+    return idle < nslots;
+}
+
+void standby_close() {
+    /* keep pids, so exit of idle processes is not counted as session end */
+    for (int i = 0; i < nslots; i++) {
+        if (slots[i].fd != -1) {
+            close(slots[i].fd);
+            slots[i].fd = -1;
+        }
+    }
+}
+
+/* child: wait for client socket from master */
+static void standby_wait(int fd, struct standby_sess *sess) {
+    struct standby_msg m;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = &m, .iov_len = sizeof(m)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    ssize_t n;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+        ;
+    if (n != sizeof(m))
+        exit(0); /* master is gone */
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS)
+        exit(1);
+    close(fd);
+    memcpy(&sess->fd, CMSG_DATA(cmsg), sizeof(int));
+    memcpy(sess->ip, m.ip, sizeof(sess->ip));
+    sess->ip[sizeof(sess->ip) - 1] = '\0';
+    sess->port = m.port;
+}
+
+pid_t standby_fork(int srv_fd, struct standby_sess *sess) {
+    int sv[2], i;
+    pid_t pid;
+
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].pid == 0)
+            break;
+    }
+    if (i == nslots) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+        return -1;
+    pid = fork();
+    if (pid == 0) {
+        close(srv_fd);
+        close(sv[0]);
+        standby_close();
+        standby_wait(sv[1], sess);
+        return 0;
+    }
+    close(sv[1]);
+    if (pid == -1) {
+        int err = errno;
+        close(sv[0]);
+        errno = err;
+        return -1;
+    }
+    slots[i].pid = pid;
+    slots[i].fd = sv[0];
+    idle++;
+    return pid;
+}
+
+pid_t standby_handoff(int sess_fd, const char *ip, u_short port) {
+    struct standby_msg m;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {.iov_base = &m, .iov_len = sizeof(m)};
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    pid_t pid = -1;
+
+    memset(&m, 0, sizeof(m));
+    strncpy(m.ip, ip, sizeof(m.ip) - 1);
+    m.port = port;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sess_fd, sizeof(int));
+
+    for (int i = 0; i < nslots && pid == -1; i++) {
+        struct standby_slot *s = &slots[i];
+        if (s->pid == 0 || s->dead)
+            continue;
+        if (s->pid == -1) {
+            slot_free(s);
+            continue;
+        }
+        if (sendmsg(s->fd, &msg, MSG_NOSIGNAL) == sizeof(m)) {
+            pid = s->pid;
+            slot_free(s);
+        } else {
+            /*
+             * process died, but not reaped yet: keep pid, so it's exit is
+             * not counted as session end
+             */
+            ALOG(LOG_ERR, "standby process %d: %s", s->pid, strerror(errno));
+            close(s->fd);
+            s->fd = -1;
+            s->dead = 1;
+        }
+    }
+    return pid;
+}
+
+int standby_reap(pid_t pid) {
+    for (int i = 0; i < nslots; i++) {
+        if (slots[i].pid == pid) {
+            if (slots[i].dead)
+                slot_free(&slots[i]);
+            else
+                slots[i].pid = -1;
+            return 1;
+        }
+    }
+    return 0;
+}
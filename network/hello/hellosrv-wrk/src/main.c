@@ -7,6 +7,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -17,12 +18,16 @@
 #include <c_procs/netutils/netutils.h>
 #include <c_procs/strutils.h>
 
+#include <srvcommon/acceptlock.h>
+#include <srvcommon/wrkstat.h>
+
 struct config {
 	char *ip;
 	int   port;
 	/* long int max_connect; */ /* max connections */
 	unsigned int delay;
 	int          workers;
+	int          accept_mode; /* accept serialization (enum accept_mode) */
 };
 
 /* #define BACKLOG 20 */
@@ -34,9 +39,15 @@ char running = 1;
 
 int  workers = 0;     /* number of workers */
 char worker_died = 0; /* set to 1 in signal handler if worker died */
+char stat_dump = 0;   /* set to 1 in signal handler for statistic dump */
 
 pid_t *wpids = NULL;
 
+struct wrkstat *stats = NULL; /* workers statistic, indexed like wpids */
+struct wrkstat *wstat = NULL;
+
+struct accept_lock *alock = NULL; /* accept mutex (mutex accept mode) */
+
 struct config conf;
 
 int server_session(int sess_fd, const char *ip, const u_short port,
@@ -45,12 +56,16 @@ int server_session(int sess_fd, const char *ip, const u_short port,
 	strcpy(buf, "Hi there!\n");
 	ssize_t len = strlen(buf);
 	for (int i = 0; i < 5; i++) {
+		uint64_t start = wrkstat_now_us();
 		if (send(sess_fd, buf, len, MSG_NOSIGNAL) == -1) {
+			wrkstat_add(&wstat->errors, 1);
 			_LOG_ERROR_ERRNO(root_logger,
 			                 "send on client connection from %s:%d: %s", errno,
 			                 ip, port);
 			break;
 		}
+		wrkstat_latency(wstat, start);
+		wrkstat_add(&wstat->bytes_out, len);
 		sleep(conf->delay);
 	}
 	/* _LOG_INFO(root_logger, "close client connection from %s:%d", ip, port);
@@ -58,22 +73,82 @@ int server_session(int sess_fd, const char *ip, const u_short port,
 	close(sess_fd);
 }
 
-pid_t loop_child(int srv_fd, const struct config *conf) {
+/*
+ * Wait for connection with configured accept serialization.
+ * Return -1 without connection (interrupted, timeout or lost race).
+ */
+int worker_accept(int srv_fd, int ep_fd, SA_IN *client_addr,
+                  socklen_t *client_addr_len) {
+	int sess_fd;
+	int locked = 0;
+	if (alock) {
+		if ((locked = accept_lock_acquire(alock, 1000)) == -1)
+			_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "accept lock");
+		if (locked < 1)
+			return -1;
+	} else if (ep_fd >= 0) {
+		struct epoll_event ev;
+		int                n = epoll_wait(ep_fd, &ev, 1, 1000);
+		if (n == -1 && errno != EINTR)
+			_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_wait");
+		if (n < 1)
+			return -1;
+	}
+	*client_addr_len = sizeof(*client_addr);
+	sess_fd = accept(srv_fd, (SA *) client_addr, client_addr_len);
+	if (locked)
+		accept_lock_release(alock);
+	if (sess_fd == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			wrkstat_add(&wstat->wakeups, 1);
+			wrkstat_add(&wstat->wakeups_empty, 1);
+		} else if (errno != EINTR && errno != ECONNABORTED) {
+			_LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
+			                 "accept", srv_fd);
+		}
+		return -1;
+	}
+	wrkstat_add(&wstat->wakeups, 1);
+	wrkstat_accepted(wstat, sess_fd);
+	return sess_fd;
+}
+
+pid_t loop_child(int *srv_fds, int idx, const struct config *conf) {
 	pid_t pid = fork();
 	if (pid == 0) {
 		int       ec = 0;
+		int       srv_fd = srv_fds[0];
+		int       ep_fd = -1;
 		SA_IN     client_addr;
-		socklen_t client_addr_len = sizeof(client_addr);
+		socklen_t client_addr_len;
 		char      ipbuf[INET_ADDRSTRLEN];
 		workers = -1; /* set to -1 in worker */
+		wstat = &stats[idx];
+		wrkstat_start(wstat, getpid());
+		if (conf->accept_mode == ACCEPT_REUSEPORT) {
+			/* use own listener, other listeners belongs to other workers */
+			srv_fd = srv_fds[idx];
+			for (int i = 0; i < conf->workers; i++) {
+				if (i != idx)
+					close(srv_fds[i]);
+			}
+		} else if (conf->accept_mode == ACCEPT_EXCLUSIVE) {
+			/* wait in own epoll, kernel wake up one exclusive waiter */
+			struct epoll_event ev;
+			ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+			ev.data.fd = srv_fd;
+			set_nonblock(srv_fd);
+			if ((ep_fd = epoll_create1(EPOLL_CLOEXEC)) == -1 ||
+			    epoll_ctl(ep_fd, EPOLL_CTL_ADD, srv_fd, &ev) == -1) {
+				_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "accept epoll");
+				exit(EXIT_FAILURE);
+			}
+		}
 		while (running) {
-			int sess_fd = accept(srv_fd, (SA *) &client_addr, &client_addr_len);
-			if (sess_fd == -1) {
-				if (errno != EINTR)
-					_LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
-					                 "accept", srv_fd);
+			int sess_fd =
+			    worker_accept(srv_fd, ep_fd, &client_addr, &client_addr_len);
+			if (sess_fd == -1)
 				continue;
-			}
 			if (running == 0)
 				break;
 
@@ -105,56 +180,91 @@ pid_t loop_child(int srv_fd, const struct config *conf) {
 	return pid;
 }
 
-int start_server(const struct config *conf) {
-	int   ec = 0;
+int listen_socket(const struct config *conf) {
 	int   srv_fd; /* server socket */
 	SA_IN srv_addr;
-	int   reuse = 1;
-	int   status;
-	pid_t wpid;
-	wpids = (pid_t *) calloc(sizeof(pid_t), conf->workers);
-	if (wpids == NULL) {
-		_LOG_ERROR(root_logger, "%s", "alloc workers");
-		return -1;
-	}
 
 	if ((srv_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
-		ec = -1;
 		_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "socket");
-		goto EXIT;
+		return -1;
 	}
 	set_reuseaddr(srv_fd);
+	if (conf->accept_mode == ACCEPT_REUSEPORT) {
+		int reuse = 1;
+		if (setsockopt(srv_fd, SOL_SOCKET, SO_REUSEPORT, &reuse,
+		               sizeof(reuse)) == -1) {
+			_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "SO_REUSEPORT");
+			goto ERROR;
+		}
+	}
 
 	srv_addr.sin_family = AF_INET;
 	srv_addr.sin_port = htons(conf->port);
 	if (conf->ip == NULL)
 		srv_addr.sin_addr.s_addr = htonl(INADDR_ANY); /* List on any IP */
 	else if (inet_aton(conf->ip, &srv_addr.sin_addr) == 0) {
-		ec = -1;
 		_LOG_ERROR(root_logger, "invalid address: %s", conf->ip);
-		goto EXIT;
+		goto ERROR;
 	}
 
 	if (bind(srv_fd, (SA *) &srv_addr, sizeof(srv_addr)) == -1) {
-		ec = -1;
 		_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "bind");
-		goto EXIT;
+		goto ERROR;
 	}
 
 	/* set_nonblock(srv_fd); */
 
 	if (listen(srv_fd, BACKLOG) == -1) {
-		ec = -1;
 		_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "listen");
+		goto ERROR;
+	}
+	return srv_fd;
+ERROR:
+	close(srv_fd);
+	return -1;
+}
+
+int start_server(const struct config *conf) {
+	int   ec = 0;
+	int * srv_fds; /* server sockets, one per worker in reuseport mode */
+	int   listeners;
+	int   status;
+	pid_t wpid;
+	listeners = conf->accept_mode == ACCEPT_REUSEPORT ? conf->workers : 1;
+	wpids = (pid_t *) calloc(sizeof(pid_t), conf->workers);
+	stats = wrkstat_new(conf->workers);
+	srv_fds = (int *) malloc(sizeof(int) * listeners);
+	if (wpids == NULL || stats == NULL || srv_fds == NULL) {
+		_LOG_ERROR(root_logger, "%s", "alloc workers");
+		free(wpids);
+		wrkstat_free(stats, conf->workers);
+		free(srv_fds);
+		return -1;
+	}
+	for (int i = 0; i < listeners; i++)
+		srv_fds[i] = -1;
+
+	if (conf->accept_mode == ACCEPT_MUTEX &&
+	    (alock = accept_lock_new()) == NULL) {
+		ec = -1;
+		_LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "accept lock");
 		goto EXIT;
 	}
 
-	_LOG_NOTICE(root_logger, "%s", "startup");
+	for (int i = 0; i < listeners; i++) {
+		if ((srv_fds[i] = listen_socket(conf)) == -1) {
+			ec = -1;
+			goto EXIT;
+		}
+	}
+
+	_LOG_NOTICE(root_logger, "startup (accept %s)",
+	            accept_mode_name(conf->accept_mode));
 
 	/* run workers */
 	if (workers < conf->workers) {
 		for (int i = 0; i < conf->workers; i++) {
-			wpids[i] = loop_child(srv_fd, conf);
+			wpids[i] = loop_child(srv_fds, i, conf);
 			if (wpids[i] < 0) {
 				ec = -1;
 				running = 0;
@@ -173,7 +283,7 @@ int start_server(const struct config *conf) {
 					if (running == 0) {
 						break;
 					}
-					wpids[i] = loop_child(srv_fd, conf);
+					wpids[i] = loop_child(srv_fds, i, conf);
 					if (wpids[i] < 0) {
 						ec = -1;
 						_LOG_INFO(root_logger, "%s", "worker restart faled");
@@ -185,6 +295,9 @@ int start_server(const struct config *conf) {
 					}
 				}
 			}
+		} else if (stat_dump) {
+			stat_dump = 0;
+			wrkstat_dump(stats, conf->workers);
 		} else {
 			sleep(1);
 		}
@@ -192,9 +305,16 @@ int start_server(const struct config *conf) {
 EXIT:
 	while (wait(&status) > 0) {
 	}
-	if (srv_fd)
-		close(srv_fd);
+	for (int i = 0; i < listeners; i++) {
+		if (srv_fds[i] >= 0)
+			close(srv_fds[i]);
+	}
+	free(srv_fds);
+	accept_lock_free(alock);
 	free(wpids);
+	if (ec == 0)
+		wrkstat_dump(stats, conf->workers);
+	wrkstat_free(stats, conf->workers);
 	if (ec) {
 		_LOG_NOTICE(root_logger, "%s", "shutdown with error");
 	} else {
@@ -249,7 +369,9 @@ void sig_handler(int sig) {
 		_LOG_INFO(root_logger, "%s", "received SIGHUP signal");
 		break;
 	case SIGUSR1:
-		_LOG_INFO(root_logger, "%s", "received SIGUSR1 signal");
+		/* dump workers statistic in master loop */
+		if (workers >= 0)
+			stat_dump = 1;
 		break;
 	case SIGINT:
 	case SIGTERM:
@@ -332,7 +454,9 @@ void usage(const char *name) {
 	        "\t-a | --address <LISTEN_ADDRESS> (default all)\n"
 	        "\t-p | --port <LISTEN_PORT> (default 1234)\n"
 	        "\t-d | --delay <DELAY> (default 0)\n"
-	        "\t-w | --workers <WORKERS> (default 2)\n");
+	        "\t-w | --workers <WORKERS> (default 2)\n"
+	        "\t-x | --accept <none|mutex|exclusive|reuseport> accept\n"
+	        "\t     serialization (default none)\n");
 	exit(1);
 }
 
@@ -346,11 +470,12 @@ int main(int argc, char *const argv[]) {
 	conf.workers = 2;
 	/* conf.max_connect = INT_MAX; */
 	conf.delay = 0;
+	conf.accept_mode = ACCEPT_NONE;
 
 	int opt = 0;
 	int opt_idx = 0;
 
-	const char *        opts = "hba:p:w:d:";
+	const char *        opts = "hba:p:w:d:x:";
 	const struct option long_opts[] = {
 	    /* Use flags like so:
 	    {"verbose",	no_argument,	&verbose_flag, 'V'}*/
@@ -361,6 +486,7 @@ int main(int argc, char *const argv[]) {
 	    {"port", optional_argument, 0, 'p'},
 	    {"delay", required_argument, 0, 'd'},
 	    {"workers", required_argument, 0, 'w'},
+	    {"accept", required_argument, 0, 'x'},
 	    {0, 0, 0, 0}};
 
 	while ((opt = getopt_long(argc, argv, opts, long_opts, &opt_idx)) != -1) {
@@ -401,6 +527,12 @@ int main(int argc, char *const argv[]) {
 			}
 			break;
 		}
+		case 'x':
+			if ((conf.accept_mode = accept_mode_parse(optarg)) == -1) {
+				fprintf(stderr, "invalid accept mode: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 0: /* binded option, set by getopt */
 			break;
 		case '?':
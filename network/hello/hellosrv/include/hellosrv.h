@@ -0,0 +1,34 @@
+#ifndef _HELLOSRV_H_
+#define _HELLOSRV_H_
+
+#define HELLO_MSG "Hi there!\n"
+#define HELLO_COUNT 5 /* messages per client */
+
+#include "payload.h"
+
+enum engine {
+    ENGINE_FORK = 0, /* process per client, sleep between messages */
+    ENGINE_TIMER = 1 /* all clients in one process, timer wheel schedule */
+};
+
+struct config {
+    char *ip;
+    int port;
+    long int max_connect; /* max connections */
+    unsigned int delay;
+    int engine;
+    unsigned int interval;    /* messages interval (ms), timer engine */
+    int spawn;                /* session spawn mode */
+    const char *session_exec; /* session executable (vfork, spawn modes) */
+    const char *file;         /* streamed file, NULL - HELLO_MSG */
+    int header;               /* send header line before file */
+    struct payload payload;
+};
+
+extern int running;
+extern unsigned long int connected;
+
+/* timer engine loop */
+int loop_timed(int srv_fd, const struct config *conf);
+
+#endif /* _HELLOSRV_H_ */
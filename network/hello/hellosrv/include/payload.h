@@ -0,0 +1,39 @@
+#ifndef _HELLOSRV_PAYLOAD_H_
+#define _HELLOSRV_PAYLOAD_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Payload streamed to each client with sendfile (no copy through user space).
+ * Source is file (config snapshot, etc) or memfd with HELLO_MSG (default).
+ * Optional header line "NAME SIZE\n" is sent before file body under TCP_CORK,
+ * so header and first body bytes leave in one segment.
+ */
+
+#define PAYLOAD_HEADER_MAX 288
+
+struct payload {
+    int fd;     /* sendfile source */
+    off_t size; /* body size */
+    int count;  /* sends per client */
+    char header[PAYLOAD_HEADER_MAX];
+    size_t header_len; /* 0 - without header */
+};
+
+/*
+ * Open PATH (NULL - HELLO_MSG in memfd), with HEADER line if not 0.
+ * Return -1 on error (errno is set).
+ */
+int payload_open(struct payload *p, const char *path, int header);
+
+void payload_close(struct payload *p);
+
+/*
+ * Send payload from *POS (header and body offset) to socket FD.
+ * Return 0 if sent all (*POS is reset), -1 on error (errno is set). On
+ * non-blocking socket EAGAIN is error, *POS is position for resume.
+ */
+int payload_send(const struct payload *p, int fd, size_t *pos);
+
+#endif /* _HELLOSRV_PAYLOAD_H_ */
@@ -0,0 +1,12 @@
+#ifndef _HELLOSRV_SESSION_H_
+#define _HELLOSRV_SESSION_H_
+
+#include <sys/types.h>
+
+#include "payload.h"
+
+/* serve client connection, used by forked child and session executable */
+void server_session(int sess_fd, const char *ip, const u_short port,
+                    const struct payload *p, unsigned int delay);
+
+#endif /* _HELLOSRV_SESSION_H_ */
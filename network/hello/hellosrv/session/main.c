@@ -0,0 +1,51 @@
+/*
+ * hellosrv-session: serve one client connection (passed as stdin/stdout),
+ * started by hellosrv in vfork or spawn mode.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "payload.h"
+#include "session.h"
+
+int main(int argc, char *const argv[]) {
+    int port, delay;
+    struct payload payload;
+    const char *file = NULL;
+    int header = 0;
+
+    if (argc < 4 || argc > 6) {
+        fprintf(stderr, "use: %s IP PORT DELAY [FILE [HEADER]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    port = atoi(argv[2]);
+    delay = atoi(argv[3]);
+    if (argc > 4)
+        file = argv[4];
+    if (argc > 5)
+        header = atoi(argv[5]);
+
+    sigaction(SIGPIPE, &(struct sigaction){SIG_IGN}, NULL);
+
+    /* server rings, synchronous syslog without them */
+    if (alog_attach(ALOG_SHM_FD) == -1)
+        openlog("hellosrv", LOG_CONS | LOG_PID | LOG_NDELAY, LOG_LOCAL0);
+
+    if (payload_open(&payload, file, header) == -1) {
+        ALOG(LOG_ERR, "payload %s: %s", file ? file : "hello",
+             strerror(errno));
+        close(STDIN_FILENO);
+        close(STDOUT_FILENO);
+        return EXIT_FAILURE;
+    }
+
+    server_session(STDIN_FILENO, argv[1], port, &payload, delay);
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -17,9 +18,17 @@
 #include <c_procs/netutils/netutils.h>
 #include <c_procs/strutils.h>
 
+#include <srvcommon/asynclog.h>
+#include <srvcommon/spawn.h>
+
+#include "hellosrv.h"
+#include "session.h"
+
 /* #define BACKLOG 20 */
 #define BACKLOG SOMAXCONN
 
+#define ALOG_RINGS 8
+
 #define BUFSIZE 4096
 
 int running = 1;
@@ -27,32 +36,6 @@ int running = 1;
 unsigned long int connected = 0; /* number of connections */
 int worker = 0;                  /* set to 1 in worker process */
 
-struct config {
-    char *ip;
-    int port;
-    long int max_connect; /* max connections */
-    unsigned int delay;
-};
-
-int server_session(int sess_fd, const char *ip, const u_short port,
-                   const struct config *conf) {
-    char buf[BUFSIZE];
-    strcpy(buf, "Hi there!\n");
-    ssize_t len = strlen(buf);
-    for (int i = 0; i < 5; i++) {
-        if (send(sess_fd, buf, len, MSG_NOSIGNAL) == -1) {
-            _LOG_ERROR_ERRNO(root_logger,
-                             "send on client connection from %s:%d: %s", errno,
-                             ip, port);
-            break;
-        }
-        sleep(conf->delay);
-    }
-    /* _LOG_INFO(root_logger, "close client connection from %s:%d", ip, port);
-     */
-    close(sess_fd);
-}
-
 int loop_fork(int srv_fd, const struct config *conf) {
     int ec = 0;
     SA_IN client_addr;
@@ -62,43 +45,63 @@ int loop_fork(int srv_fd, const struct config *conf) {
         int sess_fd = accept(srv_fd, (SA *)&client_addr, &client_addr_len);
         if (sess_fd == -1) {
             if (errno != EINTR)
-                _LOG_ERROR_ERRNO(root_logger, "%s on socket %d: %s", errno,
-                                 "accept", srv_fd);
+                ALOG(LOG_ERR, "%s on socket %d: %s", "accept", srv_fd,
+                     strerror(errno));
             continue;
         }
 
-        /* Format client IP address */
-        if (getnameinfo((SA *)&client_addr, client_addr_len, ipbuf,
-                        INET_ADDRSTRLEN, 0, 0, NI_NUMERICHOST) == 0) {
-            _LOG_INFO(root_logger, "connect from %s:%d", ipbuf,
-                      client_addr.sin_port);
+        /* Format client IP address (numeric, so without getnameinfo) */
+        if (inet_ntop(AF_INET, &client_addr.sin_addr, ipbuf, INET_ADDRSTRLEN)) {
+            ALOG_SAMPLED(LOG_INFO, "connect from %s:%d", ipbuf,
+                         client_addr.sin_port);
         } else {
-            _LOG_ERROR(root_logger, "invalid address for socket %d", sess_fd);
+            ipbuf[0] = '\0';
+            ALOG(LOG_ERR, "invalid address for socket %d", sess_fd);
         }
         if (connected >= conf->max_connect) {
             const char *buf = "Too many connections\n";
             send(sess_fd, buf, strlen(buf), MSG_NOSIGNAL);
             close(sess_fd);
-            _LOG_ERROR(root_logger, "%s", "too many connections");
+            ALOG(LOG_ERR, "%s", "too many connections");
             continue;
         }
 
-        pid_t pid = fork();
+        pid_t pid;
+        if (conf->spawn == SPAWN_FORK) {
+            pid = fork();
+            if (pid == 0) {
+                /* child process */
+                worker = 1;
+                close(srv_fd);
+                server_session(sess_fd, ipbuf, client_addr.sin_port,
+                               &conf->payload, conf->delay);
+                exit(0);
+            }
+        } else {
+            char port[8], delay[8], header[2];
+            /* FILE and HEADER are omitted (NULL) for hello payload */
+            char *const args[] = {(char *)"hellosrv-session",
+                                  ipbuf,
+                                  port,
+                                  delay,
+                                  (char *)conf->file,
+                                  header,
+                                  NULL};
+            snprintf(port, sizeof(port), "%d", client_addr.sin_port);
+            snprintf(delay, sizeof(delay), "%u", conf->delay);
+            snprintf(header, sizeof(header), "%d", conf->header);
+            pid = spawn_session(conf->spawn, conf->session_exec, args, sess_fd,
+                                alog_shm_fd());
+        }
         if (pid == -1) {
-            _LOG_ERROR_ERRNO(root_logger,
-                             "fork on client connection from %s:%d: %s", errno,
-                             ipbuf, client_addr.sin_port);
-        } else if (pid == 0) {
-            /* child process */
-            worker = 1;
-            close(srv_fd);
-            server_session(sess_fd, ipbuf, client_addr.sin_port, conf);
-            exit(0);
+            ALOG(LOG_ERR, "%s on client connection from %s:%d: %s",
+                 spawn_mode_name(conf->spawn), ipbuf, client_addr.sin_port,
+                 strerror(errno));
+        } else {
+            connected++;
         }
-        connected++;
         close(sess_fd);
     }
-EXIT:
     close(srv_fd);
     return ec;
 }
@@ -141,11 +144,27 @@ int start_server(const struct config *conf) {
         goto EXIT;
     }
 
-    _LOG_NOTICE(root_logger, "%s", "startup");
+    if (alog_start() == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "start log flusher");
+        goto EXIT;
+    }
 
-    ec = loop_fork(srv_fd, conf);
+    _LOG_INFO(root_logger, "payload %s, %lld bytes",
+              conf->file ? conf->file : "hello", (long long)conf->payload.size);
+
+    if (conf->engine == ENGINE_TIMER) {
+        _LOG_NOTICE(root_logger, "startup (timer engine, interval %u ms)",
+                    conf->interval);
+        ec = loop_timed(srv_fd, conf);
+    } else {
+        _LOG_NOTICE(root_logger, "startup (spawn %s)",
+                    spawn_mode_name(conf->spawn));
+        ec = loop_fork(srv_fd, conf);
+    }
 
 EXIT:
+    alog_stop();
     if (ec)
         _LOG_NOTICE(root_logger, "%s", "shutdown with error");
     return ec;
@@ -159,8 +178,10 @@ void app_shutdown() {
         sleep(10);
     else
         sleep(1);
-    if (!worker)
+    if (!worker) {
+        alog_stop();
         _LOG_NOTICE(root_logger, "%s", "shutdown");
+    }
     exit(0);
 }
 
@@ -260,8 +281,21 @@ void usage(const char *name) {
             "\t-b | --background Fork and run in background\n"
             "\t-a | --address <LISTEN_ADDRESS> (default all)\n"
             "\t-p | --port <LISTEN_PORT> (default 1234)\n"
+            "\t-L | --log <syslog|stderr|FILE> connections log (default syslog)\n"
+            "\t-l | --log-level <err|warning|notice|info|debug> (default info)\n"
+            "\t-N | --log-sample <N> log one of N connections events (default 1)\n"
             "\t-d | --delay <DELAY> (default 0)\n"
-            "\t-m | --max <MAX_CONNECTIONS> (default unlimited)\n");
+            "\t-f | --file <PATH> stream file to client with sendfile\n"
+            "\t     (default \"Hi there!\" 5 times)\n"
+            "\t-H | --header send \"NAME SIZE\" line before file\n"
+            "\t-e | --engine <fork|timer> process per client or timer driven\n"
+            "\t     clients in one process (default fork)\n"
+            "\t-i | --interval <MS> messages interval for timer engine\n"
+            "\t     (default DELAY * 1000)\n"
+            "\t-m | --max <MAX_CONNECTIONS> (default unlimited)\n"
+            "\t-s | --spawn <fork|vfork|spawn> session process (default fork)\n"
+            "\t-E | --session-exec <PATH> session executable for vfork/spawn\n"
+            "\t     (default hellosrv-session near server executable)\n");
     exit(1);
 }
 
@@ -275,11 +309,22 @@ int main(int argc, char *const argv[]) {
     conf.port = 1234;
     conf.max_connect = INT_MAX;
     conf.delay = 0;
+    conf.spawn = SPAWN_FORK;
+    conf.session_exec = NULL;
+    conf.engine = ENGINE_FORK;
+    conf.file = NULL;
+    conf.header = 0;
+    int interval = -1;
+    char session_exec[PATH_MAX];
+    char file_path[PATH_MAX];
+    const char *log_output = NULL;
+    int log_level = LOG_INFO;
+    int log_sample = 1;
 
     int opt = 0;
     int opt_idx = 0;
 
-    const char *opts = "hba:p:m:d:";
+    const char *opts = "hba:p:m:d:f:He:i:L:l:N:s:E:";
     const struct option long_opts[] = {
         /* Use flags like so:
         {"verbose",	no_argument,	&verbose_flag, 'V'}*/
@@ -290,6 +335,15 @@ int main(int argc, char *const argv[]) {
         {"port", required_argument, 0, 'p'},
         {"delay", required_argument, 0, 'd'},
         {"max", required_argument, 0, 'm'},
+        {"file", required_argument, 0, 'f'},
+        {"header", no_argument, 0, 'H'},
+        {"engine", required_argument, 0, 'e'},
+        {"interval", required_argument, 0, 'i'},
+        {"log", required_argument, 0, 'L'},
+        {"log-level", required_argument, 0, 'l'},
+        {"log-sample", required_argument, 0, 'N'},
+        {"spawn", required_argument, 0, 's'},
+        {"session-exec", required_argument, 0, 'E'},
         {0, 0, 0, 0}};
 
     while ((opt = getopt_long(argc, argv, opts, long_opts, &opt_idx)) != -1) {
@@ -332,6 +386,54 @@ int main(int argc, char *const argv[]) {
             }
             break;
         }
+        case 'f':
+            conf.file = optarg;
+            break;
+        case 'H':
+            conf.header = 1;
+            break;
+        case 'e':
+            if (strcmp(optarg, "fork") == 0) {
+                conf.engine = ENGINE_FORK;
+            } else if (strcmp(optarg, "timer") == 0) {
+                conf.engine = ENGINE_TIMER;
+            } else {
+                fprintf(stderr, "invalid engine: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            if (interval < 0) {
+                fprintf(stderr, "invalid interval: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'L':
+            log_output = optarg;
+            break;
+        case 'l':
+            if ((log_level = alog_level_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid log level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'N':
+            log_sample = atoi(optarg);
+            if (log_sample <= 0) {
+                fprintf(stderr, "invalid log sample: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's':
+            if ((conf.spawn = spawn_mode_parse(optarg)) == -1) {
+                fprintf(stderr, "invalid spawn mode: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'E':
+            conf.session_exec = optarg;
+            break;
         case 0: /* binded option, set by getopt */
             break;
         case '?':
@@ -350,6 +452,46 @@ int main(int argc, char *const argv[]) {
         return EXIT_FAILURE;
     }
 
+    conf.interval = interval >= 0 ? (unsigned int)interval : conf.delay * 1000;
+
+    if (conf.spawn != SPAWN_FORK) {
+        if (conf.session_exec == NULL) {
+            if (spawn_exec_path(session_exec, sizeof(session_exec),
+                                "hellosrv-session") == -1) {
+                perror("session executable");
+                return EXIT_FAILURE;
+            }
+            conf.session_exec = session_exec;
+        }
+        if (access(conf.session_exec, X_OK) == -1) {
+            fprintf(stderr, "session executable %s: %s\n", conf.session_exec,
+                    strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (conf.file != NULL) {
+        /* absolute path for session executable */
+        if (realpath(conf.file, file_path) == NULL) {
+            fprintf(stderr, "file %s: %s\n", conf.file, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        conf.file = file_path;
+    }
+    if (payload_open(&conf.payload, conf.file, conf.header) == -1) {
+        fprintf(stderr, "file %s: %s\n", conf.file ? conf.file : "hello",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* children share rings by pid hash */
+    if (alog_init(name, log_output, LOG_LOCAL0, log_level, ALOG_RINGS,
+                  log_sample) == -1) {
+        fprintf(stderr, "init log %s: %s\n", log_output ? log_output : "syslog",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+
     if (sig_handlers_init()) {
         ec = 1;
         goto EXIT;
@@ -378,6 +520,7 @@ int main(int argc, char *const argv[]) {
         }
     }
 EXIT:
+    payload_close(&conf.payload);
     if (ec != 0) {
         fprintf(stderr, "exit with error, check log\n");
     }
@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hellosrv.h"
+#include "payload.h"
+
+static int open_hello() {
+    const char msg[] = HELLO_MSG;
+    size_t wpos = 0;
+    int fd = memfd_create("hellosrv", MFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    while (wpos < sizeof(msg) - 1) {
+        ssize_t n = write(fd, msg + wpos, sizeof(msg) - 1 - wpos);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        wpos += n;
+    }
+    return fd;
+}
+
+int payload_open(struct payload *p, const char *path, int header) {
+    struct stat st;
+    int err;
+
+    p->header_len = 0;
+    if (path == NULL) {
+        if ((p->fd = open_hello()) == -1)
+            return -1;
+        p->size = strlen(HELLO_MSG);
+        p->count = HELLO_COUNT;
+        return 0;
+    }
+
+    if ((p->fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return -1;
+    if (fstat(p->fd, &st) == -1)
+        goto ERROR;
+    if (!S_ISREG(st.st_mode)) {
+        errno = EINVAL;
+        goto ERROR;
+    }
+    p->size = st.st_size;
+    p->count = 1;
+    if (header) {
+        char name[PATH_MAX];
+        int n;
+        snprintf(name, sizeof(name), "%s", path);
+        n = snprintf(p->header, sizeof(p->header), "%s %lld\n", basename(name),
+                     (long long) p->size);
+        if (n < 0 || (size_t) n >= sizeof(p->header)) {
+            errno = ENAMETOOLONG;
+            goto ERROR;
+        }
+        p->header_len = n;
+    }
+    /* body is read once per client, keep it in page cache */
+    posix_fadvise(p->fd, 0, 0, POSIX_FADV_WILLNEED);
+    return 0;
+
+ERROR:
+    err = errno;
+    close(p->fd);
+    p->fd = -1;
+    errno = err;
+    return -1;
+}
+
+void payload_close(struct payload *p) {
+    if (p->fd != -1) {
+        close(p->fd);
+        p->fd = -1;
+    }
+}
+
+static int set_cork(int fd, int on) {
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+int payload_send(const struct payload *p, int fd, size_t *pos) {
+    if (*pos == 0 && p->header_len > 0 && set_cork(fd, 1) == -1)
+        return -1;
+    while (*pos < p->header_len) {
+        ssize_t n = send(fd, p->header + *pos, p->header_len - *pos,
+                         MSG_NOSIGNAL | MSG_MORE);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        *pos += n;
+    }
+    while (*pos - p->header_len < (size_t) p->size) {
+        off_t off = *pos - p->header_len;
+        ssize_t n = sendfile(fd, p->fd, &off, p->size - off);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0) {
+            /* file truncated after open */
+            errno = EIO;
+            return -1;
+        }
+        *pos += n;
+    }
+    /* push corked tail */
+    if (p->header_len > 0 && set_cork(fd, 0) == -1)
+        return -1;
+    *pos = 0;
+    return 0;
+}
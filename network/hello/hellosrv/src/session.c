@@ -0,0 +1,26 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <srvcommon/asynclog.h>
+
+#include "payload.h"
+#include "session.h"
+
+void server_session(int sess_fd, const char *ip, const u_short port,
+                    const struct payload *p, unsigned int delay) {
+    for (int i = 0; i < p->count; i++) {
+        size_t pos = 0;
+        if (payload_send(p, sess_fd, &pos) == -1) {
+            ALOG(LOG_ERR, "send on client connection from %s:%d: %s", ip, port,
+                 strerror(errno));
+            break;
+        }
+        sleep(delay);
+    }
+    /* _LOG_INFO(root_logger, "close client connection from %s:%d", ip, port);
+     */
+    close(sess_fd);
+}
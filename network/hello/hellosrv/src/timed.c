@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <c_procs/logutils/syslogutils.h>
+#include <c_procs/netutils/netutils.h>
+
+#include <srvcommon/asynclog.h>
+#include <srvcommon/timerwheel.h>
+
+#include "hellosrv.h"
+
+#define MAX_EVENTS 256
+
+#define TIMED_TICK_MAX 10 /* max wheel tick (ms) */
+
+/* timed-stream client, indexed by fd */
+struct timed_client {
+    struct twheel_timer timer; /* first member, timer is cast to client */
+    int fd;                    /* -1 if free */
+    int sent;                  /* sent payloads */
+    size_t wpos;               /* sent bytes of current payload */
+    int wait_out;              /* EPOLLOUT is requested */
+    char ip[INET_ADDRSTRLEN];
+    u_short port;
+};
+
+struct timed_ctx {
+    int ep_fd;
+    struct twheel wheel;
+    unsigned long ticks; /* messages interval in ticks */
+    const struct payload *payload;
+    struct timed_client *clients;
+    int max_fd;
+};
+
+static void client_close(struct timed_ctx *ctx, struct timed_client *c,
+                         int err) {
+    if (err)
+        ALOG(LOG_ERR, "send on client connection from %s:%d: %s", c->ip,
+             c->port, strerror(err));
+    else
+        ALOG_SAMPLED(LOG_INFO, "close client connection from %s:%d", c->ip,
+                     c->port);
+    twheel_del(&ctx->wheel, &c->timer);
+    close(c->fd); /* also removed from epoll */
+    c->fd = -1;
+    connected--;
+}
+
+static int client_events(struct timed_ctx *ctx, struct timed_client *c,
+                         int wait_out) {
+    struct epoll_event ev;
+    if (c->wait_out == wait_out)
+        return 0;
+    ev.events = EPOLLRDHUP | EPOLLET | (wait_out ? EPOLLOUT : 0);
+    ev.data.fd = c->fd;
+    if (epoll_ctl(ctx->ep_fd, EPOLL_CTL_MOD, c->fd, &ev) == -1)
+        return -1;
+    c->wait_out = wait_out;
+    return 0;
+}
+
+/* send rest of current payload and schedule next one */
+static void client_send(struct timed_ctx *ctx, struct timed_client *c) {
+    if (payload_send(ctx->payload, c->fd, &c->wpos) == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* socket buffer is full, continue on EPOLLOUT */
+            if (client_events(ctx, c, 1) == -1)
+                client_close(ctx, c, errno);
+            return;
+        }
+        client_close(ctx, c, errno);
+        return;
+    }
+    c->sent++;
+    if (client_events(ctx, c, 0) == -1) {
+        client_close(ctx, c, errno);
+        return;
+    }
+    if (ctx->ticks == 0) {
+        /* no interval, stream all messages now */
+        if (c->sent < ctx->payload->count)
+            client_send(ctx, c);
+        else
+            client_close(ctx, c, 0);
+        return;
+    }
+    /* after last message client is closed after interval (like sleep) */
+    twheel_add(&ctx->wheel, &c->timer, ctx->ticks);
+}
+
+static void client_due(struct twheel_timer *t, void *arg) {
+    struct timed_ctx *ctx = (struct timed_ctx *) arg;
+    struct timed_client *c = (struct timed_client *) t;
+    if (c->sent < ctx->payload->count)
+        client_send(ctx, c);
+    else
+        client_close(ctx, c, 0);
+}
+
+static void accept_clients(struct timed_ctx *ctx, int srv_fd,
+                           const struct config *conf) {
+    for (;;) {
+        struct epoll_event ev;
+        struct timed_client *c;
+        SA_IN client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int sess_fd = accept4(srv_fd, (SA *) &client_addr, &client_addr_len,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sess_fd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                ALOG(LOG_ERR, "%s on socket %d: %s", "accept", srv_fd,
+                     strerror(errno));
+            return;
+        }
+        /* max_connect is positive (checked on parse) */
+        if (connected >= (unsigned long int) conf->max_connect ||
+            sess_fd >= ctx->max_fd) {
+            const char *buf = "Too many connections\n";
+            send(sess_fd, buf, strlen(buf), MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(sess_fd);
+            ALOG(LOG_ERR, "%s", "too many connections");
+            continue;
+        }
+
+        c = &ctx->clients[sess_fd];
+        c->fd = sess_fd;
+        c->sent = 0;
+        c->wpos = 0;
+        c->wait_out = 0;
+        c->port = client_addr.sin_port;
+        twheel_timer_init(&c->timer);
+        if (inet_ntop(AF_INET, &client_addr.sin_addr, c->ip,
+                      INET_ADDRSTRLEN)) {
+            ALOG_SAMPLED(LOG_INFO, "connect from %s:%d", c->ip, c->port);
+        } else {
+            c->ip[0] = '\0';
+            ALOG(LOG_ERR, "invalid address for socket %d", sess_fd);
+        }
+
+        /* only hangup and writable events, client data is ignored */
+        ev.events = EPOLLRDHUP | EPOLLET;
+        ev.data.fd = sess_fd;
+        if (epoll_ctl(ctx->ep_fd, EPOLL_CTL_ADD, sess_fd, &ev) == -1) {
+            ALOG(LOG_ERR, "epoll add client %s:%d: %s", c->ip, c->port,
+                 strerror(errno));
+            close(sess_fd);
+            c->fd = -1;
+            continue;
+        }
+        connected++;
+        client_send(ctx, c);
+    }
+}
+
+/* raise open files limit for many clients, return limit */
+static int files_limit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        return 1024;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT32_MAX)
+        return INT32_MAX;
+    return (int) rl.rlim_cur;
+}
+
+int loop_timed(int srv_fd, const struct config *conf) {
+    int ec = 0;
+    int tm_fd = -1;
+    unsigned long tick_ms;
+    struct itimerspec its;
+    struct epoll_event ev;
+    struct epoll_event events[MAX_EVENTS];
+    struct timed_ctx ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.ep_fd = -1;
+    ctx.payload = &conf->payload;
+
+    /* tick is interval or less, so interval error is below one tick */
+    tick_ms = conf->interval < TIMED_TICK_MAX ? conf->interval : TIMED_TICK_MAX;
+    if (tick_ms == 0)
+        tick_ms = 1;
+    ctx.ticks = (conf->interval + tick_ms - 1) / tick_ms;
+
+    ctx.max_fd = files_limit();
+    if (conf->max_connect < ctx.max_fd - 16)
+        ctx.max_fd = conf->max_connect + 16;
+    if ((ctx.clients = malloc(sizeof(struct timed_client) * ctx.max_fd)) ==
+        NULL) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "clients alloc");
+        goto EXIT;
+    }
+    for (int i = 0; i < ctx.max_fd; i++)
+        ctx.clients[i].fd = -1;
+    if (twheel_init(&ctx.wheel, ctx.ticks + 1) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "timer wheel");
+        goto EXIT;
+    }
+
+    if (set_nonblock(srv_fd) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "set_nonblock");
+        goto EXIT;
+    }
+    if ((ctx.ep_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_create");
+        goto EXIT;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = srv_fd;
+    if (epoll_ctl(ctx.ep_fd, EPOLL_CTL_ADD, srv_fd, &ev) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_ctl");
+        goto EXIT;
+    }
+
+    if ((tm_fd = timerfd_create(CLOCK_MONOTONIC,
+                                TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "timerfd_create");
+        goto EXIT;
+    }
+    its.it_interval.tv_sec = tick_ms / 1000;
+    its.it_interval.tv_nsec = (tick_ms % 1000) * 1000000;
+    its.it_value = its.it_interval;
+    ev.events = EPOLLIN;
+    ev.data.fd = tm_fd;
+    if (timerfd_settime(tm_fd, 0, &its, NULL) == -1 ||
+        epoll_ctl(ctx.ep_fd, EPOLL_CTL_ADD, tm_fd, &ev) == -1) {
+        ec = -1;
+        _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "timerfd");
+        goto EXIT;
+    }
+
+    _LOG_INFO(root_logger, "timer engine: tick %lu ms, max clients %d",
+              tick_ms, ctx.max_fd);
+
+    while (running) {
+        int n = epoll_wait(ctx.ep_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            ec = -1;
+            _LOG_ERROR_ERRNO(root_logger, "%s: %s", errno, "epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == srv_fd) {
+                accept_clients(&ctx, srv_fd, conf);
+            } else if (fd == tm_fd) {
+                uint64_t exp;
+                /* missed ticks (long tick processing) are caught up */
+                if (read(tm_fd, &exp, sizeof(exp)) == sizeof(exp)) {
+                    while (exp-- > 0)
+                        twheel_tick(&ctx.wheel, client_due, &ctx);
+                }
+            } else {
+                struct timed_client *c = &ctx.clients[fd];
+                if (c->fd == -1)
+                    continue; /* closed in this batch */
+                if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    client_close(&ctx, c, 0);
+                else if ((events[i].events & EPOLLOUT) && c->wait_out)
+                    client_send(&ctx, c);
+            }
+        }
+    }
+
+EXIT:
+    if (tm_fd != -1)
+        close(tm_fd);
+    if (ctx.ep_fd != -1)
+        close(ctx.ep_fd);
+    if (ctx.clients) {
+        for (int i = 0; i < ctx.max_fd; i++) {
+            if (ctx.clients[i].fd != -1)
+                close(ctx.clients[i].fd);
+        }
+        free(ctx.clients);
+    }
+    twheel_free(&ctx.wheel);
+    close(srv_fd);
+    return ec;
+}
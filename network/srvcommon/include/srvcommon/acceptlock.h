@@ -0,0 +1,40 @@
+#ifndef _SRVCOMMON_ACCEPTLOCK_H_
+#define _SRVCOMMON_ACCEPTLOCK_H_
+
+/*
+ * Accept serialization for prefork workers.
+ * none      - all workers wait on shared listener, kernel wake them up
+ *             (blocking accept wake one, epoll wake all - thundering herd)
+ * mutex     - only worker, holding process-shared mutex, wait on listener
+ * exclusive - shared listener in per-worker epoll with EPOLLEXCLUSIVE
+ * reuseport - SO_REUSEPORT listener per worker, kernel balance connections
+ */
+
+enum accept_mode {
+    ACCEPT_NONE = 0,
+    ACCEPT_MUTEX = 1,
+    ACCEPT_EXCLUSIVE = 2,
+    ACCEPT_REUSEPORT = 3
+};
+
+/* return mode or -1 if invalid */
+int accept_mode_parse(const char *s);
+const char *accept_mode_name(int mode);
+
+struct accept_lock;
+
+/*
+ * Robust process-shared mutex in anonymous shared mmap, created in master
+ * before fork. Lock, owned by died worker, is recovered by next locker.
+ */
+struct accept_lock *accept_lock_new();
+void accept_lock_free(struct accept_lock *l);
+
+/*
+ * Acquire lock, wait up to timeout_ms (0 - try only).
+ * Return 1 if acquired, 0 on timeout, -1 on error (errno is set).
+ */
+int accept_lock_acquire(struct accept_lock *l, int timeout_ms);
+void accept_lock_release(struct accept_lock *l);
+
+#endif /* _SRVCOMMON_ACCEPTLOCK_H_ */
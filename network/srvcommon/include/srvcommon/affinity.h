@@ -0,0 +1,48 @@
+#ifndef _SRVCOMMON_AFFINITY_H_
+#define _SRVCOMMON_AFFINITY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Placement policy for workers (processes or threads).
+ * compact - fill NUMA node by node, hyperthread siblings are neighbours
+ * spread  - round-robin over NUMA nodes, one thread per core first
+ * list    - explicit cpu list, like 0,2,4-7
+ * Worker N is pinned to cpu with index (N % cpus count) in policy order.
+ */
+
+enum affinity_policy {
+    AFFINITY_NONE = 0,
+    AFFINITY_COMPACT = 1,
+    AFFINITY_SPREAD = 2,
+    AFFINITY_LIST = 3
+};
+
+struct affinity {
+    int policy;
+    int ncpu;
+    int *cpus;    /* cpus in policy order */
+    int rt_prio;  /* SCHED_FIFO priority, 0 - don't change scheduler */
+};
+
+/* parse policy (none, compact, spread or cpu list), return -1 on error */
+int affinity_init(struct affinity *aff, const char *policy, int rt_prio);
+void affinity_destroy(struct affinity *aff);
+
+/* cpu for worker or -1 if not pinned */
+int affinity_cpu(const struct affinity *aff, int idx);
+
+/*
+ * Pin calling thread to cpu for worker, prefer memory from local NUMA node
+ * (buffers, allocated after this call, are node-local) and set realtime
+ * scheduler if requested. Return -1 on error (errno is set).
+ */
+int affinity_apply(const struct affinity *aff, int idx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SRVCOMMON_AFFINITY_H_ */
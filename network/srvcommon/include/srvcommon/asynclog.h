@@ -0,0 +1,76 @@
+#ifndef _SRVCOMMON_ASYNCLOG_H_
+#define _SRVCOMMON_ASYNCLOG_H_
+
+#include <syslog.h>
+
+/*
+ * Asynchronous logger for hot path events (connect, close, session errors).
+ *
+ * Messages are formatted by producer into fixed size records of lock-free
+ * bounded rings in anonymous shared mmap, so forked workers and per-request
+ * children log without syscalls. Background flusher thread (in long-lived
+ * parent process) drains rings and write batches to file (one write) or to
+ * syslog socket (one sendmmsg).
+ * Prefork worker own ring (alog_set_ring), other processes share rings by
+ * pid hash. On full ring message is dropped and counted.
+ * Rings live in memfd, so spawned (exec) session executable attach them
+ * with alog_attach on descriptor, passed as ALOG_SHM_FD.
+ *
+ * Level is checked before formatting, connection events can be sampled
+ * (log only one of N).
+ */
+
+#define ALOG_RING_SIZE 1024 /* records per ring, power of 2 */
+#define ALOG_REC_SIZE 256   /* record size, message is truncated to fit */
+#define ALOG_SHM_FD 3       /* rings descriptor in spawned session */
+
+extern int alog_level;
+
+/*
+ * Create rings and open output: NULL or "syslog" - syslog socket, "stderr" or
+ * file path. Call before fork of workers. Return -1 on error (errno is set).
+ */
+int alog_init(const char *ident, const char *output, int facility, int level,
+              int rings, int sample);
+
+/* start flusher thread, call in process, which live until server shutdown */
+int alog_start();
+
+/* flush pending messages, stop flusher and close output */
+void alog_stop();
+
+/*
+ * Attach to rings of parent (in spawned executable) and close FD.
+ * Return -1 on error (errno is set).
+ */
+int alog_attach(int fd);
+
+/* rings descriptor for pass to spawned executable, -1 if not initialized */
+int alog_shm_fd();
+
+/* bind current process to own ring (prefork worker) */
+void alog_set_ring(int idx);
+
+/* parse level name (err, warning, notice, info, debug), return -1 if invalid */
+int alog_level_parse(const char *s);
+
+/* return 1 if sampled connection event must be logged */
+int alog_sample();
+
+void alog_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#define ALOG(level, ...)                                                       \
+    do {                                                                       \
+        if ((level) <= alog_level)                                             \
+            alog_write((level), __VA_ARGS__);                                  \
+    } while (0)
+
+/* per-connection event, subject of sampling */
+#define ALOG_SAMPLED(level, ...)                                               \
+    do {                                                                       \
+        if ((level) <= alog_level && alog_sample())                            \
+            alog_write((level), __VA_ARGS__);                                  \
+    } while (0)
+
+#endif /* _SRVCOMMON_ASYNCLOG_H_ */
@@ -0,0 +1,61 @@
+#ifndef _SRVCOMMON_SCOREBOARD_H_
+#define _SRVCOMMON_SCOREBOARD_H_
+
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+/*
+ * Prefork workers scoreboard, shared between master and workers (anonymous
+ * shared mmap, created in master before fork).
+ * Worker publish its own slot, master only read slots and reset slots of died
+ * workers, so no locks needed.
+ */
+
+enum sb_state {
+    SB_FREE = 0,     /* no worker */
+    SB_STARTING = 1, /* forked, not ready */
+    SB_IDLE = 2,     /* ready for accept new connection */
+    SB_BUSY = 3,     /* can't accept new connection */
+    SB_EXITING = 4   /* graceful stop requested by master */
+};
+
+struct sb_slot {
+    atomic_int pid;
+    atomic_int state;
+    atomic_long connections; /* active connections */
+} __attribute__((aligned(CACHE_LINE)));
+
+struct scoreboard {
+    int size;
+    struct sb_slot *slots;
+};
+
+struct scoreboard *scoreboard_new(int size);
+void scoreboard_free(struct scoreboard *sb);
+
+/* return slot index for pid or -1 */
+int scoreboard_find(const struct scoreboard *sb, pid_t pid);
+/* return index of free slot or -1 */
+int scoreboard_find_free(const struct scoreboard *sb);
+/* count workers (not free slots) and idle workers (starting counted as idle) */
+void scoreboard_count(const struct scoreboard *sb, int *total, int *idle);
+
+static inline int sb_get_state(struct sb_slot *slot) {
+    return atomic_load_explicit(&slot->state, memory_order_acquire);
+}
+
+static inline void sb_set_state(struct sb_slot *slot, int state) {
+    atomic_store_explicit(&slot->state, state, memory_order_release);
+}
+
+/* change state, if not changed by other side (master set SB_EXITING) */
+static inline int sb_cas_state(struct sb_slot *slot, int from, int to) {
+    return atomic_compare_exchange_strong_explicit(
+        &slot->state, &from, to, memory_order_acq_rel, memory_order_acquire);
+}
+
+#endif /* _SRVCOMMON_SCOREBOARD_H_ */
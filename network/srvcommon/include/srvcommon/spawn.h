@@ -0,0 +1,39 @@
+#ifndef _SRVCOMMON_SPAWN_H_
+#define _SRVCOMMON_SPAWN_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Session process creation for process-per-request servers.
+ *
+ * fork   - copy of server process (page tables copied, cost grows with RSS)
+ * vfork  - clone(CLONE_VM | CLONE_VFORK) and exec of session executable
+ * spawn  - posix_spawn of session executable
+ *
+ * Session executable get client socket as stdin/stdout (and asynclog rings as
+ * ALOG_SHM_FD, if log_fd is not -1), default signal handlers and empty
+ * signal mask.
+ */
+
+enum spawn_mode { SPAWN_FORK = 0, SPAWN_VFORK, SPAWN_POSIX };
+
+/* return spawn mode or -1 if invalid */
+int spawn_mode_parse(const char *s);
+
+const char *spawn_mode_name(int mode);
+
+/*
+ * Path to executable NAME in directory of current executable.
+ * Return -1 on error (errno is set).
+ */
+int spawn_exec_path(char *path, size_t size, const char *name);
+
+/*
+ * Start session executable (vfork or spawn mode).
+ * Return child pid or -1 on error (errno is set).
+ */
+pid_t spawn_session(int mode, const char *path, char *const argv[],
+                    int sess_fd, int log_fd);
+
+#endif /* _SRVCOMMON_SPAWN_H_ */
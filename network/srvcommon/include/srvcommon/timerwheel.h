@@ -0,0 +1,49 @@
+#ifndef _SRVCOMMON_TIMERWHEEL_H_
+#define _SRVCOMMON_TIMERWHEEL_H_
+
+/*
+ * Hashed timer wheel. Timer is linked into slot of expire tick (modulo slots
+ * count), timeouts longer than wheel are counted in rounds. Add and delete
+ * are O(1), tick visit only one slot.
+ * Timer is embedded into owner struct (intrusive list), no allocations.
+ */
+
+struct twheel_timer {
+    struct twheel_timer *prev, *next;
+    unsigned long rounds;
+};
+
+struct twheel {
+    struct twheel_timer *slots; /* list heads */
+    unsigned long mask;
+    unsigned long cur; /* current tick */
+    unsigned long count; /* pending timers */
+};
+
+/* slots is rounded up to power of 2, return -1 on error */
+int twheel_init(struct twheel *w, unsigned long slots);
+
+void twheel_free(struct twheel *w);
+
+static inline void twheel_timer_init(struct twheel_timer *t) {
+    t->prev = t->next = NULL;
+    t->rounds = 0;
+}
+
+static inline int twheel_pending(const struct twheel_timer *t) {
+    return t->next != NULL;
+}
+
+/* expire after TICKS ticks (at least 1) */
+void twheel_add(struct twheel *w, struct twheel_timer *t, unsigned long ticks);
+
+void twheel_del(struct twheel *w, struct twheel_timer *t);
+
+/*
+ * Advance wheel one tick and call FN for expired timers. Timer is removed
+ * before call, so FN may add it again or free owner.
+ */
+void twheel_tick(struct twheel *w,
+                 void (*fn)(struct twheel_timer *t, void *arg), void *arg);
+
+#endif /* _SRVCOMMON_TIMERWHEEL_H_ */
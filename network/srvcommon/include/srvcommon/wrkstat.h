@@ -0,0 +1,80 @@
+#ifndef _SRVCOMMON_WRKSTAT_H_
+#define _SRVCOMMON_WRKSTAT_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+/*
+ * Per-worker statistic, shared between master and workers (anonymous shared
+ * mmap, created in master before fork).
+ * Every slot has a single writer (worker), so counters updated without lock
+ * prefix, master read them with relaxed loads and merge on dump.
+ *
+ * Latency histogram buckets: values below 16 us are exact, greater values
+ * are grouped by power of two with 8 sub-buckets (max error 12.5%).
+ *
+ * Accept wakeups count returns from wait on listener, empty wakeups found no
+ * pending connection (lost race with other worker). Accept wait is time
+ * connection spent in accept queue, taken from TCP_INFO (ms resolution,
+ * lower bound if client already sent data).
+ */
+
+#define WRKSTAT_SUB_BITS 3
+#define WRKSTAT_LINEAR 16
+#define WRKSTAT_BUCKETS                                                        \
+    (WRKSTAT_LINEAR + (40 - 4) * (1 << WRKSTAT_SUB_BITS))
+
+struct wrkstat {
+    atomic_int pid;
+    atomic_ulong connections; /* accepted connections */
+    atomic_ulong bytes_in;
+    atomic_ulong bytes_out;
+    atomic_ulong errors;
+    atomic_ulong timeouts;
+    atomic_ulong wakeups;       /* accept wakeups */
+    atomic_ulong wakeups_empty; /* accept wakeups without connection */
+    atomic_ulong latency[WRKSTAT_BUCKETS];     /* request latency (us) */
+    atomic_ulong accept_wait[WRKSTAT_BUCKETS]; /* accept queue wait (us) */
+} __attribute__((aligned(CACHE_LINE)));
+
+struct wrkstat *wrkstat_new(int size);
+void wrkstat_free(struct wrkstat *st, int size);
+
+/* bind slot to new worker, counters are accumulated over slot workers */
+void wrkstat_start(struct wrkstat *st, pid_t pid);
+
+/* merge all slots and log totals and per-worker statistic */
+void wrkstat_dump(struct wrkstat *st, int size);
+
+/* count accepted connection and its accept queue wait */
+void wrkstat_accepted(struct wrkstat *st, int sess_fd);
+
+int wrkstat_bucket(uint64_t us);
+/* upper bound of bucket (us) */
+uint64_t wrkstat_bucket_value(int bucket);
+
+/* single writer increment, no atomic rmw needed */
+static inline void wrkstat_add(atomic_ulong *c, unsigned long v) {
+    atomic_store_explicit(
+        c, atomic_load_explicit(c, memory_order_relaxed) + v,
+        memory_order_relaxed);
+}
+
+static inline uint64_t wrkstat_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void wrkstat_latency(struct wrkstat *st, uint64_t start_us) {
+    uint64_t now = wrkstat_now_us();
+    wrkstat_add(&st->latency[wrkstat_bucket(now - start_us)], 1);
+}
+
+#endif /* _SRVCOMMON_WRKSTAT_H_ */
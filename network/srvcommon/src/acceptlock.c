@@ -0,0 +1,96 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <srvcommon/acceptlock.h>
+
+static const char *accept_modes[] = {"none", "mutex", "exclusive",
+                                     "reuseport"};
+
+#define ACCEPT_MODES ((int) (sizeof(accept_modes) / sizeof(accept_modes[0])))
+
+struct accept_lock {
+    pthread_mutex_t mutex;
+};
+
+int accept_mode_parse(const char *s) {
+    for (int i = 0; i < ACCEPT_MODES; i++) {
+        if (strcmp(s, accept_modes[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *accept_mode_name(int mode) {
+    if (mode < 0 || mode >= ACCEPT_MODES)
+        return "unknown";
+    return accept_modes[mode];
+}
+
+struct accept_lock *accept_lock_new() {
+    struct accept_lock *l;
+    pthread_mutexattr_t attr;
+    int err;
+    void *p = mmap(NULL, sizeof(struct accept_lock), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    l = (struct accept_lock *) p;
+    if ((err = pthread_mutexattr_init(&attr)) != 0)
+        goto ERROR;
+    if ((err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)) ==
+            0 &&
+        (err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)) == 0)
+        err = pthread_mutex_init(&l->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (err == 0)
+        return l;
+ERROR:
+    munmap(p, sizeof(struct accept_lock));
+    errno = err;
+    return NULL;
+}
+
+void accept_lock_free(struct accept_lock *l) {
+    if (l == NULL)
+        return;
+    pthread_mutex_destroy(&l->mutex);
+    munmap(l, sizeof(struct accept_lock));
+}
+
+int accept_lock_acquire(struct accept_lock *l, int timeout_ms) {
+    int err;
+    if (timeout_ms > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += timeout_ms / 1000;
+        ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        err = pthread_mutex_timedlock(&l->mutex, &ts);
+    } else {
+        err = pthread_mutex_trylock(&l->mutex);
+    }
+    switch (err) {
+    case 0:
+        return 1;
+    case EOWNERDEAD:
+        /* previous owner died, nothing to recover except lock itself */
+        pthread_mutex_consistent(&l->mutex);
+        return 1;
+    case EBUSY:
+    case ETIMEDOUT:
+        return 0;
+    default:
+        errno = err;
+        return -1;
+    }
+}
+
+void accept_lock_release(struct accept_lock *l) {
+    pthread_mutex_unlock(&l->mutex);
+}
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <srvcommon/affinity.h>
+
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
+#endif
+
+struct cpu_topo {
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int sibling; /* thread index in core */
+    int core_idx; /* core index in node */
+};
+
+static int read_int(const char *fmt, int cpu, int def) {
+    char path[256];
+    FILE *f;
+    int v;
+    snprintf(path, sizeof(path), fmt, cpu);
+    if ((f = fopen(path, "r")) == NULL)
+        return def;
+    if (fscanf(f, "%d", &v) != 1)
+        v = def;
+    fclose(f);
+    return v;
+}
+
+static int cpu_node(int cpu) {
+    char path[256];
+    for (int node = 0; node < 1024; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d",
+                 cpu, node);
+        if (access(path, F_OK) == 0)
+            return node;
+    }
+    return 0;
+}
+
+static int cmp_compact(const void *a, const void *b) {
+    const struct cpu_topo *x = a, *y = b;
+    if (x->node != y->node)
+        return x->node - y->node;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static int cmp_spread(const void *a, const void *b) {
+    const struct cpu_topo *x = a, *y = b;
+    if (x->sibling != y->sibling)
+        return x->sibling - y->sibling;
+    if (x->core_idx != y->core_idx)
+        return x->core_idx - y->core_idx;
+    if (x->node != y->node)
+        return x->node - y->node;
+    return x->cpu - y->cpu;
+}
+
+/* allowed cpus, ordered by topology */
+static int topology_order(struct affinity *aff, int policy) {
+    cpu_set_t set;
+    struct cpu_topo *topo;
+    int n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == -1)
+        return -1;
+    topo = calloc(CPU_COUNT(&set), sizeof(struct cpu_topo));
+    if (topo == NULL)
+        return -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set))
+            continue;
+        topo[n].cpu = cpu;
+        topo[n].node = cpu_node(cpu);
+        topo[n].package = read_int(
+            "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu,
+            0);
+        topo[n].core =
+            read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu, cpu);
+        n++;
+    }
+    /* compact order group siblings, so ranks are easy to calculate */
+    qsort(topo, n, sizeof(struct cpu_topo), cmp_compact);
+    for (int i = 0, core_idx = -1; i < n; i++) {
+        if (i > 0 && topo[i].node == topo[i - 1].node &&
+            topo[i].package == topo[i - 1].package &&
+            topo[i].core == topo[i - 1].core) {
+            topo[i].sibling = topo[i - 1].sibling + 1;
+            topo[i].core_idx = topo[i - 1].core_idx;
+        } else {
+            if (i == 0 || topo[i].node != topo[i - 1].node)
+                core_idx = 0;
+            else
+                core_idx++;
+            topo[i].sibling = 0;
+            topo[i].core_idx = core_idx;
+        }
+    }
+    if (policy == AFFINITY_SPREAD)
+        qsort(topo, n, sizeof(struct cpu_topo), cmp_spread);
+
+    aff->cpus = malloc(sizeof(int) * n);
+    if (aff->cpus == NULL) {
+        free(topo);
+        return -1;
+    }
+    for (int i = 0; i < n; i++)
+        aff->cpus[i] = topo[i].cpu;
+    aff->ncpu = n;
+    free(topo);
+    return 0;
+}
+
+/* parse cpu list, like 0,2,4-7 */
+static int parse_list(struct affinity *aff, const char *list) {
+    const char *p = list;
+    int n = 0, size = 16;
+    aff->cpus = malloc(sizeof(int) * size);
+    if (aff->cpus == NULL)
+        return -1;
+    while (*p) {
+        char *end;
+        long first, last;
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            goto ERROR;
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                goto ERROR;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (n == size) {
+                int *cpus = realloc(aff->cpus, sizeof(int) * size * 2);
+                if (cpus == NULL)
+                    goto ERROR;
+                aff->cpus = cpus;
+                size *= 2;
+            }
+            aff->cpus[n++] = (int) cpu;
+        }
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            goto ERROR;
+        p = end;
+    }
+    if (n == 0)
+        goto ERROR;
+    aff->ncpu = n;
+    return 0;
+ERROR:
+    free(aff->cpus);
+    aff->cpus = NULL;
+    errno = EINVAL;
+    return -1;
+}
+
+int affinity_init(struct affinity *aff, const char *policy, int rt_prio) {
+    aff->policy = AFFINITY_NONE;
+    aff->ncpu = 0;
+    aff->cpus = NULL;
+    aff->rt_prio = rt_prio;
+    if (rt_prio < 0 || rt_prio > sched_get_priority_max(SCHED_FIFO)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (policy == NULL || strcmp(policy, "none") == 0) {
+        return 0;
+    } else if (strcmp(policy, "compact") == 0) {
+        aff->policy = AFFINITY_COMPACT;
+        return topology_order(aff, aff->policy);
+    } else if (strcmp(policy, "spread") == 0) {
+        aff->policy = AFFINITY_SPREAD;
+        return topology_order(aff, aff->policy);
+    } else {
+        aff->policy = AFFINITY_LIST;
+        return parse_list(aff, policy);
+    }
+}
+
+void affinity_destroy(struct affinity *aff) {
+    free(aff->cpus);
+    aff->cpus = NULL;
+    aff->ncpu = 0;
+}
+
+int affinity_cpu(const struct affinity *aff, int idx) {
+    if (aff->policy == AFFINITY_NONE || aff->ncpu == 0)
+        return -1;
+    return aff->cpus[idx % aff->ncpu];
+}
+
+int affinity_apply(const struct affinity *aff, int idx) {
+    int cpu = affinity_cpu(aff, idx);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        /* on linux pid 0 is calling thread */
+        if (sched_setaffinity(0, sizeof(set), &set) == -1)
+            return -1;
+        /* first-touch allocations from node of pinned cpu */
+        if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) == -1 &&
+            errno != ENOSYS)
+            return -1;
+    }
+    if (aff->rt_prio > 0) {
+        struct sched_param param;
+        param.sched_priority = aff->rt_prio;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+            return -1;
+    }
+    return 0;
+}
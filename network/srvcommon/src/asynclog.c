@@ -0,0 +1,558 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <srvcommon/asynclog.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+#define ALOG_MSG_SIZE (ALOG_REC_SIZE - 24)
+#define ALOG_LINE_SIZE (ALOG_MSG_SIZE + 96) /* formatted record */
+#define ALOG_BATCH 64            /* records per write */
+#define ALOG_FLUSH_INTERVAL 10   /* flusher sleep on empty rings (ms) */
+#define ALOG_STALL_TIMEOUT 1000  /* check producer of unpublished record (ms) */
+
+/*
+ * Bounded multi-producer ring (D. Vyukov): record sequence is equal to
+ * position for free record and position + 1 for published one.
+ * Producer pid is set just after reserve, so flusher can skip record of
+ * died producer (preempted or stopped one will publish it later).
+ */
+struct alog_rec {
+    atomic_ulong seq;
+    uint64_t ts; /* realtime (us) */
+    atomic_int pid; /* 0 - free or owner is not known yet */
+    int16_t level;
+    uint16_t len;
+    char msg[ALOG_MSG_SIZE];
+};
+
+_Static_assert(sizeof(struct alog_rec) == ALOG_REC_SIZE, "alog record size");
+
+struct alog_ring {
+    atomic_ulong head __attribute__((aligned(CACHE_LINE))); /* producers */
+    atomic_ulong tail __attribute__((aligned(CACHE_LINE))); /* flusher */
+    unsigned long stalled_pos; /* unpublished record (flusher) */
+    uint64_t stalled_ts;
+    atomic_ulong dropped;
+    struct alog_rec recs[ALOG_RING_SIZE];
+};
+
+/* rings header, also read by processes attached after exec */
+struct alog_shm {
+    int nrings;
+    int level;
+    int sample;
+    atomic_ulong sampled; /* shared sample counter */
+} __attribute__((aligned(CACHE_LINE)));
+
+struct alog_batch {
+    int count;
+    size_t len;
+    struct iovec iov[ALOG_BATCH];
+    struct mmsghdr msgs[ALOG_BATCH];
+    char buf[ALOG_BATCH * ALOG_LINE_SIZE];
+};
+
+int alog_level = LOG_INFO;
+
+static struct {
+    struct alog_shm *shm;
+    size_t shm_size;
+    int shm_fd;
+    struct alog_ring *rings;
+    int nrings;
+    int ring;      /* ring of current process */
+    int own;       /* ring is owned by current process */
+    pid_t pid;
+    int sample;
+    unsigned long sampled;
+    int fd;        /* output */
+    int is_syslog;
+    int facility;
+    char ident[32];
+    long tz_off;   /* local time offset (s), cached at init */
+    pthread_t flusher;
+    int started;   /* flusher started in current process */
+    atomic_int stop;
+    unsigned long dropped; /* already reported drops */
+    struct alog_batch *batch;
+} lg = {.sample = 1, .fd = -1, .shm_fd = -1};
+
+static const char *levels[] = {"emerg", "alert",  "crit", "err",
+                               "warning", "notice", "info", "debug"};
+static const char *level_names[] = {"EMERG",   "ALERT",  "CRIT", "ERROR",
+                                    "WARNING", "NOTICE", "INFO", "DEBUG"};
+static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* flusher only buffer, don't copy page tables to forked children */
+static void *alloc_dontfork(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    madvise(p, size, MADV_DONTFORK);
+    return p;
+}
+
+static void alog_atfork_child() {
+    lg.pid = getpid();
+    lg.started = 0; /* flusher thread stay in parent */
+    lg.batch = NULL; /* not mapped in child */
+    if (!lg.own && lg.nrings > 0)
+        lg.ring = lg.pid % lg.nrings;
+}
+
+static int syslog_connect() {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, "/dev/log", sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int alog_level_parse(const char *s) {
+    if (strcmp(s, "error") == 0)
+        return LOG_ERR;
+    for (int i = 0; i < (int) (sizeof(levels) / sizeof(levels[0])); i++) {
+        if (strcmp(s, levels[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/* rings in memfd, so spawned session executable can attach it */
+static void *shm_create(size_t size) {
+    void *p;
+    int fd = memfd_create("asynclog", MFD_CLOEXEC);
+    if (fd == -1)
+        return MAP_FAILED;
+    if (fd <= ALOG_SHM_FD) {
+        /* don't clash with fds, passed to spawned session */
+        int nfd = fcntl(fd, F_DUPFD_CLOEXEC, ALOG_SHM_FD + 1);
+        close(fd);
+        if ((fd = nfd) == -1)
+            return MAP_FAILED;
+    }
+    if (ftruncate(fd, size) == -1 ||
+        (p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) ==
+            MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return MAP_FAILED;
+    }
+    lg.shm_fd = fd;
+    return p;
+}
+
+int alog_init(const char *ident, const char *output, int facility, int level,
+              int rings, int sample) {
+    static int atfork = 0;
+    time_t t = time(NULL);
+    struct tm tm;
+    size_t size = sizeof(struct alog_shm) + sizeof(struct alog_ring) * rings;
+    void *p;
+    if (rings < 1 || level < LOG_EMERG || level > LOG_DEBUG || sample < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (output == NULL || strcmp(output, "syslog") == 0) {
+        /* no syslog daemon (container), write to console like LOG_CONS */
+        if ((lg.fd = syslog_connect()) == -1)
+            lg.fd = STDERR_FILENO;
+        else
+            lg.is_syslog = 1;
+    } else if (strcmp(output, "stderr") == 0) {
+        lg.fd = STDERR_FILENO;
+    } else {
+        lg.fd = open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (lg.fd == -1)
+            return -1;
+    }
+    p = shm_create(size);
+    if (p == MAP_FAILED) {
+        int err = errno;
+        if (lg.fd != STDERR_FILENO)
+            close(lg.fd);
+        lg.fd = -1;
+        errno = err;
+        return -1;
+    }
+    lg.shm = (struct alog_shm *) p;
+    lg.shm_size = size;
+    lg.shm->nrings = rings;
+    lg.shm->level = level;
+    lg.shm->sample = sample;
+    atomic_init(&lg.shm->sampled, 0);
+    lg.rings = (struct alog_ring *) (lg.shm + 1);
+    lg.nrings = rings;
+    for (int i = 0; i < rings; i++) {
+        for (unsigned long j = 0; j < ALOG_RING_SIZE; j++) {
+            atomic_init(&lg.rings[i].recs[j].seq, j);
+            atomic_init(&lg.rings[i].recs[j].pid, 0);
+        }
+    }
+    strncpy(lg.ident, ident, sizeof(lg.ident) - 1);
+    lg.facility = facility;
+    lg.sample = sample;
+    lg.pid = getpid();
+    lg.ring = lg.pid % rings;
+    localtime_r(&t, &tm);
+    lg.tz_off = tm.tm_gmtoff;
+    alog_level = level;
+    if (!atfork) {
+        pthread_atfork(NULL, NULL, alog_atfork_child);
+        atfork = 1;
+    }
+    return 0;
+}
+
+int alog_attach(int fd) {
+    struct stat st;
+    struct alog_shm *shm;
+    void *p;
+    if (fstat(fd, &st) == -1)
+        return -1;
+    if ((size_t) st.st_size < sizeof(struct alog_shm)) {
+        errno = EINVAL;
+        return -1;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    shm = (struct alog_shm *) p;
+    if (shm->nrings < 1 ||
+        (size_t) st.st_size != sizeof(struct alog_shm) +
+                                   sizeof(struct alog_ring) * shm->nrings) {
+        munmap(p, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+    close(fd);
+    lg.shm = shm;
+    lg.shm_size = st.st_size;
+    lg.rings = (struct alog_ring *) (shm + 1);
+    lg.nrings = shm->nrings;
+    lg.sample = shm->sample;
+    lg.pid = getpid();
+    lg.ring = lg.pid % lg.nrings;
+    alog_level = shm->level;
+    return 0;
+}
+
+int alog_shm_fd() { return lg.shm_fd; }
+
+void alog_set_ring(int idx) {
+    if (lg.nrings > 0) {
+        lg.ring = idx % lg.nrings;
+        lg.own = 1;
+    }
+}
+
+int alog_sample() {
+    if (lg.sample <= 1)
+        return 1;
+    if (!lg.own && lg.shm) {
+        /* short-lived children, count across them */
+        unsigned long n = atomic_fetch_add_explicit(&lg.shm->sampled, 1,
+                                                    memory_order_relaxed);
+        return n % lg.sample == 0;
+    }
+    return lg.sampled++ % lg.sample == 0;
+}
+
+void alog_write(int level, const char *fmt, ...) {
+    va_list ap;
+    struct alog_ring *r;
+    struct alog_rec *rec;
+    unsigned long pos;
+    int n;
+
+    va_start(ap, fmt);
+    if (lg.rings == NULL) {
+        /* not initialized or already stopped */
+        vsyslog(level, fmt, ap);
+        va_end(ap);
+        return;
+    }
+    r = &lg.rings[lg.ring];
+    pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    for (;;) {
+        long diff;
+        rec = &r->recs[pos & (ALOG_RING_SIZE - 1)];
+        diff = (long) (atomic_load_explicit(&rec->seq, memory_order_acquire) -
+                       pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &r->head, &pos, pos + 1, memory_order_relaxed,
+                    memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            /* ring is full, flusher is behind */
+            atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+            va_end(ap);
+            return;
+        } else {
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+        }
+    }
+    atomic_store_explicit(&rec->pid, lg.pid, memory_order_relaxed);
+    rec->ts = now_us();
+    rec->level = level;
+    n = vsnprintf(rec->msg, ALOG_MSG_SIZE, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        n = 0;
+    else if (n >= ALOG_MSG_SIZE)
+        n = ALOG_MSG_SIZE - 1;
+    rec->len = n;
+    atomic_store_explicit(&rec->seq, pos + 1, memory_order_release);
+}
+
+/* days since epoch to civil date (H. Hinnant), localtime_r take tz lock */
+static void civil_date(long days, int *y, int *m, int *d) {
+    long era, yoe, doe, doy, mp;
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = days - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+static void batch_flush(struct alog_batch *b) {
+    if (b->count == 0)
+        return;
+    if (lg.is_syslog) {
+        int sent = 0;
+        for (int i = 0; i < b->count; i++) {
+            memset(&b->msgs[i].msg_hdr, 0, sizeof(b->msgs[i].msg_hdr));
+            b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+            b->msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        while (sent < b->count) {
+            int n = sendmmsg(lg.fd, b->msgs + sent, b->count - sent, 0);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                /* syslog daemon restarted, reconnect and drop batch */
+                int fd = syslog_connect();
+                if (fd != -1) {
+                    close(lg.fd);
+                    lg.fd = fd;
+                }
+                break;
+            }
+            sent += n;
+        }
+    } else {
+        size_t pos = 0;
+        while (pos < b->len) {
+            ssize_t n = write(lg.fd, b->buf + pos, b->len - pos);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            pos += n;
+        }
+    }
+    b->count = 0;
+    b->len = 0;
+}
+
+static void batch_add(struct alog_batch *b, uint64_t ts, int pid, int level,
+                      const char *msg, int len) {
+    char *line;
+    int n, y, m, d;
+    long sec = (long) (ts / 1000000) + lg.tz_off;
+    long days = sec / 86400, tod = sec % 86400;
+    if (tod < 0) {
+        tod += 86400;
+        days--;
+    }
+    if (b->count == ALOG_BATCH)
+        batch_flush(b);
+    line = b->buf + b->len;
+    civil_date(days, &y, &m, &d);
+    if (lg.is_syslog) {
+        n = snprintf(line, ALOG_LINE_SIZE,
+                     "<%d>%s %2d %02ld:%02ld:%02ld %s[%d]: %.*s",
+                     lg.facility | level, months[m - 1], d, tod / 3600,
+                     tod / 60 % 60, tod % 60, lg.ident, pid, len, msg);
+    } else {
+        n = snprintf(line, ALOG_LINE_SIZE,
+                     "%04d-%02d-%02d %02ld:%02ld:%02ld.%06lu %s[%d] %s: %.*s\n",
+                     y, m, d, tod / 3600, tod / 60 % 60, tod % 60,
+                     (unsigned long) (ts % 1000000), lg.ident, pid,
+                     level_names[level & LOG_PRIMASK], len, msg);
+    }
+    if (n >= ALOG_LINE_SIZE)
+        n = ALOG_LINE_SIZE - 1;
+    b->iov[b->count].iov_base = line;
+    b->iov[b->count].iov_len = n;
+    b->count++;
+    b->len += n;
+}
+
+/* drain published records of all rings, return drained count */
+static int alog_drain(struct alog_batch *b) {
+    int count = 0;
+    unsigned long dropped = 0;
+    for (int i = 0; i < lg.nrings; i++) {
+        struct alog_ring *r = &lg.rings[i];
+        unsigned long pos =
+            atomic_load_explicit(&r->tail, memory_order_relaxed);
+        for (;;) {
+            struct alog_rec *rec = &r->recs[pos & (ALOG_RING_SIZE - 1)];
+            unsigned long seq =
+                atomic_load_explicit(&rec->seq, memory_order_acquire);
+            if (seq != pos + 1) {
+                if (atomic_load_explicit(&r->head, memory_order_relaxed) ==
+                    pos)
+                    break; /* empty */
+                /*
+                 * reserved, but not published: producer is preempted,
+                 * stopped or died inside alog_write. Record can be skipped
+                 * only if producer is gone, live one will write it later.
+                 */
+                if (r->stalled_ts == 0 || r->stalled_pos != pos) {
+                    r->stalled_pos = pos;
+                    r->stalled_ts = now_us();
+                    break;
+                } else if (now_us() - r->stalled_ts <
+                           ALOG_STALL_TIMEOUT * 1000) {
+                    break;
+                } else {
+                    int pid = atomic_load_explicit(&rec->pid,
+                                                   memory_order_relaxed);
+                    if (pid == 0 || kill(pid, 0) == 0 || errno != ESRCH)
+                        break;
+                }
+                r->stalled_ts = 0;
+                atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+            } else {
+                batch_add(b, rec->ts,
+                          atomic_load_explicit(&rec->pid,
+                                               memory_order_relaxed),
+                          rec->level, rec->msg, rec->len);
+                count++;
+            }
+            atomic_store_explicit(&rec->pid, 0, memory_order_relaxed);
+            atomic_store_explicit(&rec->seq, pos + ALOG_RING_SIZE,
+                                  memory_order_release);
+            pos++;
+            atomic_store_explicit(&r->tail, pos, memory_order_relaxed);
+        }
+        dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+    }
+    if (dropped > lg.dropped) {
+        char msg[64];
+        int n = snprintf(msg, sizeof(msg), "asynclog: %lu messages dropped",
+                         dropped - lg.dropped);
+        batch_add(b, now_us(), getpid(), LOG_WARNING, msg, n);
+        lg.dropped = dropped;
+    }
+    batch_flush(b);
+    return count;
+}
+
+static void *alog_flusher(void *arg) {
+    struct alog_batch *b = (struct alog_batch *) arg;
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = ALOG_FLUSH_INTERVAL * 1000000L;
+    for (;;) {
+        int stop = atomic_load_explicit(&lg.stop, memory_order_acquire);
+        int n = alog_drain(b);
+        if (n == 0) {
+            if (stop)
+                break;
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+int alog_start() {
+    sigset_t mask, old;
+    int err;
+    if (lg.rings == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* allocated here, not in alog_init: alog_start run in process with
+       flusher (after daemon fork) */
+    lg.batch = alloc_dontfork(sizeof(struct alog_batch));
+    if (lg.batch == NULL)
+        return -1;
+    /* signals must be handled in main thread */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, &old);
+    atomic_store_explicit(&lg.stop, 0, memory_order_relaxed);
+    err = pthread_create(&lg.flusher, NULL, alog_flusher, lg.batch);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err) {
+        munmap(lg.batch, sizeof(struct alog_batch));
+        lg.batch = NULL;
+        errno = err;
+        return -1;
+    }
+    lg.started = 1;
+    return 0;
+}
+
+void alog_stop() {
+    if (!lg.started)
+        return;
+    atomic_store_explicit(&lg.stop, 1, memory_order_release);
+    pthread_join(lg.flusher, NULL);
+    lg.started = 0;
+    munmap(lg.shm, lg.shm_size);
+    lg.shm = NULL;
+    lg.rings = NULL;
+    lg.nrings = 0;
+    close(lg.shm_fd);
+    lg.shm_fd = -1;
+    munmap(lg.batch, sizeof(struct alog_batch));
+    lg.batch = NULL;
+    if (lg.fd != STDERR_FILENO)
+        close(lg.fd);
+    lg.fd = -1;
+    lg.is_syslog = 0;
+}
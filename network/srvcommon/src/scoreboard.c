@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <srvcommon/scoreboard.h>
+
+struct scoreboard *scoreboard_new(int size) {
+    struct scoreboard *sb;
+    void *p;
+    if (size <= 0)
+        return NULL;
+    sb = malloc(sizeof(struct scoreboard));
+    if (sb == NULL)
+        return NULL;
+    p = mmap(NULL, sizeof(struct sb_slot) * size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        free(sb);
+        return NULL;
+    }
+    /* anonymous mapping is zero filled, so all slots are SB_FREE */
+    sb->size = size;
+    sb->slots = (struct sb_slot *) p;
+    return sb;
+}
+
+void scoreboard_free(struct scoreboard *sb) {
+    if (sb == NULL)
+        return;
+    munmap(sb->slots, sizeof(struct sb_slot) * sb->size);
+    free(sb);
+}
+
+int scoreboard_find(const struct scoreboard *sb, pid_t pid) {
+    for (int i = 0; i < sb->size; i++) {
+        if (atomic_load_explicit(&sb->slots[i].pid, memory_order_relaxed) ==
+            pid)
+            return i;
+    }
+    return -1;
+}
+
+int scoreboard_find_free(const struct scoreboard *sb) {
+    for (int i = 0; i < sb->size; i++) {
+        if (sb_get_state(&sb->slots[i]) == SB_FREE)
+            return i;
+    }
+    return -1;
+}
+
+void scoreboard_count(const struct scoreboard *sb, int *total, int *idle) {
+    *total = 0;
+    *idle = 0;
+    for (int i = 0; i < sb->size; i++) {
+        int state = sb_get_state(&sb->slots[i]);
+        if (state != SB_FREE)
+            (*total)++;
+        if (state == SB_IDLE || state == SB_STARTING)
+            (*idle)++;
+    }
+}
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <srvcommon/asynclog.h>
+#include <srvcommon/spawn.h>
+
+#define SPAWN_STACK_SIZE (64 * 1024) /* vfork child stack (until exec) */
+
+extern char **environ;
+
+static const char *spawn_modes[] = {"fork", "vfork", "spawn"};
+
+#define SPAWN_MODES ((int) (sizeof(spawn_modes) / sizeof(spawn_modes[0])))
+
+struct spawn_args {
+    const char *path;
+    char *const *argv;
+    int sess_fd;
+    int log_fd;
+    int err; /* exec error, set by child */
+};
+
+int spawn_mode_parse(const char *s) {
+    for (int i = 0; i < SPAWN_MODES; i++) {
+        if (strcmp(s, spawn_modes[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+const char *spawn_mode_name(int mode) {
+    if (mode < 0 || mode >= SPAWN_MODES)
+        return "unknown";
+    return spawn_modes[mode];
+}
+
+int spawn_exec_path(char *path, size_t size, const char *name) {
+    char *p;
+    size_t left;
+    ssize_t n = readlink("/proc/self/exe", path, size - 1);
+    if (n == -1)
+        return -1;
+    path[n] = '\0';
+    if ((p = strrchr(path, '/')) == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    p++;
+    left = size - (p - path);
+    if ((size_t) snprintf(p, left, "%s", name) >= left) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* run on parent memory (parent is suspended), only syscalls before exec */
+static int vfork_child(void *arg) {
+    struct spawn_args *a = (struct spawn_args *) arg;
+    struct sigaction sa;
+    sigset_t none;
+
+    /* parent handlers touch parent state, reset before unblock */
+    memset(&sa, 0, sizeof(sa));
+    for (int sig = 1; sig < NSIG; sig++) {
+        struct sigaction old;
+        if (sigaction(sig, NULL, &old) == 0 && old.sa_handler != SIG_IGN &&
+            old.sa_handler != SIG_DFL) {
+            sa.sa_handler = SIG_DFL;
+            sigaction(sig, &sa, NULL);
+        }
+    }
+    if (dup2(a->sess_fd, STDIN_FILENO) == -1 ||
+        dup2(a->sess_fd, STDOUT_FILENO) == -1)
+        goto ERROR;
+    if (a->log_fd != -1 && dup2(a->log_fd, ALOG_SHM_FD) == -1)
+        goto ERROR;
+    /* parent may block signals (signalfd), session get them */
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    execve(a->path, a->argv, environ);
+ERROR:
+    a->err = errno;
+    _exit(127);
+}
+
+static pid_t spawn_vfork(const char *path, char *const argv[], int sess_fd,
+                         int log_fd) {
+    static char *stack = NULL; /* reused, parent wait exec of child */
+    struct spawn_args a;
+    sigset_t all, old;
+    pid_t pid;
+    int err;
+
+    if (stack == NULL) {
+        void *p = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (p == MAP_FAILED)
+            return -1;
+        stack = (char *) p;
+    }
+
+    a.path = path;
+    a.argv = argv;
+    a.sess_fd = sess_fd;
+    a.log_fd = log_fd;
+    a.err = 0;
+
+    /* no parent handlers in child until it reset them */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pid = clone(vfork_child, stack + SPAWN_STACK_SIZE,
+                CLONE_VM | CLONE_VFORK | SIGCHLD, &a);
+    err = errno;
+    if (pid != -1 && a.err != 0) {
+        /* exec failed, reap before SIGCHLD handler can see it */
+        waitpid(pid, NULL, 0);
+        err = a.err;
+        pid = -1;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (pid == -1)
+        errno = err;
+    return pid;
+}
+
+static pid_t spawn_posix(const char *path, char *const argv[], int sess_fd,
+                         int log_fd) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t none, all;
+    pid_t pid;
+    int err;
+
+    if ((err = posix_spawn_file_actions_init(&fa)) != 0)
+        goto EXIT;
+    if ((err = posix_spawnattr_init(&attr)) != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        goto EXIT;
+    }
+    sigemptyset(&none);
+    sigfillset(&all);
+    if ((err = posix_spawn_file_actions_adddup2(&fa, sess_fd, STDIN_FILENO)) ||
+        (err = posix_spawn_file_actions_adddup2(&fa, sess_fd, STDOUT_FILENO)))
+        goto DESTROY;
+    if (log_fd != -1 &&
+        (err = posix_spawn_file_actions_adddup2(&fa, log_fd, ALOG_SHM_FD)))
+        goto DESTROY;
+    if ((err = posix_spawnattr_setsigmask(&attr, &none)) ||
+        (err = posix_spawnattr_setsigdefault(&attr, &all)) ||
+        (err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                                                   POSIX_SPAWN_SETSIGDEF |
+                                                   POSIX_SPAWN_USEVFORK)))
+        goto DESTROY;
+    err = posix_spawn(&pid, path, &fa, &attr, argv, environ);
+DESTROY:
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+EXIT:
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t spawn_session(int mode, const char *path, char *const argv[],
+                    int sess_fd, int log_fd) {
+    switch (mode) {
+    case SPAWN_VFORK:
+        return spawn_vfork(path, argv, sess_fd, log_fd);
+    case SPAWN_POSIX:
+        return spawn_posix(path, argv, sess_fd, log_fd);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include <srvcommon/timerwheel.h>
+
+static void list_insert(struct twheel_timer *head, struct twheel_timer *t) {
+    t->next = head->next;
+    t->prev = head;
+    head->next->prev = t;
+    head->next = t;
+}
+
+static void list_unlink(struct twheel_timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = t->next = NULL;
+}
+
+int twheel_init(struct twheel *w, unsigned long slots) {
+    unsigned long n = 1;
+    while (n < slots)
+        n <<= 1;
+    w->slots = malloc(n * sizeof(struct twheel_timer));
+    if (w->slots == NULL)
+        return -1;
+    /* empty slot is circular list of head only */
+    for (unsigned long i = 0; i < n; i++)
+        w->slots[i].prev = w->slots[i].next = &w->slots[i];
+    w->mask = n - 1;
+    w->cur = 0;
+    w->count = 0;
+    return 0;
+}
+
+void twheel_free(struct twheel *w) {
+    free(w->slots);
+    w->slots = NULL;
+}
+
+void twheel_add(struct twheel *w, struct twheel_timer *t, unsigned long ticks) {
+    if (ticks == 0)
+        ticks = 1;
+    if (twheel_pending(t))
+        twheel_del(w, t);
+    t->rounds = (ticks - 1) / (w->mask + 1);
+    list_insert(&w->slots[(w->cur + ticks) & w->mask], t);
+    w->count++;
+}
+
+void twheel_del(struct twheel *w, struct twheel_timer *t) {
+    if (!twheel_pending(t))
+        return;
+    list_unlink(t);
+    w->count--;
+}
+
+void twheel_tick(struct twheel *w,
+                 void (*fn)(struct twheel_timer *t, void *arg), void *arg) {
+    struct twheel_timer *head, *t, *next;
+    struct twheel_timer expired;
+
+    w->cur++;
+    head = &w->slots[w->cur & w->mask];
+    expired.prev = expired.next = &expired;
+    /* move expired to local list, fn may add timers to this slot */
+    for (t = head->next; t != head; t = next) {
+        next = t->next;
+        if (t->rounds > 0) {
+            t->rounds--;
+        } else {
+            list_unlink(t);
+            list_insert(&expired, t);
+        }
+    }
+    /* still pending, until fn call (fn may delete other expired timer) */
+    while (expired.next != &expired) {
+        t = expired.next;
+        list_unlink(t);
+        w->count--;
+        fn(t, arg);
+    }
+}
@@ -0,0 +1,159 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <c_procs/logutils/syslogutils.h>
+
+#include <srvcommon/wrkstat.h>
+
+struct wrkstat *wrkstat_new(int size) {
+    void *p;
+    if (size <= 0)
+        return NULL;
+    p = mmap(NULL, sizeof(struct wrkstat) * size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    return (struct wrkstat *) p;
+}
+
+void wrkstat_free(struct wrkstat *st, int size) {
+    if (st)
+        munmap(st, sizeof(struct wrkstat) * size);
+}
+
+void wrkstat_start(struct wrkstat *st, pid_t pid) {
+    atomic_store_explicit(&st->pid, pid, memory_order_relaxed);
+}
+
+void wrkstat_accepted(struct wrkstat *st, int sess_fd) {
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    wrkstat_add(&st->connections, 1);
+    /* last data receive time is set on handshake completion */
+    if (getsockopt(sess_fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0)
+        wrkstat_add(&st->accept_wait[wrkstat_bucket(
+                        (uint64_t) ti.tcpi_last_data_recv * 1000)],
+                    1);
+}
+
+int wrkstat_bucket(uint64_t us) {
+    int e, sub, bucket;
+    if (us < WRKSTAT_LINEAR)
+        return (int) us;
+    e = 63 - __builtin_clzll(us);
+    sub = (us >> (e - WRKSTAT_SUB_BITS)) & ((1 << WRKSTAT_SUB_BITS) - 1);
+    bucket = WRKSTAT_LINEAR + ((e - 4) << WRKSTAT_SUB_BITS) + sub;
+    if (bucket >= WRKSTAT_BUCKETS)
+        bucket = WRKSTAT_BUCKETS - 1;
+    return bucket;
+}
+
+uint64_t wrkstat_bucket_value(int bucket) {
+    int e, sub;
+    if (bucket < WRKSTAT_LINEAR)
+        return bucket;
+    e = ((bucket - WRKSTAT_LINEAR) >> WRKSTAT_SUB_BITS) + 4;
+    sub = (bucket - WRKSTAT_LINEAR) & ((1 << WRKSTAT_SUB_BITS) - 1);
+    return (((uint64_t) ((1 << WRKSTAT_SUB_BITS) + sub) + 1)
+            << (e - WRKSTAT_SUB_BITS)) - 1;
+}
+
+struct wrkstat_sum {
+    unsigned long connections;
+    unsigned long requests;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+    unsigned long errors;
+    unsigned long timeouts;
+    unsigned long wakeups;
+    unsigned long wakeups_empty;
+    unsigned long accepts; /* connections with accept wait sample */
+    unsigned long latency[WRKSTAT_BUCKETS];
+    unsigned long accept_wait[WRKSTAT_BUCKETS];
+};
+
+static void wrkstat_merge(struct wrkstat_sum *sum, struct wrkstat *st) {
+    sum->connections +=
+        atomic_load_explicit(&st->connections, memory_order_relaxed);
+    sum->bytes_in += atomic_load_explicit(&st->bytes_in, memory_order_relaxed);
+    sum->bytes_out +=
+        atomic_load_explicit(&st->bytes_out, memory_order_relaxed);
+    sum->errors += atomic_load_explicit(&st->errors, memory_order_relaxed);
+    sum->timeouts += atomic_load_explicit(&st->timeouts, memory_order_relaxed);
+    sum->wakeups += atomic_load_explicit(&st->wakeups, memory_order_relaxed);
+    sum->wakeups_empty +=
+        atomic_load_explicit(&st->wakeups_empty, memory_order_relaxed);
+    for (int i = 0; i < WRKSTAT_BUCKETS; i++) {
+        unsigned long n =
+            atomic_load_explicit(&st->latency[i], memory_order_relaxed);
+        sum->latency[i] += n;
+        sum->requests += n; /* every served request has latency sample */
+        n = atomic_load_explicit(&st->accept_wait[i], memory_order_relaxed);
+        sum->accept_wait[i] += n;
+        sum->accepts += n;
+    }
+}
+
+static unsigned long percentile(const unsigned long *hist, unsigned long count,
+                                double p) {
+    unsigned long need, n = 0;
+    if (count == 0)
+        return 0;
+    need = (unsigned long) (p * count);
+    if (need == 0)
+        need = 1;
+    for (int i = 0; i < WRKSTAT_BUCKETS; i++) {
+        n += hist[i];
+        if (n >= need)
+            return (unsigned long) wrkstat_bucket_value(i);
+    }
+    return (unsigned long) wrkstat_bucket_value(WRKSTAT_BUCKETS - 1);
+}
+
+static void wrkstat_log(const char *name, pid_t pid,
+                        const struct wrkstat_sum *sum) {
+    _LOG_NOTICE(root_logger,
+                "stat %s pid %d: connections %lu requests %lu in %lu out %lu "
+                "errors %lu timeouts %lu latency(us) p50 %lu p90 %lu p99 %lu "
+                "p999 %lu wakeups %lu empty %lu accept wait(us) p50 %lu "
+                "p99 %lu max %lu",
+                name, pid, sum->connections, sum->requests, sum->bytes_in,
+                sum->bytes_out, sum->errors, sum->timeouts,
+                percentile(sum->latency, sum->requests, 0.5),
+                percentile(sum->latency, sum->requests, 0.9),
+                percentile(sum->latency, sum->requests, 0.99),
+                percentile(sum->latency, sum->requests, 0.999), sum->wakeups,
+                sum->wakeups_empty,
+                percentile(sum->accept_wait, sum->accepts, 0.5),
+                percentile(sum->accept_wait, sum->accepts, 0.99),
+                percentile(sum->accept_wait, sum->accepts, 1.0));
+}
+
+void wrkstat_dump(struct wrkstat *st, int size) {
+    struct wrkstat_sum *total, *sum;
+    char name[32];
+    total = calloc(2, sizeof(struct wrkstat_sum));
+    if (total == NULL) {
+        _LOG_ERROR(root_logger, "%s", "alloc stat");
+        return;
+    }
+    sum = total + 1;
+    for (int i = 0; i < size; i++) {
+        memset(sum, 0, sizeof(struct wrkstat_sum));
+        wrkstat_merge(sum, &st[i]);
+        if (sum->connections == 0 && sum->requests == 0)
+            continue; /* slot never used */
+        wrkstat_merge(total, &st[i]);
+        snprintf(name, sizeof(name), "worker %d", i);
+        wrkstat_log(name, atomic_load_explicit(&st[i].pid, memory_order_relaxed),
+                    sum);
+    }
+    wrkstat_log("total", getpid(), total);
+    free(total);
+}